@@ -0,0 +1,133 @@
+/**
+ * Compares ActionValueTable with FixedActionValueTable on grid worlds.
+ *
+ * Two workloads are timed:
+ *   1. Random set_value()/best_action() calls, as done by TD control methods.
+ *   2. Q-learning via QLearningImprover::improve_using().
+ *
+ * Usage: runBenchmarks [repeat count]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rl/ActionValueTable.h"
+#include "rl/FixedActionValueTable.h"
+#include "rl/GridWorld.h"
+#include "rl/Policy.h"
+#include "rl/QLearningImprover.h"
+#include "util/random.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/**
+ * Creates the table as QLearningImprover::improve() would: ActionValueTable has its greedy cache
+ * enabled.
+ */
+template<typename ValueFunction>
+ValueFunction create_table(const rl::Environment& env) {
+    return ValueFunction(env);
+}
+
+template<>
+rl::ActionValueTable create_table<rl::ActionValueTable>(const rl::Environment& env) {
+    rl::ActionValueTable value_function(env);
+    value_function.enable_greedy_cache();
+    return value_function;
+}
+
+/**
+ * Runs a fixed, seeded sequence of updates and greedy lookups of allowed state-action pairs.
+ *
+ * \returns a checksum, so that the work can't be optimized away (and so that the table types can
+ *          be checked to give the same results).
+ */
+template<typename ValueFunction>
+double run_table_updates(const rl::Environment& env, ValueFunction& value_function,
+                         long update_count) {
+    rl::util::random::reseed_generator(1);
+    double checksum = 0;
+    for(long i = 0; i < update_count; i++) {
+        const rl::State& s = env.state(rl::util::random::random_in_range(0, env.state_count()));
+        const rl::Action* a = &env.action(rl::util::random::random_in_range(0, env.action_count()));
+        while(!env.is_end_state(s) and !env.is_action_allowed(s, *a)) {
+            a = &env.action(rl::util::random::random_in_range(0, env.action_count()));
+        }
+        double current = value_function.value(s, *a);
+        double best = value_function.best_action(s).second;
+        value_function.set_value(s, *a, current + 0.1 * (-1 + best - current));
+        checksum += best;
+    }
+    return checksum;
+}
+
+template<typename ValueFunction>
+void bench_table(const std::string& name, const rl::Environment& env, long update_count,
+                 int repeats) {
+    double best_ms = std::numeric_limits<double>::max();
+    double checksum = 0;
+    for(int r = 0; r < repeats; r++) {
+        ValueFunction value_function = create_table<ValueFunction>(env);
+        Clock::time_point start = Clock::now();
+        checksum = run_table_updates(env, value_function, update_count);
+        best_ms = std::min(best_ms, elapsed_ms(start));
+    }
+    std::cout << "  " << std::left << std::setw(28) << name << std::right << std::setw(10)
+              << std::fixed << std::setprecision(2) << best_ms << " ms  (checksum "
+              << checksum << ")\n";
+}
+
+template<typename ValueFunction>
+void bench_qlearning(const std::string& name, const rl::Environment& env, int iterations,
+                     int repeats) {
+    rl::QLearningImprover improver;
+    improver.set_iteration_count(iterations);
+    double best_ms = std::numeric_limits<double>::max();
+    for(int r = 0; r < repeats; r++) {
+        rl::util::random::reseed_generator(1);
+        Clock::time_point start = Clock::now();
+        ValueFunction value_function = create_table<ValueFunction>(env);
+        std::unique_ptr<rl::Policy> policy = improver.improve_using(env, value_function);
+        best_ms = std::min(best_ms, elapsed_ms(start));
+    }
+    std::cout << "  " << std::left << std::setw(28) << name << std::right << std::setw(10)
+              << std::fixed << std::setprecision(2) << best_ms << " ms\n";
+}
+
+template<int HEIGHT, int WIDTH>
+void bench_grid(long update_count, int qlearning_iterations, int repeats) {
+    rl::GridWorld<HEIGHT, WIDTH> env(rl::GridWorldBoundsBehaviour::NO_OUT_OF_BOUNDS);
+    env.mark_as_end_state(env.pos_to_state(grid::Position{HEIGHT - 1, WIDTH - 1}));
+    std::cout << "GridWorld<" << HEIGHT << ", " << WIDTH << ">\n";
+    std::cout << " " << update_count << " random updates:\n";
+    bench_table<rl::ActionValueTable>("ActionValueTable", env, update_count, repeats);
+    bench_table<rl::FixedActionValueTable<4>>("FixedActionValueTable<4>", env, update_count,
+                                              repeats);
+    std::cout << " Q-learning, " << qlearning_iterations << " episodes:\n";
+    bench_qlearning<rl::ActionValueTable>("ActionValueTable", env, qlearning_iterations,
+                                          repeats);
+    bench_qlearning<rl::FixedActionValueTable<4>>("FixedActionValueTable<4>", env,
+                                                  qlearning_iterations, repeats);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int repeats = argc > 1 ? std::atoi(argv[1]) : 5;
+    bench_grid<4, 4>(10000000, 200000, repeats);
+    bench_grid<20, 20>(10000000, 20000, repeats);
+    bench_grid<100, 100>(10000000, 1000, repeats);
+    return 0;
+}
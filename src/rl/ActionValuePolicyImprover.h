@@ -26,12 +26,10 @@ public:
         while(!finished) {
             bool policy_updated = false;
             //const ActionValueTable& value_fctn = evaluate(evaluator_, env, *ans);
-            // TODO: Without loop detection, this call risks a possible infinite loop. For example,
-            // in a deterministic grid world, a trial might go:
-            //     (0,0), (0,1), (0,2), (0,3), (1, 3), (2, 3), (3, 3 [end]).
-            // This trial could make 'right' the highest scoring action for (0,2). Another trial
-            // might
-            // 0, while another trial might pass by tile
+            // note: Unless trial limits are set (see set_trial_limits()), this call can loop
+            // forever: in a deterministic grid world, the improved policy might move back and
+            // forth between two tiles and a trial would never end. With limits, such a trial is
+            // cut short and its pairs get the (poor) return truncated at the horizon.
             evaluator_.step();
             const ActionValueTable& value_fctn = evaluator_.value_function();
             for(const State& state : env.states()) {
@@ -106,6 +104,14 @@ public:
                 static_cast<const ActionValuePolicyImprover*>(this)->policy_evaluator());
     }
 
+    /**
+     * Bounds the trials of the default evaluator, see
+     * FirstVisitMCActionValuePredictor::set_trial_limits().
+     */
+    void set_trial_limits(const TrialLimits& limits) {
+        default_evaluator.set_trial_limits(limits);
+    }
+
     void set_policy_evaluator(const ActionBasedEvaluator& evaluator) {
         evaluator_ = evaluator;
     }
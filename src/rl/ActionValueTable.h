@@ -1,13 +1,26 @@
 #pragma once
 
 #include "rl/Environment.h"
+#include "rl/impl/TableStorage.h"
+#include "util/FlatIdMap.h"
 #include "glog/logging.h"
+#include <algorithm>
+#include <array>
+#include <limits>
 #include <vector>
 
 namespace rl {
 
 /**
  * Represents an action-value function.
+ *
+ * The values are held in a single row-major buffer, with each state's row padded to a multiple of
+ * LANE_COUNT values. The buffer is on the heap, or in a memory mapped file for tables created by
+ * open_mapped().
+ *
+ * A sparse table (create_sparse()) instead only allocates the rows of states that have been set.
+ * The rows are held in one growing buffer, located by a hash table keyed on the state ID. The
+ * values of the other states are the initial values of a dense table.
  */
 class ActionValueTable {
 public:
@@ -17,13 +30,80 @@ public:
     // invalid state to be permitted.
     ActionValueTable() = default;
 
-    ActionValueTable(ID state_count, ID action_count)
+    ActionValueTable(ID state_count, ID action_count) :
+        state_count_(state_count),
+        action_count_(action_count),
+        stride_(stride_for(action_count))
     {
         Expects(state_count > 0);
         Expects(action_count > 0);
-        for(ID state = 0; state < state_count; state++) {
-            values_.emplace_back(std::vector<double>(action_count, 0));
+        values_ = impl::TableStorage(static_cast<std::size_t>(state_count) * stride_, MASKED);
+        initialize_rows();
+    }
+
+    /**
+     * Creates a table for \c env with the values of disallowed state-action pairs masked to -inf,
+     * so that they are never chosen by best_action().
+     *
+     * End states, and states without any allowed actions, are not masked. Their values stay at 0,
+     * as clients rely on a zero value for end states.
+     */
+    explicit ActionValueTable(const Environment& env) :
+        ActionValueTable(env.state_count(), env.action_count())
+    {
+        mask_disallowed(env);
+    }
+
+    /**
+     * Creates a table backed by the file at \c path. A new file is initialized as done by the
+     * (state_count, action_count) constructor; an existing file (e.g. from an earlier run) keeps
+     * its values, so a run can be resumed.
+     *
+     * \throws std::runtime_error if an existing file holds a different table.
+     */
+    static ActionValueTable open_mapped(const std::string& path, ID state_count,
+                                        ID action_count, util::MappedFile::Options options={}) {
+        ActionValueTable table;
+        table.open_storage(path, state_count, action_count, options);
+        return table;
+    }
+
+    /**
+     * As above, for a table masked as done by the environment constructor.
+     */
+    static ActionValueTable open_mapped(const std::string& path, const Environment& env,
+                                        util::MappedFile::Options options={}) {
+        ActionValueTable table;
+        if(table.open_storage(path, env.state_count(), env.action_count(), options)) {
+            table.mask_disallowed(env);
         }
+        CHECK(table.masked()) << "The file " << path << " holds an unmasked table.";
+        return table;
+    }
+
+    /**
+     * Creates a sparse table, equivalent to ActionValueTable(state_count, action_count).
+     */
+    static ActionValueTable create_sparse(ID state_count, ID action_count) {
+        Expects(state_count > 0);
+        Expects(action_count > 0);
+        ActionValueTable table;
+        table.state_count_ = state_count;
+        table.action_count_ = action_count;
+        table.stride_ = stride_for(action_count);
+        table.sparse_ = true;
+        return table;
+    }
+
+    /**
+     * Creates a sparse table, equivalent to ActionValueTable(env). The rows are masked as they are
+     * allocated, so \c env must outlive the table.
+     */
+    static ActionValueTable create_sparse(const Environment& env) {
+        ActionValueTable table = create_sparse(env.state_count(), env.action_count());
+        table.mask_env_ = &env;
+        table.masked_ = true;
+        return table;
     }
 
     // Core guidelines C21:
@@ -43,35 +123,309 @@ public:
     //   * We would require the client to manually set the value of all end states to zero.
     //     Currently, some of the clients of ValueTable rely on a zero default.
     double value(const State& state, const Action& action) const {
-        Expects(state.id() < static_cast<ID>(values_.size()));
-        Expects(action.id() < static_cast<ID>(values_.front().size()));
-        return values_[state.id()][action.id()];
+        DCHECK_LT(state.id(), state_count_);
+        DCHECK_LT(action.id(), action_count_);
+        if(sparse_) {
+            const long* offset = sparse_rows_.find(state.id());
+            return offset ? sparse_values_[*offset + action.id()]
+                          : initial_value(state, action);
+        }
+        return values_.data()[static_cast<std::size_t>(state.id()) * stride_ + action.id()];
     }
 
     void set_value(const State& state, const Action& action, double value) {
-        Expects(state.id() < static_cast<ID>(values_.size()));
-        Expects(action.id() < static_cast<ID>(values_.front().size()));
-        values_[state.id()][action.id()] = value;
+        DCHECK_LT(state.id(), state_count_);
+        DCHECK_LT(action.id(), action_count_);
+        if(sparse_) {
+            sparse_row(state)[action.id()] = value;
+            return;
+        }
+        double& entry =
+                values_.data()[static_cast<std::size_t>(state.id()) * stride_ + action.id()];
+        if(greedy_cache_enabled_) {
+            update_greedy_cache(state.id(), action.id(), entry, value);
+        }
+        entry = value;
     }
 
     using ActionValuePair = std::pair<ID, double>;
+    /**
+     * \returns the action with the highest value (the first such action if there are ties), and
+     *          its value.
+     */
     ActionValuePair best_action(const State& state) const {
-        int max_pos = 0;
-        double max_val = std::numeric_limits<double>::lowest();
-        CHECK_LT(state.id(), static_cast<ID>(values_.size()));
-        const std::vector<double>& action_list = values_.at(state.id());
-        for(ID i = 0; i < static_cast<ID>(action_list.size()); i++) {
-            if(action_list.at(i) > max_val) {
-                max_val = action_list.at(i);
-                max_pos = i;
+        CHECK_LT(state.id(), state_count_);
+        if(sparse_) {
+            const long* offset = sparse_rows_.find(state.id());
+            return offset ? scan_best_action(sparse_values_.data() + *offset)
+                          : initial_best_action(state);
+        }
+        if(greedy_cache_enabled_) {
+            if(greedy_stale_[state.id()]) {
+                greedy_[state.id()] = scan_best_action(row(state.id()));
+                greedy_stale_[state.id()] = false;
+            }
+            return greedy_[state.id()];
+        }
+        return scan_best_action(row(state.id()));
+    }
+
+    /**
+     * Turns on the greedy cache: a per-state best action and value maintained by set_value().
+     *
+     * With the cache, best_action() is a lookup in the common case. A state's row is only
+     * rescanned (on the next best_action() call) after its current best value decreases.
+     *
+     * That rescan writes the cache from the const best_action(), so a table with the cache must
+     * not be read from more than one thread at a time. In particular, a policy over such a table
+     * (e.g. a greedy policy) can't be given to an evaluator with more than one trial thread.
+     */
+    void enable_greedy_cache() {
+        // The cache is dense.
+        CHECK(!sparse_) << "Sparse tables don't support the greedy cache.";
+        greedy_.resize(static_cast<std::size_t>(state_count_));
+        for(ID state = 0; state < state_count_; state++) {
+            greedy_[state] = scan_best_action(row(state));
+        }
+        greedy_stale_.assign(static_cast<std::size_t>(state_count_), false);
+        greedy_cache_enabled_ = true;
+    }
+
+    bool greedy_cache_enabled() const {
+        return greedy_cache_enabled_;
+    }
+
+    /**
+     * \returns true if the table was created from an environment, with disallowed actions masked.
+     *          best_action() then only considers allowed actions.
+     */
+    bool masked() const {
+        return masked_;
+    }
+
+    ID state_count() const {
+        return state_count_;
+    }
+
+    bool is_mapped() const {
+        return values_.is_mapped();
+    }
+
+    bool is_sparse() const {
+        return sparse_;
+    }
+
+    /**
+     * \returns the number of rows allocated by a sparse table.
+     */
+    std::size_t sparse_row_count() const {
+        return sparse_rows_.size();
+    }
+
+    /**
+     * \returns false if the values were read from an existing file by open_mapped().
+     */
+    bool created() const {
+        return values_.created();
+    }
+
+    /**
+     * Sets the madvise() access pattern hint of a mapped table.
+     */
+    void advise(util::MappedFile::AccessPattern access_pattern) {
+        values_.advise(access_pattern);
+    }
+
+    /**
+     * Writes a mapped table's values back to its file.
+     */
+    void sync() {
+        values_.sync();
+    }
+
+    ID action_count() const {
+        return action_count_;
+    }
+
+private:
+    static ID stride_for(ID action_count) {
+        return (action_count + LANE_COUNT - 1) / LANE_COUNT * LANE_COUNT;
+    }
+
+    // Sets the padding to MASKED and the values to 0.
+    void initialize_rows() {
+        for(ID state = 0; state < state_count_; state++) {
+            std::fill_n(row(state), stride_, MASKED);
+            std::fill_n(row(state), action_count_, 0.0);
+        }
+    }
+
+    /**
+     * \returns true if the row of \c s is masked: it isn't an end state and it has at least one
+     *          allowed action.
+     */
+    static bool is_masked_row(const Environment& env, const State& s) {
+        if(env.is_end_state(s)) {
+            return false;
+        }
+        for(const Action& a : env.actions()) {
+            if(env.is_action_allowed(s, a)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void mask_row(const Environment& env, const State& s, double* values) {
+        if(!is_masked_row(env, s)) {
+            return;
+        }
+        for(const Action& a : env.actions()) {
+            if(!env.is_action_allowed(s, a)) {
+                values[a.id()] = MASKED;
+            }
+        }
+    }
+
+    void mask_disallowed(const Environment& env) {
+        for(const State& s : env.states()) {
+            mask_row(env, s, row(s.id()));
+        }
+        masked_ = true;
+        values_.set_flags(values_.flags() | MASKED_FLAG);
+    }
+
+    /**
+     * Maps the values to the file at \c path.
+     *
+     * \returns true if the file is new.
+     */
+    bool open_storage(const std::string& path, ID state_count, ID action_count,
+                      util::MappedFile::Options options) {
+        Expects(state_count > 0);
+        Expects(action_count > 0);
+        state_count_ = state_count;
+        action_count_ = action_count;
+        stride_ = stride_for(action_count);
+        values_ = impl::TableStorage(path, impl::TableStorage::Kind::ACTION_VALUE_TABLE,
+                                     state_count, action_count, stride_, options);
+        if(values_.created()) {
+            initialize_rows();
+        }
+        masked_ = values_.flags() & MASKED_FLAG;
+        return values_.created();
+    }
+
+    /**
+     * \returns the row of \c state in a sparse table, allocating it if necessary.
+     */
+    double* sparse_row(const State& state) {
+        long& offset = sparse_rows_[state.id()];
+        if(offset == NO_ROW) {
+            offset = static_cast<long>(sparse_values_.size());
+            sparse_values_.resize(sparse_values_.size() + stride_, MASKED);
+            std::fill_n(sparse_values_.data() + offset, action_count_, 0.0);
+            if(mask_env_) {
+                mask_row(*mask_env_, state, sparse_values_.data() + offset);
+            }
+        }
+        return sparse_values_.data() + offset;
+    }
+
+    // The value of a pair in a row that a sparse table hasn't allocated.
+    double initial_value(const State& state, const Action& action) const {
+        if(mask_env_ and !mask_env_->is_action_allowed(state, action) and
+           is_masked_row(*mask_env_, state)) {
+            return MASKED;
+        }
+        return 0.0;
+    }
+
+    // best_action() for a row that a sparse table hasn't allocated.
+    ActionValuePair initial_best_action(const State& state) const {
+        if(mask_env_ and is_masked_row(*mask_env_, state)) {
+            for(const Action& a : mask_env_->actions()) {
+                if(mask_env_->is_action_allowed(state, a)) {
+                    return std::make_pair(a.id(), 0.0);
+                }
+            }
+        }
+        return std::make_pair(0, 0.0);
+    }
+
+    ActionValuePair scan_best_action(const double* values) const {
+        // Each lane keeps the max of every LANE_COUNT'th value. The lanes are independent, so
+        // the loop can be vectorized. The padding is -inf, so it is never chosen.
+        std::array<double, LANE_COUNT> lane_max;
+        std::array<ID, LANE_COUNT> lane_pos;
+        lane_max.fill(std::numeric_limits<double>::lowest());
+        lane_pos.fill(0);
+        for(ID block = 0; block < stride_; block += LANE_COUNT) {
+            for(ID lane = 0; lane < LANE_COUNT; lane++) {
+                double v = values[block + lane];
+                bool greater = v > lane_max[lane];
+                lane_max[lane] = greater ? v : lane_max[lane];
+                lane_pos[lane] = greater ? block + lane : lane_pos[lane];
+            }
+        }
+        ID max_pos = lane_pos[0];
+        double max_val = lane_max[0];
+        for(ID lane = 1; lane < LANE_COUNT; lane++) {
+            bool tie_before = lane_max[lane] == max_val and lane_pos[lane] < max_pos;
+            if(lane_max[lane] > max_val or tie_before) {
+                max_val = lane_max[lane];
+                max_pos = lane_pos[lane];
             }
         }
         return std::make_pair(max_pos, max_val);
     }
 
+    void update_greedy_cache(ID state, ID action, double old_value, double new_value) {
+        if(greedy_stale_[state]) {
+            return;
+        }
+        ActionValuePair& best = greedy_[state];
+        if(new_value > best.second or (new_value == best.second and action < best.first)) {
+            best = {action, new_value};
+        } else if(action == best.first and new_value < old_value) {
+            // Another action might now be the best.
+            greedy_stale_[state] = true;
+        }
+    }
+
+    double* row(ID state) {
+        return values_.data() + static_cast<std::size_t>(state) * stride_;
+    }
+
+    const double* row(ID state) const {
+        return values_.data() + static_cast<std::size_t>(state) * stride_;
+    }
+
 private:
-    using StateActionTable = std::vector<std::vector<double>>;
-    StateActionTable values_{};
+    // Rows are padded to a multiple of this many values (4 doubles = 256 bits).
+    static constexpr ID LANE_COUNT = 4;
+    // Marks a missing row in sparse_rows_.
+    static constexpr long NO_ROW = -1;
+    // Stored in the file header of mapped tables created from an environment.
+    static constexpr std::uint32_t MASKED_FLAG = 1;
+    // Value of padding and of disallowed state-action pairs.
+    static constexpr double MASKED = -std::numeric_limits<double>::infinity();
+    ID state_count_ = 0;
+    ID action_count_ = 0;
+    ID stride_ = 0;
+    bool masked_ = false;
+    // Row-major: state * stride_ + action.
+    impl::TableStorage values_{};
+    // Sparse tables: state ID -> offset of the state's row in sparse_values_.
+    bool sparse_ = false;
+    util::FlatIdMap<long> sparse_rows_{NO_ROW};
+    std::vector<double> sparse_values_{};
+    // Used by sparse tables to mask rows as they are allocated.
+    const Environment* mask_env_ = nullptr;
+    // Greedy cache. Stale entries are rescanned lazily by best_action().
+    bool greedy_cache_enabled_ = false;
+    mutable std::vector<ActionValuePair> greedy_{};
+    mutable std::vector<char> greedy_stale_{};
 };
 
 } // namespace rl
\ No newline at end of file
@@ -1,47 +1,223 @@
 #pragma once
 
+#include <deque>
+#include <utility>
+#include <vector>
+
 #include "rl/Policy.h"
 
 namespace rl {
 
+/**
+ * A mixture of policies: the probability of an action is the weighted sum of the component
+ * policies' probabilities for the action.
+ *
+ * The blended distribution for a state is calculated on the first query for the state and cached.
+ * Later queries, sampling and probability lookups use the cache. Only the queried states get a
+ * cache row, and invalidate() drops the rows without freeing them, so refilling the cache after
+ * each change of a component policy only costs the states that are visited again. If a component
+ * policy changes, invalidate() must be called.
+ *
+ * As the cache is filled by the const methods, they are not safe to call from several threads at
+ * once until prepare() has filled the cache for every state (see Policy::prepare()).
+ */
 class BlendedPolicy : public Policy {
 public:
-    // note: this can be extended from 2 policies to n policies.
+    /**
+     * A component policy and its weight in the mixture.
+     */
+    using Component = std::pair<const Policy*, double>;
+
+public:
     // note: taking the policies in by const pointer (rather than reference) so that it is clear
     // that we expect the client to maintain the lifetime of these objects. a const ref type
     // would allow the client to use an rvalue temporary as an argument, which would lead to
     // undefined behaviour.
+    /**
+     * Blends two policies: (1 - blend) * policy1 + blend * policy2.
+     */
     BlendedPolicy(const Policy* policy1, const Policy* policy2, double blend) :
-    policy1(*CHECK_NOTNULL(policy1)), policy2(*CHECK_NOTNULL(policy2)), blend(blend)
+        BlendedPolicy({{policy1, 1.0 - blend}, {policy2, blend}})
     {
         CHECK_GE(1.0, blend);
         CHECK_LE(0.0, blend);
     }
 
+    /**
+     * Blends any number of policies. The weights are normalized to sum to 1.
+     */
+    explicit BlendedPolicy(std::vector<Component> components) : components_(std::move(components)) {
+        CHECK(!components_.empty());
+        double total_weight = 0;
+        for(const Component& component : components_) {
+            CHECK_NOTNULL(component.first);
+            CHECK_LE(0.0, component.second);
+            total_weight += component.second;
+        }
+        CHECK_GT(total_weight, 0.0);
+        // Skipped when possible, so that the weights are used exactly as given.
+        if(total_weight == 1.0) {
+            return;
+        }
+        for(Component& component : components_) {
+            component.second /= total_weight;
+        }
+    }
+
     const Action& next_action(const Environment& env, const State& from_state) const override {
-        return possible_actions(env, from_state).random_action();
+        return cached_distribution(env, from_state).random_action();
     }
 
     ActionDistribution
     possible_actions(const Environment& env, const State& from_state) const override {
-        // Add policy1.
-        ActionDistribution res;
+        return cached_distribution(env, from_state);
+    }
+
+    ActionDistributionView action_distribution(const Environment& env, const State& from_state,
+                                               ActionDistribution& scratch) const override {
+        return cached_distribution(env, from_state).view();
+    }
+
+    /**
+     * \returns the probability of \c action being chosen from \c from_state. After the state's
+     *          first query, this is a single array read.
+     */
+    double probability(const Environment& env, const State& from_state,
+                       const Action& action) const {
+        cached_distribution(env, from_state);
+        std::size_t row = rows_[from_state.id()];
+        return probabilities_[row * action_count_ + action.id()];
+    }
+
+    /**
+     * Calculates the distributions of all of the environment's states, so that later queries
+     * for the environment only read the cache. Does nothing if the cache is already complete.
+     */
+    void prepare(const Environment& env) const override {
+        if(is_prepared(env)) {
+            return;
+        }
+        for(const State& s : env.states()) {
+            cached_distribution(env, s);
+        }
+        is_prepared_ = true;
+    }
+
+    /**
+     * \returns true if prepare() has been called for \c env, and the cache hasn't been
+     *          invalidated since.
+     */
+    bool is_prepared(const Environment& env) const {
+        return is_prepared_ and cached_env_ == &env;
+    }
+
+    /**
+     * Drops all cached distributions. To be called when a component policy changes.
+     */
+    void invalidate() const {
+        used_row_count_ = 0;
+        is_prepared_ = false;
+    }
+
+    /**
+     * Drops the cached distribution for a single state.
+     */
+    void invalidate(const State& state) const {
+        if(is_cached(state.id())) {
+            row_states_[rows_[state.id()]] = NO_STATE;
+            is_prepared_ = false;
+        }
+    }
+
+private:
+    static constexpr ID NO_STATE = -1;
+
+    // rows_ isn't cleared by invalidate(), so a state's entry is only trusted if the row it
+    // points to is in use and belongs to the state.
+    bool is_cached(ID state) const {
+        if(static_cast<std::size_t>(state) >= rows_.size()) {
+            return false;
+        }
+        std::size_t row = rows_[state];
+        return row < used_row_count_ and row_states_[row] == state;
+    }
+
+    const ActionDistribution& cached_distribution(const Environment& env,
+                                                  const State& from_state) const {
+        if(cached_env_ != &env) {
+            cached_env_ = &env;
+            action_count_ = static_cast<std::size_t>(env.action_count());
+            rows_.assign(static_cast<std::size_t>(env.state_count()), 0);
+            // The rows are sized by the action count.
+            distributions_.clear();
+            row_states_.clear();
+            probabilities_.clear();
+            invalidate();
+        }
+        CHECK_GT(rows_.size(), static_cast<std::size_t>(from_state.id()));
+        if(is_cached(from_state.id())) {
+            return distributions_[rows_[from_state.id()]];
+        }
+        // Take the next row, reusing the rows dropped by invalidate().
+        std::size_t row = used_row_count_++;
+        if(row == distributions_.size()) {
+            distributions_.emplace_back();
+            row_states_.push_back(NO_STATE);
+            probabilities_.resize(probabilities_.size() + action_count_);
+        }
+        rows_[from_state.id()] = row;
+        row_states_[row] = from_state.id();
+        ActionDistribution& res = distributions_[row];
+        component_dists_.resize(components_.size());
+        std::vector<ActionDistributionView> views;
+        views.reserve(components_.size());
+        for(std::size_t i = 0; i < components_.size(); i++) {
+            views.push_back(components_[i].first->action_distribution(env, from_state,
+                                                                      component_dists_[i]));
+        }
+        res.clear();
+        double* probabilities = probabilities_.data() + row * action_count_;
         for(const Action& a : env.actions()) {
-            Weight weight1 = policy1.possible_actions(env, from_state).probability(a);
-            Weight weight2 = policy2.possible_actions(env, from_state).probability(a);
-            Weight new_weight = (1.0-blend) * weight1 + blend * weight2;
+            Weight new_weight = 0;
+            for(std::size_t i = 0; i < components_.size(); i++) {
+                if(views[i].empty()) {
+                    continue;
+                }
+                new_weight += components_[i].second * views[i].probability(a);
+            }
+            probabilities[a.id()] = new_weight;
             if(new_weight != 0.0) {
                 res.add_action(a, new_weight);
             }
         }
+        // The weights already sum to 1, but normalize in case of rounding.
+        if(!res.empty()) {
+            for(const Action& a : env.actions()) {
+                probabilities[a.id()] /= res.total_weight();
+            }
+        }
         return res;
     }
 
 private:
-    // Switch to const* if assignment operator or move ctr is needed.
-    const Policy& policy1;
-    const Policy& policy2;
-    double blend;
+    // Weights are normalized.
+    std::vector<Component> components_;
+    // Cache. Cleared if the policy is used with a different environment.
+    mutable const Environment* cached_env_ = nullptr;
+    mutable std::size_t action_count_ = 0;
+    // State ID -> cache row. Only meaningful for the states that is_cached() accepts.
+    mutable std::vector<std::size_t> rows_{};
+    // Rows [0, used_row_count_) are in use. A deque, so that the distributions (and the views
+    // returned of them) stay in place as rows are added.
+    mutable std::deque<ActionDistribution> distributions_{};
+    // Row -> the state it holds, or NO_STATE.
+    mutable std::vector<ID> row_states_{};
+    // Row * action_count_ + action ID -> probability.
+    mutable std::vector<double> probabilities_{};
+    mutable std::size_t used_row_count_ = 0;
+    mutable bool is_prepared_ = false;
+    // Reused to hold the components' distributions.
+    mutable std::vector<ActionDistribution> component_dists_{};
 };
 
-} // namespace rl
\ No newline at end of file
+} // namespace rl
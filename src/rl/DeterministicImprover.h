@@ -54,6 +54,8 @@ public:
         std::unique_ptr<StochasticPolicy> ans =
                 std::make_unique<StochasticPolicy>(StochasticPolicy::create_from(env, policy));
         bool finished = false;
+        // Reused for every call to calculate_best_action().
+        std::vector<double> action_values;
         while(!finished) {
             bool policy_updated = false;
             const ValueTable& value_fctn = evaluate(evaluator_, env, *ans);
@@ -73,7 +75,7 @@ public:
                 const Action* improved_action = nullptr;
                 double reward = 0;
                 std::tie(improved_action, reward) = calculate_best_action(
-                        env, s, value_fctn, current_action);
+                        env, s, value_fctn, current_action, action_values);
                 if(improved_action) {
                     // We found a better action!
                     // Clear all existing actions, and use the new one.
@@ -93,8 +95,13 @@ private:
             const Environment& env,
             const State& from_state,
             const ValueTable& value_fctn,
-            const Action* current_action) const {
+            const Action* current_action,
+            std::vector<double>& action_values) const {
         std::pair<const Action*, double> ans{nullptr, 0};
+        // Calculate the backups for all actions at once, as the environment might be able to
+        // share work between them.
+        env.action_values(from_state, value_fctn, evaluator_.discount_rate(), action_values);
+        double v_current = value_fctn.value(from_state);
         for(const Action& a : env.actions()) {
             // If the action is not possible, continue.
             // TODO: what if you get into a dead end? Should that be allowed without it being an end
@@ -106,8 +113,7 @@ private:
             if(current_action and *current_action == a) {
                 continue;
             }
-            double expected_value = calculate_reward(env, from_state, a, value_fctn);
-            double v_current = value_fctn.value(from_state);
+            double expected_value = action_values[a.id()];
             if(greater_than(expected_value, v_current, evaluator_.delta_threshold())) {
                 // We found a better action!
                 ans = {&a, expected_value};
@@ -121,19 +127,6 @@ private:
         return ans;
     }
 
-    double calculate_reward(const Environment& env, const State& from_state,
-            const Action& action, const ValueTable& value_fctn) const {
-        ResponseDistribution transitions = env.transition_list(from_state, action);
-        double expect_value_sum = 0;
-        for(const Response& r : transitions.responses()) {
-            double next_state_value = evaluator_.discount_rate() * value_fctn.value(r.next_state);
-            expect_value_sum += r.prob_weight * (r.reward.value() + next_state_value);
-        }
-        Ensures(transitions.total_weight() != 0);
-        double expected_value = expect_value_sum / transitions.total_weight();
-        return expected_value;
-    }
-
 private:
     IterativePolicyEvaluator default_evalutator;
     StateBasedEvaluator& evaluator_ = default_evalutator;
@@ -49,6 +49,119 @@ private:
     StateToActionMap state_to_action_{};
 };
 
+/**
+ * A deterministic policy stored as a dense state ID->action ID array.
+ *
+ * Unlike DeterministicPolicy, no State or Action objects are copied and next_action() is a single
+ * (bounds checked) array read. The policy is tied to environments with the state count given at
+ * construction. States without an action (end states) hold NO_ACTION.
+ */
+class DenseDeterministicPolicy : public Policy {
+public:
+    static constexpr ID NO_ACTION = -1;
+
+public:
+    explicit DenseDeterministicPolicy(ID state_count) :
+        state_to_action_(static_cast<std::size_t>(state_count), NO_ACTION)
+    {}
+
+    const Action& next_action(const Environment& e, const State& from_state) const override {
+        CHECK_GT(state_to_action_.size(), static_cast<std::size_t>(from_state.id()));
+        ID action_id = state_to_action_[from_state.id()];
+        CHECK_NE(action_id, NO_ACTION) << "No action is set for state " << from_state.id() << ".";
+        return e.action(action_id);
+    }
+
+    ActionDistribution possible_actions(const Environment& e,
+                                        const State& from_state) const override {
+        ActionDistribution dist;
+        action_distribution(e, from_state, dist);
+        return dist;
+    }
+
+    ActionDistributionView action_distribution(const Environment& e, const State& from_state,
+                                               ActionDistribution& scratch) const override {
+        CHECK_GT(state_to_action_.size(), static_cast<std::size_t>(from_state.id()));
+        scratch.clear();
+        ID action_id = state_to_action_[from_state.id()];
+        if(action_id != NO_ACTION) {
+            scratch.add_action(e.action(action_id));
+        }
+        return scratch.view();
+    }
+
+    void set_action_for_state(const State& s, const Action& a) {
+        CHECK_GT(state_to_action_.size(), static_cast<std::size_t>(s.id()));
+        state_to_action_[s.id()] = a.id();
+        revision_++;
+    }
+
+    void clear_action_for_state(const State& s) {
+        CHECK_GT(state_to_action_.size(), static_cast<std::size_t>(s.id()));
+        state_to_action_[s.id()] = NO_ACTION;
+        revision_++;
+    }
+
+    /**
+     * Sets the actions of all states at once.
+     *
+     * \param state_to_action the action ID for each state ID, or NO_ACTION.
+     */
+    void set_actions(std::vector<ID> state_to_action) {
+        Expects(state_to_action.size() == state_to_action_.size());
+        state_to_action_ = std::move(state_to_action);
+        revision_++;
+    }
+
+    /**
+     * \returns the action ID for each state ID, or NO_ACTION.
+     */
+    const std::vector<ID>& state_to_action() const {
+        return state_to_action_;
+    }
+
+    /**
+     * \returns a count of the changes to the actions, so that a copy of state_to_action() can be
+     *          checked for staleness without comparing the arrays.
+     */
+    long revision() const {
+        return revision_;
+    }
+
+    /**
+     * Create a \c DenseDeterministicPolicy from another policy.
+     *
+     * For each (non-end) state, the action with the highest weight is chosen. If there are ties,
+     * the first of the tied actions in the source distribution is chosen. For a StochasticPolicy,
+     * this reads the stored distributions without copying them.
+     */
+    template<typename PolicyInType>
+    static DenseDeterministicPolicy create_from(const Environment& env,
+                                                const PolicyInType& other) {
+        DenseDeterministicPolicy out(env.state_count());
+        ActionDistribution scratch;
+        for(const State& s : env.states()) {
+            if(env.is_end_state(s)) {
+                continue;
+            }
+            const ActionWeight* best = nullptr;
+            for(const ActionWeight& entry : other.action_distribution(env, s, scratch).entries()) {
+                if(!best or entry.weight > best->weight) {
+                    best = &entry;
+                }
+            }
+            if(best) {
+                out.state_to_action_[s.id()] = CHECK_NOTNULL(best->action)->id();
+            }
+        }
+        return out;
+    }
+
+private:
+    std::vector<ID> state_to_action_;
+    long revision_ = 0;
+};
+
 class DeterministicLambdaPolicy : public rl::Policy {
 public:
     using Callback = std::function<const rl::Action&(const rl::Environment&, const rl::State&)>;
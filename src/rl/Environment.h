@@ -10,6 +10,8 @@
 
 namespace rl {
 
+class ValueTable;
+
 /*
  * Following the reasoning here and avoiding unsigned integer types.
  * https://google.github.io/styleguide/cppguide.html#Integer_Types
@@ -334,8 +336,53 @@ public:
      */
     virtual Response next_state(const State& from_state, const Action& action) const = 0;
 
+    /**
+     * Samples next_state() using \c generator rather than the calling thread's generator, so that
+     * several threads can sample an environment with a stream each.
+     *
+     * Derived classes that override next_state() hide this overload; call it through an
+     * Environment reference.
+     */
+    Response next_state(const State& from_state, const Action& action,
+                        util::random::Generator& generator) const {
+        util::random::ScopedGenerator scope(generator);
+        return next_state(from_state, action);
+    }
+
     // Full MDP info.
     virtual ResponseDistribution transition_list(const State& from_state, const Action& action) const = 0;
+
+    /**
+     * \returns true if next_state() always gives the same response for a (state, action) pair.
+     * Used to detect trials that loop forever (see TrialLimits). False is always safe.
+     */
+    virtual bool is_deterministic() const = 0;
+
+    //----------------------------------------------------------------------------------------------
+    // Backups
+    //----------------------------------------------------------------------------------------------
+    /**
+     * Calculates the expected return of taking \c action in \c from_state and then receiving the
+     * (discounted) value of the next state according to \c value_function. In other words, the
+     * one-step backup Q(s, a) = sum over (s', r): p(s', r | s, a) * (r + discount_rate * v(s')).
+     */
+    virtual double action_value(const State& from_state, const Action& action,
+                                const ValueTable& value_function, double discount_rate) const = 0;
+
+    /**
+     * Calculates the backup Q(s, a) (see action_value()) for every action of \c from_state.
+     *
+     * This exists so that environments whose transitions share most of their computation across
+     * actions (e.g. Jack's Car Rental) can do the shared work once per state instead of once per
+     * action.
+     *
+     * \param out [out] resized to action_count(). out[a.id()] holds Q(from_state, a) for every
+     *        allowed action. Entries for actions that are not allowed hold
+     *        std::numeric_limits<double>::lowest(). Passing the same vector on every call avoids
+     *        reallocating it.
+     */
+    virtual void action_values(const State& from_state, const ValueTable& value_function,
+                               double discount_rate, std::vector<double>& out) const = 0;
 };
 
 } // namespace rl
@@ -3,8 +3,13 @@
 #include <rl/impl/PolicyEvaluator.h>
 #include "rl/ActionValueTable.h"
 #include "rl/Policy.h"
+#include "rl/StateActionMap.h"
 #include "rl/Trial.h"
+#include "rl/impl/ConvergenceStats.h"
+#include "rl/impl/ExploringStarts.h"
+#include "rl/impl/ParallelTrials.h"
 #include <iostream>
+#include <utility>
 
 namespace rl {
 
@@ -15,59 +20,103 @@ public:
     static constexpr double DEFAULT_DELTA_THRESHOLD = 1e-8;
     static constexpr double DEFAULT_DISCOUNT_RATE = 1.0;
     static constexpr int MIN_VISIT = 1000;
+    static constexpr double DEFAULT_CONFIDENCE_LEVEL = 0.95;
+    static constexpr double DEFAULT_CONFIDENCE_TOLERANCE = 0.01;
+    // A pair's confidence interval is only trusted after this many returns.
+    static constexpr int MIN_CONFIDENCE_INTERVAL_VISIT = 10;
+
+    /**
+     * When the evaluator is finished.
+     *
+     * DELTA: the max delta of the last step is below the delta threshold, and every (state, action)
+     *        pair has more than MIN_VISIT visits. The default.
+     * CONFIDENCE_INTERVAL: for every pair, the confidence interval of the mean return has a
+     *        half-width of at most the tolerance, and there are at least
+     *        MIN_CONFIDENCE_INTERVAL_VISIT returns. Pairs with a low return variance meet this
+     *        after a few trials. See set_confidence_interval() (DEFAULT_CONFIDENCE_LEVEL and
+     *        DEFAULT_CONFIDENCE_TOLERANCE if it isn't called).
+     */
+    enum class StoppingMode {DELTA, CONFIDENCE_INTERVAL};
 
 public:
     void initialize(const Environment& env, const Policy& policy) override {
         impl::PolicyEvaluator::initialize(env, policy);
-        // We use action_count * state_count elements of the arrays.
-        // Check that (action_count * state_count) < array size max.
-        // TODO: how to best guard against overflow here?
-        // Expects(std::numeric_limits<std::size_t>::max() / env.action_count() > env.state_count());
-        Ensures(env.action_count() * env.state_count() > 0);
-        std::size_t element_count = env.action_count() * env.state_count();
         value_function_ = ActionValueTable(env.state_count(), env.action_count());
-        visit_count = std::vector<int>(element_count, 0);
-        delta = std::vector<double>(element_count, 0.0);
-        // Set the value for all end states (zero).
-        for(const State& state : env.end_states()) {
-            for(const Action& action : env.actions()) {
-                visit_count[hash(state, action)] =
-                        std::numeric_limits<int>::max();
-            }
-        }
+        // Only the live (state, action) pairs are stored, so end states and disallowed actions
+        // are not considered when calculating the max delta and min visit.
+        visit_count = CompactStateActionMap<int>(env, 0);
+        delta = CompactStateActionMap<double>(env, 0.0);
+        m2_ = CompactStateActionMap<double>(env, 0.0);
+        CHECK(!visit_count.empty()) << "The environment has no allowed (state, action) pairs.";
+        exploring_starts_.reset(env);
+        CHECK_EQ(static_cast<long>(exploring_starts_.pair_count()), visit_count.size());
+        runner_.set_first_visit_keys(exploring_starts_.pair_count());
+        visit_counter_.reset(visit_count.size());
+        delta_tracker_.reset(visit_count.size());
+        wide_pair_count_ = visit_count.size();
+        truncated_trial_count_ = 0;
     }
 
+    /**
+     * Runs a trial from every allowed (state, action) pair (except retired pairs, see
+     * set_pair_retirement()), then updates the value function with the trials' first-visit
+     * returns.
+     *
+     * As in FirstVisitMCValuePredictor, the trials are run by thread_count() threads and their
+     * returns are merged in a fixed order, so the result for a given seed doesn't depend on the
+     * thread count.
+     */
     void step() override {
         const Environment& env = *CHECK_NOTNULL(env_);
         const Policy& policy = *CHECK_NOTNULL(policy_);
+        if(thread_count() > 1) {
+            policy.prepare(env);
+        }
         // We will use first-visit & exploring starts.
         // Force starting from all state-action pairs.
-        for(const State& start_state : env.states()) {
-            // Skip end states, as no action can be taken from them.
-            if(env.is_end_state(start_state)) {
-                continue;
-            }
-            for(const Action& start_action : env.actions()) {
-                // Skip state-action pairs that are not valid for the environment.
-                if(!env.is_action_allowed(start_state, start_action)) {
-                    continue;
-                }
-                Trace trace = run_trial(env, policy, &start_state, &start_action);
-                update_action_value_fctn(trace);
-            }
+        const std::vector<long>& starts = exploring_starts_.begin_step();
+        const std::vector<impl::ReturnShard>& shards = runner_.run(
+                starts.size(),
+                [this, &env, &policy, &starts](std::size_t i,
+                                               impl::ParallelTrialRunner::Scratch& scratch,
+                                               impl::ReturnShard& shard) {
+                    const std::pair<ID, ID>& start = exploring_starts_.pair(starts[i]);
+                    const State& start_state = env.state(start.first);
+                    const Action& start_action = env.action(start.second);
+                    TrialEnd end = run_trial(env, policy, scratch.trace, &start_state,
+                                             &start_action, trial_limits_);
+                    if(end != TrialEnd::END_STATE) {
+                        shard.add_truncated_trial();
+                    }
+                    add_returns(env, scratch.trace, scratch.first_visits, shard);
+                });
+        for(const impl::ReturnShard& shard : shards) {
+            merge(env, shard);
+            truncated_trial_count_ += shard.truncated_trial_count();
         }
-        // Update stopping criteria.
+        exploring_starts_.end_step([this](long index) {
+            return is_pair_converged(index);
+        });
+        // Update stopping criteria. The retired pairs keep the delta that met the threshold.
         steps_++;
-        most_recent_delta_ = *std::max_element(delta.begin(), delta.end());
-        // TODO: what if there are skipped state-action pairs that then have 0 visit count?
-        min_visit_ = *std::min_element(visit_count.begin(), visit_count.end());
+        most_recent_delta_ = delta_tracker_.max();
+        min_visit_ = visit_counter_.min();
     }
 
     bool finished() const override {
+        if(stopping_mode_ == StoppingMode::CONFIDENCE_INTERVAL) {
+            return steps_ > 0 and wide_pair_count_ == 0;
+        }
         return most_recent_delta_ < delta_threshold_ and min_visit_ > MIN_VISIT;
     }
 
     void run() override {
+        if(stopping_mode_ == StoppingMode::CONFIDENCE_INTERVAL) {
+            while(!finished()) {
+                step();
+            }
+            return;
+        }
         while(most_recent_delta_ > delta_threshold_ or min_visit_ < MIN_VISIT) {
             step();
         }
@@ -85,62 +134,192 @@ public:
         return 1.0;
     }
 
+    /**
+     * Sets the number of threads used to run the trials of a step (1 by default). Above 1, the
+     * environment and the policy must be safe to use from several threads at once. Each step
+     * calls Policy::prepare() before the trials.
+     */
+    void set_thread_count(int thread_count) {
+        runner_.set_thread_count(thread_count);
+    }
+
+    int thread_count() const {
+        return runner_.thread_count();
+    }
+
+    /**
+     * Enables skipping the (state, action) pairs whose own delta is below the delta threshold
+     * and whose visit count is above MIN_VISIT. Every \c reverify_interval steps, all pairs are
+     * started again, and pairs that no longer meet the criteria are reinstated. Takes effect on
+     * the next step.
+     */
+    void set_pair_retirement(
+            bool enabled, int reverify_interval=impl::ExploringStarts::DEFAULT_REVERIFY_INTERVAL) {
+        exploring_starts_.set_retirement(enabled, reverify_interval);
+    }
+
+    long retired_pair_count() const {
+        return exploring_starts_.retired_count();
+    }
+
+    /**
+     * Bounds the trials (no bounds by default). A trial that is cut short gives the returns
+     * truncated at the horizon, and is counted by truncated_trial_count(). As the returns of a
+     * cycle are only defined up to a horizon, cycle detection requires a max_length.
+     */
+    void set_trial_limits(const TrialLimits& limits) {
+        Expects(!limits.detect_cycles or limits.max_length != TrialLimits::NO_MAX_LENGTH);
+        trial_limits_ = limits;
+    }
+
+    const TrialLimits& trial_limits() const {
+        return trial_limits_;
+    }
+
+    /**
+     * \returns the number of trials since initialize() that didn't reach an end state.
+     */
+    long truncated_trial_count() const {
+        return truncated_trial_count_;
+    }
+
+    void set_stopping_mode(StoppingMode mode) {
+        stopping_mode_ = mode;
+    }
+
+    StoppingMode stopping_mode() const {
+        return stopping_mode_;
+    }
+
+    /**
+     * Switches to the CONFIDENCE_INTERVAL stopping mode.
+     *
+     * \param confidence_level the probability that the normal confidence interval of a pair's mean
+     *        return covers its true value, in (0, 1).
+     * \param tolerance the largest allowed half-width of the confidence interval.
+     *
+     * With pair retirement, a pair is retired when it meets these criteria instead of the delta
+     * criteria.
+     */
+    void set_confidence_interval(double confidence_level, double tolerance) {
+        Expects(tolerance > 0);
+        z_ = impl::two_sided_z(confidence_level);
+        tolerance_ = tolerance;
+        stopping_mode_ = StoppingMode::CONFIDENCE_INTERVAL;
+        wide_pair_count_ = 0;
+        for(long i = 0; i < visit_count.size(); i++) {
+            wide_pair_count_ += is_within_tolerance(i) ? 0 : 1;
+        }
+    }
+
+    /**
+     * \returns the sample variance of the first-visit returns of (s, a). 0 before two returns.
+     */
+    double return_variance(const State& s, const Action& a) const {
+        long index = visit_count.index(s, a);
+        CHECK_NE(index, CompactStateActionMap<int>::NO_INDEX);
+        return visit_count[index] < 2 ? 0.0 : m2_[index] / (visit_count[index] - 1);
+    }
+
+    /**
+     * \returns the half-width of the confidence interval of the value of (s, a), at the
+     * confidence level set by set_confidence_interval(). Infinite before two returns.
+     */
+    double confidence_half_width(const State& s, const Action& a) const {
+        long index = visit_count.index(s, a);
+        CHECK_NE(index, CompactStateActionMap<int>::NO_INDEX);
+        return impl::confidence_half_width(m2_[index], visit_count[index], z_);
+    }
+
 private:
-    void update_action_value_fctn(const Trace& trace) {
+    // Called by the worker threads: only the trace and the shard are written.
+    void add_returns(const Environment& env, const TraceBuffer& trace,
+                     FirstVisitIndex& first_visits, impl::ReturnShard& shard) const {
         double retrn = 0;
         Expects(!trace.empty());
+        Ensures(trace.size() <= std::numeric_limits<int>::max());
         // Track the first occurrence of a state so that we can implement first-visit (skip states
         // that have been visited already).
-        // This map assumes that max(long) > (state_count * action_count).
-        Ensures(std::numeric_limits<long>::max() >= visit_count.size());
-        std::unordered_map<long, int> first_occurrence;
+        first_visits.next_trace();
         // We can skip the last state (end state). There is no exit action paired with an end state.
-        for(std::size_t i = 0; i < trace.size() - 1; i++) {
-            const State& state = trace[i].state;
-            const Action& action = *CHECK_NOTNULL(trace[i].action);
-            Ensures(i <= std::numeric_limits<int>::max());
-            // C++ 17's unordered_map::try_emplace(). Insert if not present, otherwise do nothing.
-            first_occurrence.try_emplace(hash(state,action), static_cast<int>(i));
+        for(int i = 0; i < static_cast<int>(trace.size() - 1); i++) {
+            const State& state = env.state(trace.state_id(i));
+            const Action& action = env.action(trace.action_id(i));
+            long index = visit_count.index(state, action);
+            CHECK_NE(index, CompactStateActionMap<int>::NO_INDEX);
+            first_visits.visit(index, i);
         }
         // Add the reward for entering the end state.
-        retrn += trace.back().reward;
+        retrn += trace.rewards().back();
         // Iterate backwards over the time steps, starting from one before the end.
         // Don't use size_t here, as you will have an infinite loop given that it's unsigned.
-        Ensures(trace.size() <= std::numeric_limits<int>::max());
         for(int i = static_cast<int>(trace.size() - 2); i >= 0; i--) {
-            TimeStep step = trace[i];
             // First visit check. Skip this step if the state occurs in an earlier step.
             // Without this check, we would be implementing every-visit.
-            const State& state = step.state;
-            const Action& action = *CHECK_NOTNULL(step.action);
-            long hash_val = hash(state, action);
-            if(first_occurrence[hash_val] < i) {
-                // We still need to maintain the correct return value.
-                retrn += step.reward;
-                continue;
+            const State& state = env.state(trace.state_id(i));
+            const Action& action = env.action(trace.action_id(i));
+            long index = visit_count.index(state, action);
+            if(first_visits.first_step(index) == i) {
+                shard.add(index, retrn);
             }
-            double current_value = value_function_.value(state, action);
-            double n = ++visit_count[hash_val];
-            Ensures(n > 0);
-            double updated_value = current_value + 1/n * (retrn - current_value);
-            value_function_.set_value(state, action, updated_value);
+            retrn += trace.reward(i);
+        }
+    }
+
+    bool is_within_tolerance(long index) const {
+        return visit_count[index] >= MIN_CONFIDENCE_INTERVAL_VISIT
+               and impl::confidence_half_width(m2_[index], visit_count[index], z_) <= tolerance_;
+    }
+
+    bool is_pair_converged(long index) const {
+        if(stopping_mode_ == StoppingMode::CONFIDENCE_INTERVAL) {
+            return is_within_tolerance(index);
+        }
+        return delta[index] < delta_threshold_ and visit_count[index] > MIN_VISIT;
+    }
+
+    void merge(const Environment& env, const impl::ReturnShard& shard) {
+        for(std::size_t i = 0; i < shard.size(); i++) {
+            long index = shard.key(i);
+            const std::pair<ID, ID>& pair = exploring_starts_.pair(index);
+            const State& state = env.state(pair.first);
+            const Action& action = env.action(pair.second);
+            double value = value_function_.value(state, action);
             // note: the delta here is ever decreasing with increasing n. A second more responsive
             // weighted average for the value function could be used to keep the delta more
             // responsive.
-            delta[hash_val] = std::abs(current_value - updated_value);
-            retrn += step.reward;
+            int previous_count = visit_count[index];
+            bool was_within_tolerance = is_within_tolerance(index);
+            impl::merge_m2(shard, i, value, previous_count, m2_[index]);
+            delta[index] = impl::merge_returns(shard, i, value, visit_count[index]);
+            Ensures(visit_count[index] > 0);
+            visit_counter_.add_visits(previous_count, visit_count[index]);
+            if(was_within_tolerance != is_within_tolerance(index)) {
+                wide_pair_count_ += was_within_tolerance ? 1 : -1;
+            }
+            delta_tracker_.set(index, delta[index]);
+            value_function_.set_value(state, action, value);
         }
     }
 
-    long hash(const State& state, const Action& action) {
-        return state.id() * CHECK_NOTNULL(env_)->action_count() + action.id();
-    }
-
 private:
     ActionValueTable value_function_;
-    std::vector<int> visit_count{};
-    std::vector<double> delta{};
+    impl::ExploringStarts exploring_starts_{};
+    impl::ParallelTrialRunner runner_{};
+    CompactStateActionMap<int> visit_count{};
+    CompactStateActionMap<double> delta{};
+    // The sum of squared deviations of each pair's returns from its mean (Welford).
+    CompactStateActionMap<double> m2_{};
+    impl::MinVisitCounter visit_counter_{};
+    impl::MaxDeltaTracker delta_tracker_{};
     long min_visit_ = 0;
+    StoppingMode stopping_mode_ = StoppingMode::DELTA;
+    double z_ = impl::two_sided_z(DEFAULT_CONFIDENCE_LEVEL);
+    double tolerance_ = DEFAULT_CONFIDENCE_TOLERANCE;
+    // The pairs that don't meet the confidence interval criteria.
+    long wide_pair_count_ = 0;
+    TrialLimits trial_limits_{};
+    long truncated_trial_count_ = 0;
 };
 
 } // namespace rl
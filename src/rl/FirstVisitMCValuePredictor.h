@@ -2,6 +2,8 @@
 
 #include "rl/Policy.h"
 #include "rl/Trial.h"
+#include "rl/impl/ConvergenceStats.h"
+#include "rl/impl/ParallelTrials.h"
 #include "rl/impl/PolicyEvaluator.h"
 
 #include <exception>
@@ -17,31 +19,56 @@ public:
 public:
     void initialize(const Environment& env, const Policy& policy) override {
         impl::PolicyEvaluator::initialize(env, policy);
+        start_states_.clear();
+        for(const State& s : env.states()) {
+            if(!env.is_end_state(s)) {
+                start_states_.push_back(s.id());
+            }
+        }
+        runner_.set_first_visit_keys(static_cast<std::size_t>(env.state_count()));
+        // Only the non-end states are counted: end states are never visited.
+        visit_counter_.reset(static_cast<long>(start_states_.size()));
+        // Keyed by state ID. The end states keep a zero delta.
+        delta_tracker_.reset(env.state_count());
+        truncated_trial_count_ = 0;
         value_fuction_ = ValueTable(env.state_count());
+        // The entries of end states are unused.
         visit_count = std::vector<int>(env.state_count(), 0);
-        delta = std::vector<double>(env.state_count(), std::numeric_limits<double>::max());
-        // Set the value for all end states (zero).
-        for(const State& end_state : env.end_states()) {
-            delta[end_state.id()] = 0.0;
-            visit_count[end_state.id()] = std::numeric_limits<int>::max();
-        }
+        delta = std::vector<double>(env.state_count(), 0.0);
     }
 
+    /**
+     * Runs a trial from every non-end state (exploring starts), then updates the value function
+     * with the trials' first-visit returns.
+     *
+     * The trials are run by thread_count() threads. Each thread adds its returns to its own
+     * shards, and the shards are merged in a fixed order once all trials are done, so the result
+     * for a given seed doesn't depend on the thread count.
+     */
     void step() override {
         const Environment& env = *CHECK_NOTNULL(env_);
         const Policy& policy = *CHECK_NOTNULL(policy_);
+        if(thread_count() > 1) {
+            policy.prepare(env);
+        }
         // This algorithm will use exploring starts (start states) in order to ensure we get
         // value estimates for all states even if our policy is deterministic.
-        for(const State& start_state : env.states())
-        {
-            if(env.is_end_state(start_state))   {
-                continue;
-            }
-            Trace trace = run_trial(env, policy, &start_state);
-            update_value_fctn(trace);
+        const std::vector<impl::ReturnShard>& shards = runner_.run(
+                start_states_.size(),
+                [this, &env, &policy](std::size_t i, impl::ParallelTrialRunner::Scratch& scratch,
+                                      impl::ReturnShard& shard) {
+                    TrialEnd end = run_trial(env, policy, scratch.trace,
+                                             &env.state(start_states_[i]), nullptr, trial_limits_);
+                    if(end != TrialEnd::END_STATE) {
+                        shard.add_truncated_trial();
+                    }
+                    add_returns(scratch.trace, scratch.first_visits, shard);
+                });
+        for(const impl::ReturnShard& shard : shards) {
+            merge(env, shard);
+            truncated_trial_count_ += shard.truncated_trial_count();
         }
-        most_recent_delta_ = *std::max_element(delta.begin(), delta.end());
-        min_visit_ = *std::min_element(visit_count.begin(), visit_count.end());
+        update_stats();
         steps_++;
     }
 
@@ -63,50 +90,104 @@ public:
         return 1.0;
     }
 
+    /**
+     * Sets the number of threads used to run the trials of a step (1 by default). Above 1, the
+     * environment and the policy are used by several threads at once, so their const methods must
+     * be safe to call concurrently. Each step calls Policy::prepare() before the trials.
+     */
+    void set_thread_count(int thread_count) {
+        runner_.set_thread_count(thread_count);
+    }
+
+    int thread_count() const {
+        return runner_.thread_count();
+    }
+
+    /**
+     * Bounds the trials (no bounds by default). A trial that is cut short gives the returns
+     * truncated at the horizon, and is counted by truncated_trial_count(). As the returns of a
+     * cycle are only defined up to a horizon, cycle detection requires a max_length.
+     */
+    void set_trial_limits(const TrialLimits& limits) {
+        Expects(!limits.detect_cycles or limits.max_length != TrialLimits::NO_MAX_LENGTH);
+        trial_limits_ = limits;
+    }
+
+    const TrialLimits& trial_limits() const {
+        return trial_limits_;
+    }
+
+    /**
+     * \returns the number of trials since initialize() that didn't reach an end state.
+     */
+    long truncated_trial_count() const {
+        return truncated_trial_count_;
+    }
+
 private:
-    void update_value_fctn(const Trace& trace) {
+    // An unvisited non-end state has an unbounded delta.
+    void update_stats() {
+        min_visit_ = visit_counter_.min();
+        most_recent_delta_ =
+                min_visit_ > 0 ? delta_tracker_.max() : std::numeric_limits<double>::max();
+    }
+
+    // Called by the worker threads: only the trace and the shard are written.
+    static void add_returns(const TraceBuffer& trace, FirstVisitIndex& first_visits,
+                            impl::ReturnShard& shard) {
         double retrn = 0;
         Expects(!trace.empty());
+        Ensures(trace.size() <= std::numeric_limits<int>::max());
         // Track the first occurrence of a state so that we can implement first-visit (skip states
         // that have been visited already).
-        std::unordered_map<ID, int> first_occurrence;
+        first_visits.next_trace();
         // We can skip the last state, as you can't leave an end state.
-        for(std::size_t i = 0; i < trace.size()-1; i++) {
-            const State& s = trace[i].state;
-            if(!first_occurrence.count(s.id())) {
-                Ensures(i <= std::numeric_limits<int>::max());
-                first_occurrence[s.id()] = static_cast<int>(i);
-            }
+        for(int i = 0; i < static_cast<int>(trace.size() - 1); i++) {
+            first_visits.visit(trace.state_id(i), i);
         }
         // Add the reward for entering the end state.
-        retrn += trace.back().reward;
+        retrn += trace.rewards().back();
         // Iterate backwards over the time steps, starting from one before the end.
         // Don't use size_t here, as you will have an infinite loop given that it's unsigned.
-        Ensures(trace.size() <= std::numeric_limits<int>::max());
         for(int i = static_cast<int>(trace.size() - 2); i >= 0; i--) {
-            TimeStep step = trace[i];
+            ID state_id = trace.state_id(i);
             // First visit check. Skip this step if the state occurs in an earlier step.
             // Without this check, we would be implementing every-visit.
-            if(first_occurrence[step.state.id()] < i) {
-                // We still need to maintain the correct return value.
-                retrn += step.reward;
-                continue;
+            if(first_visits.first_step(state_id) == i) {
+                shard.add(state_id, retrn);
             }
-            double current_value = value_fuction_.value(step.state);
-            double n = ++visit_count[step.state.id()];
+            retrn += trace.reward(i);
+        }
+    }
+
+    void merge(const Environment& env, const impl::ReturnShard& shard) {
+        for(std::size_t i = 0; i < shard.size(); i++) {
+            auto state_id = static_cast<ID>(shard.key(i));
+            const State& state = env.state(state_id);
+            double value = value_fuction_.value(state);
+            int& n = visit_count[state_id];
+            int previous_n = n;
+            double d = impl::merge_returns(shard, i, value, n);
             Ensures(n > 0);
-            double updated_value = current_value + 1/n * (retrn - current_value);
-            value_fuction_.set_value(step.state, updated_value);
-            delta[step.state.id()] = std::abs(current_value - updated_value);
-            retrn += step.reward;
+            visit_counter_.add_visits(previous_n, n);
+            value_fuction_.set_value(state, value);
+            delta[state_id] = d;
+            delta_tracker_.set(state_id, d);
         }
     }
 
 private:
     ValueTable value_fuction_;
+    // The non-end states, in the order their trials are run.
+    std::vector<ID> start_states_{};
+    impl::ParallelTrialRunner runner_{};
     std::vector<int> visit_count{};
     std::vector<double> delta{};
     long min_visit_ = 0;
+    impl::MinVisitCounter visit_counter_{};
+    impl::MaxDeltaTracker delta_tracker_{};
+    TrialLimits trial_limits_{};
+    long truncated_trial_count_ = 0;
 };
 
 } // namespace rl
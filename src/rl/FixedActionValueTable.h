@@ -0,0 +1,126 @@
+#pragma once
+
+#include "rl/Environment.h"
+#include "rl/impl/FixedRow.h"
+#include "glog/logging.h"
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace rl {
+
+/**
+ * An action-value function for environments with a fixed number of actions (e.g. the 4 actions of
+ * GridWorld or the 2 actions of Blackjack).
+ *
+ * It has the same interface as ActionValueTable, but the action count is a template parameter:
+ * rows are fixed-size arrays with a power of two stride, so that a (state, action) pair is found
+ * with a shift rather than a runtime multiply, and best_action() is unrolled over the actions.
+ *
+ * There is no greedy cache: for a handful of actions the unrolled scan is as cheap as a lookup.
+ */
+template<ID ACTION_COUNT>
+class FixedActionValueTable {
+    using Row = impl::FixedRow<double, ACTION_COUNT>;
+public:
+    // The row length: ACTION_COUNT rounded up to a power of two.
+    static constexpr ID STRIDE = Row::STRIDE;
+    using ActionValuePair = std::pair<ID, double>;
+
+public:
+    FixedActionValueTable() = default;
+
+    explicit FixedActionValueTable(ID state_count) :
+        rows_(static_cast<std::size_t>(state_count))
+    {
+        Expects(state_count > 0);
+        for(Row& row : rows_) {
+            row.values.fill(MASKED);
+            std::fill_n(std::begin(row.values), ACTION_COUNT, 0.0);
+        }
+    }
+
+    /**
+     * Creates a table for \c env with disallowed state-action pairs masked, as done by
+     * ActionValueTable's environment constructor.
+     */
+    explicit FixedActionValueTable(const Environment& env) :
+        FixedActionValueTable(env.state_count())
+    {
+        CHECK_EQ(env.action_count(), ACTION_COUNT);
+        for(const State& s : env.states()) {
+            if(env.is_end_state(s)) {
+                continue;
+            }
+            bool any_allowed = false;
+            for(const Action& a : env.actions()) {
+                any_allowed = any_allowed or env.is_action_allowed(s, a);
+            }
+            if(!any_allowed) {
+                continue;
+            }
+            for(const Action& a : env.actions()) {
+                if(!env.is_action_allowed(s, a)) {
+                    rows_[s.id()].values[a.id()] = MASKED;
+                }
+            }
+        }
+        masked_ = true;
+    }
+
+    double value(const State& state, const Action& action) const {
+        DCHECK_LT(state.id(), state_count());
+        DCHECK_LT(action.id(), ACTION_COUNT);
+        return rows_[state.id()].values[action.id()];
+    }
+
+    void set_value(const State& state, const Action& action, double value) {
+        DCHECK_LT(state.id(), state_count());
+        DCHECK_LT(action.id(), ACTION_COUNT);
+        rows_[state.id()].values[action.id()] = value;
+    }
+
+    /**
+     * \returns the action with the highest value (the first such action if there are ties), and
+     *          its value.
+     */
+    ActionValuePair best_action(const State& state) const {
+        CHECK_LT(state.id(), state_count());
+        return scan_best_action(rows_[state.id()].values,
+                                std::make_integer_sequence<ID, ACTION_COUNT>{});
+    }
+
+    bool masked() const {
+        return masked_;
+    }
+
+    ID state_count() const {
+        return static_cast<ID>(rows_.size());
+    }
+
+    ID action_count() const {
+        return ACTION_COUNT;
+    }
+
+private:
+    static_assert(sizeof(Row) == STRIDE * sizeof(double), "Rows must not have extra padding.");
+
+    // The comparisons are expanded for each action, so there is no loop. As in ActionValueTable,
+    // the scan starts from the lowest double, so the result is the same in every case.
+    template<ID... ACTIONS>
+    static ActionValuePair scan_best_action(const std::array<double, STRIDE>& values,
+                                            std::integer_sequence<ID, ACTIONS...>) {
+        ActionValuePair best{0, std::numeric_limits<double>::lowest()};
+        ((values[ACTIONS] > best.second ? (best = {ACTIONS, values[ACTIONS]}, 0) : 0), ...);
+        return best;
+    }
+
+private:
+    static constexpr double MASKED = -std::numeric_limits<double>::infinity();
+    std::vector<Row> rows_{};
+    bool masked_ = false;
+};
+
+} // namespace rl
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <vector>
+
+#include "rl/Policy.h"
+
+namespace rl {
+
+/**
+ * An immutable stochastic policy stored in compressed sparse row form.
+ *
+ * The (action, weight) entries of all states are held in contiguous arrays, with a per-state
+ * offset into them. Each state also has an alias table (Vose's method) so that next_action() is
+ * constant time regardless of the number of actions. action_distribution() returns a view of the
+ * stored entries without copying.
+ *
+ * The policy holds pointers to the actions of the environment it was built from, so it can only
+ * be used with that environment.
+ */
+class FrozenStochasticPolicy : public Policy {
+public:
+    /**
+     * Creates a frozen copy of any policy.
+     */
+    static FrozenStochasticPolicy create_from(const Environment& env, const Policy& other) {
+        FrozenStochasticPolicy out;
+        out.row_begin_.reserve(static_cast<std::size_t>(env.state_count()) + 1);
+        out.row_begin_.push_back(0);
+        ActionDistribution scratch;
+        for(const State& s : env.states()) {
+            if(!env.is_end_state(s)) {
+                ActionDistributionView dist = other.action_distribution(env, s, scratch);
+                for(const ActionWeight& entry : dist.entries()) {
+                    out.entries_.push_back(entry);
+                }
+                out.total_weights_.push_back(dist.total_weight());
+            } else {
+                out.total_weights_.push_back(0);
+            }
+            out.row_begin_.push_back(static_cast<long>(out.entries_.size()));
+        }
+        out.build_alias_tables();
+        return out;
+    }
+
+    /**
+     * Create a policy that is greedy with respect to the given value function.
+     */
+    static FrozenStochasticPolicy create_from(const Environment& env,
+                                              const ActionValueTable& value_function) {
+        FrozenStochasticPolicy out;
+        out.row_begin_.reserve(static_cast<std::size_t>(env.state_count()) + 1);
+        out.row_begin_.push_back(0);
+        for(const State& s : env.states()) {
+            if(!env.is_end_state(s)) {
+                const Action& best_action = env.action(value_function.best_action(s).first);
+                Weight weight = 1.0;
+                out.entries_.push_back(ActionWeight{&best_action, weight});
+                out.total_weights_.push_back(weight);
+            } else {
+                out.total_weights_.push_back(0);
+            }
+            out.row_begin_.push_back(static_cast<long>(out.entries_.size()));
+        }
+        out.build_alias_tables();
+        return out;
+    }
+
+    const Action& next_action(const Environment& e, const State& from_state) const override {
+        CHECK_GT(total_weights_.size(), static_cast<std::size_t>(from_state.id()));
+        long begin = row_begin_[from_state.id()];
+        long count = row_begin_[from_state.id() + 1] - begin;
+        Expects(count > 0);
+        // Short-cut return if there is only one action.
+        if(count == 1) {
+            return *entries_[begin].action;
+        }
+        long column = begin + util::random::random_in_range<long>(0, count);
+        double u = util::random::random_in_range<double>(0.0, 1.0);
+        long chosen = u < alias_thresholds_[column] ? column : aliases_[column];
+        return *entries_[chosen].action;
+    }
+
+    ActionDistribution
+    possible_actions(const Environment& e, const State& from_state) const override {
+        ActionDistribution dist;
+        for(const ActionWeight& entry : view(from_state).entries()) {
+            dist.add_action(*entry.action, entry.weight);
+        }
+        return dist;
+    }
+
+    ActionDistributionView action_distribution(const Environment& e, const State& from_state,
+                                               ActionDistribution& scratch) const override {
+        return view(from_state);
+    }
+
+    /**
+     * \returns the probability of \c action being chosen from \c from_state.
+     */
+    double probability(const State& from_state, const Action& action) const {
+        CHECK_GT(total_weights_.size(), static_cast<std::size_t>(from_state.id()));
+        for(long i = row_begin_[from_state.id()]; i < row_begin_[from_state.id() + 1]; i++) {
+            if(entries_[i].action->id() == action.id()) {
+                return entries_[i].weight / total_weights_[from_state.id()];
+            }
+        }
+        return 0;
+    }
+
+private:
+    FrozenStochasticPolicy() = default;
+
+    ActionDistributionView view(const State& from_state) const {
+        CHECK_GT(total_weights_.size(), static_cast<std::size_t>(from_state.id()));
+        long begin = row_begin_[from_state.id()];
+        long end = row_begin_[from_state.id() + 1];
+        return ActionDistributionView(
+                gsl::span<const ActionWeight>(entries_.data() + begin, end - begin),
+                total_weights_[from_state.id()]);
+    }
+
+    /**
+     * Builds the alias table of every state with Vose's method.
+     *
+     * For the n entries of a state, each entry i gets a threshold t_i and an alias a_i, such that
+     * choosing i uniformly, then keeping i with probability t_i or otherwise taking a_i, chooses
+     * each entry with probability proportional to its weight.
+     */
+    void build_alias_tables() {
+        alias_thresholds_.assign(entries_.size(), 1.0);
+        aliases_.resize(entries_.size());
+        std::vector<double> scaled;
+        std::vector<long> small;
+        std::vector<long> large;
+        for(std::size_t state = 0; state < total_weights_.size(); state++) {
+            long begin = row_begin_[state];
+            long end = row_begin_[state + 1];
+            long count = end - begin;
+            if(count == 0) {
+                continue;
+            }
+            // A policy's actions can't have zero weight.
+            Expects(total_weights_[state] > 0);
+            scaled.clear();
+            small.clear();
+            large.clear();
+            for(long i = begin; i < end; i++) {
+                Expects(entries_[i].weight > 0);
+                aliases_[i] = i;
+                scaled.push_back(entries_[i].weight * count / total_weights_[state]);
+                (scaled.back() < 1.0 ? small : large).push_back(i);
+            }
+            while(!small.empty() and !large.empty()) {
+                long less = small.back();
+                small.pop_back();
+                long more = large.back();
+                alias_thresholds_[less] = scaled[less - begin];
+                aliases_[less] = more;
+                scaled[more - begin] -= 1.0 - scaled[less - begin];
+                if(scaled[more - begin] < 1.0) {
+                    large.pop_back();
+                    small.push_back(more);
+                }
+            }
+            // Any remaining entries are only left due to rounding, and keep a threshold of 1.
+        }
+    }
+
+private:
+    // The entries of state s are [row_begin_[s], row_begin_[s + 1]).
+    std::vector<long> row_begin_{};
+    std::vector<ActionWeight> entries_{};
+    std::vector<Weight> total_weights_{};
+    // Alias tables, in the same layout as entries_.
+    std::vector<double> alias_thresholds_{};
+    std::vector<long> aliases_{};
+};
+
+} // namespace rl
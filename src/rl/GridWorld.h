@@ -108,6 +108,10 @@ public:
         return ResponseDistribution::single_response(next_state(from_state, action));
     }
 
+    bool is_deterministic() const override {
+        return true;
+    }
+
     const State& pos_to_state(grid::Position p) const {
         // Making some assumptions on the ids and enum values matching. Could use a map instead.
         return state(grid_.to_id(p));
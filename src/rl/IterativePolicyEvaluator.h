@@ -1,22 +1,80 @@
 #pragma once
 
 #include <limits>
+#include <string>
 
+#include "rl/DeterministicPolicy.h"
 #include "rl/Policy.h"
 #include "rl/impl/PolicyEvaluator.h"
 
 namespace rl {
 
-// TODO: this evaluator (and others) need a loop detector to identify when a policy-env pair will
-// result in an infinite loop. Such a case has the potential to  occur in a deterministic
-// environment with a deterministic policy.
+// TODO: this evaluator needs a loop detector to identify when a policy-env pair will result in an
+// infinite loop. Such a case has the potential to occur in a deterministic environment with a
+// deterministic policy. The trial based evaluators can bound their trials with TrialLimits, but
+// the sweeps here have no trials to cut short: the values of the looping states just keep
+// changing, so the delta threshold is never met.
 class IterativePolicyEvaluator : public StateBasedEvaluator,
                                  public impl::PolicyEvaluator {
 public:
+    // Used in the dense state->action array for end states.
+    static constexpr ID NO_ACTION = -1;
 
+    /**
+     * DELTA: finish when the largest change in a state's value in the last sweep is below the
+     *        delta threshold. Sweeps are in-place (Gauss-Seidel).
+     * CERTIFIED_ERROR: finish when every value is certified to be within the delta threshold of
+     *        the true value. Sweeps are Jacobi sweeps, so that McQueen's bounds can be applied.
+     *        Requires a discount rate below 1.
+     */
+    enum class StoppingMode {DELTA, CERTIFIED_ERROR};
+
+public:
     void initialize(const Environment& env, const Policy& policy) override {
         impl::PolicyEvaluator::initialize(env, policy);
-        value_function_ = ValueTable(env.state_count());
+        value_function_ = value_table_path_.empty()
+                ? ValueTable(env.state_count())
+                : ValueTable::open_mapped(value_table_path_, env.state_count(),
+                                          value_table_options_);
+        state_to_action_.clear();
+        policy_inspected_ = false;
+        dense_policy_ = nullptr;
+        certified_error_ = std::numeric_limits<double>::infinity();
+    }
+
+    /**
+     * Keeps the value function in a memory mapped file, for state spaces that don't fit in RAM
+     * alongside the environment. Takes effect on the next initialize().
+     *
+     * If the file exists, initialize() starts from the values it holds. Thus, a run that was
+     * stopped can be resumed by evaluating again with the same file. Sweeps are in state order,
+     * so the default access pattern hint is SEQUENTIAL.
+     *
+     * An empty path switches back to a heap allocated value function.
+     */
+    void set_value_table_file(const std::string& path,
+                              util::MappedFile::Options options={
+                                      util::MappedFile::AccessPattern::SEQUENTIAL, false}) {
+        value_table_path_ = path;
+        value_table_options_ = options;
+    }
+
+    void set_stopping_mode(StoppingMode stopping_mode) {
+        stopping_mode_ = stopping_mode;
+    }
+
+    StoppingMode stopping_mode() const {
+        return stopping_mode_;
+    }
+
+    /**
+     * Only available for the CERTIFIED_ERROR stopping mode.
+     *
+     * \returns a bound on |v(s) - v_pi(s)| that holds for every state s, where v is the current
+     *          value function. Infinity if no sweep has been carried out.
+     */
+    double certified_error() const {
+        return certified_error_;
     }
 
     /**
@@ -30,68 +88,246 @@ public:
      *        val = 0
      *        actions = policy.get_actions(from_state)
      *        for(a in actions)
-     *            transitions = env.get_possible_transitions(from_state, a)
-     *            for(t in transitions)
-     *                val += (t.reward + value[t.next_state]) * t.prob)
+     *            val += prob(a) * env.action_value(s, a, values)
      *        error = max(error, |old_s - val|)
      *        values[s] = val
+     *
+     * where env.action_value() is the one-step backup:
+     *     sum over transitions t: (t.reward + value[t.next_state]) * t.prob
+     *
+     * If the policy has a single action for every state (e.g. a DeterministicPolicy), then the
+     * actions are read once into a dense state->action array and every following sweep does a
+     * single backup per state without querying the policy. The array is read on the first step
+     * after initialize(), so a policy that is changed later needs a new initialize(). The
+     * exception is a DenseDeterministicPolicy, whose array is read again whenever its revision()
+     * changes.
+     *
+     * In the CERTIFIED_ERROR stopping mode, the sweep is instead:
+     *
+     *     new_values = T(values)              // all backups use the old values
+     *     d_min, d_max = min, max over s of new_values[s] - values[s]
+     *
+     * T is a discount-contraction, so v_pi - new_values = sum over k >= 1 of (discount * P)^k d.
+     * P is the policy's transition matrix, substochastic if there are end states (its missing
+     * mass gives a d of 0, so 0 is included in [d_min, d_max] in that case). This gives McQueen's
+     * bounds for every state:
+     *
+     *     new_values[s] + c * d_min <= v_pi(s) <= new_values[s] + c * d_max,
+     *         c = discount / (1 - discount)
+     *
+     * The values are set to the midpoint of the bounds, which is within c * (d_max - d_min) / 2
+     * of v_pi. This is the certified error, and it is compared to the delta threshold.
      */
     void step() override {
         // Check the env_ & policy_ pointers once, then give them a shorthand.
         const Environment& e = *CHECK_NOTNULL(env_);
         const Policy& p = *CHECK_NOTNULL(policy_);
+        // This isn't done in initialize(), as policies that are broken should cause step() to
+        // throw, not initialize().
+        if(!policy_inspected_
+           or (dense_policy_ and dense_policy_->revision() != dense_policy_revision_)) {
+            inspect_policy(e, p);
+        }
+        auto dense_backup = [this, &e](const State& s) {
+            ID action_id = state_to_action_[s.id()];
+            return e.action_value(s, e.action(action_id), value_function_, discount_rate_);
+        };
+        auto dist_backup = [this, &e, &p](const State& s) {
+            return distribution_backup(e, p, s);
+        };
+        if(stopping_mode_ == StoppingMode::CERTIFIED_ERROR) {
+            most_recent_delta_ = state_to_action_.empty() ? certified_sweep(e, dist_backup)
+                                                          : certified_sweep(e, dense_backup);
+        } else {
+            most_recent_delta_ = state_to_action_.empty() ? sweep(e, dist_backup)
+                                                          : sweep(e, dense_backup);
+        }
+        steps_++;
+    }
+
+    const ValueTable& value_function() const override {
+        return value_function_;
+    }
+
+private:
+    /**
+     * Carries out an in-place sweep over all non-end states, setting each state's value to the
+     * result of \c backup.
+     *
+     * \returns the largest change in value.
+     */
+    template<typename BackupFctn>
+    double sweep(const Environment& e, const BackupFctn& backup) {
         double error = 0;
         for(const State& s : e.states()) {
-            if(e.is_end_state(s)) {
+            if(is_end_state(e, s)) {
                 continue;
             }
-            double expected_value = 0;
-            Policy::ActionDistribution action_dist = p.possible_actions(e, s);
-            // A policy must have an action for every non-end state.
-            Expects(action_dist.action_count());
-            // The action_dist can't have zero weight in total.
-            Expects(action_dist.total_weight());
-            for(auto action_weight_pair : action_dist.weight_map()) {
-                const Action& action = *CHECK_NOTNULL(action_weight_pair.first);
-                Weight action_weight = action_weight_pair.second;
-                // A policy's actions can't have zero weight.
-                Expects(action_weight);
-                ResponseDistribution response_dist = e.transition_list(s, action);
-                for(const Response& r : response_dist.responses()) {
-                    double transition_reward = r.reward.value();
-                    double reward_from_target = value_function_.value(r.next_state);
-                    // Looking at Compiler Explorer for the following computation it seems that
-                    // compilers will not optimize (a / b) * (c / d) into (a * c) / (b * d).
-                    // It looks like it can't as there will be differences due to rounding etc.
-                    // I'll do it manually instead.
-                    // (link to results: https://godbolt.org/z/v8WiUN )
-                    /*
-                    double probability =
-                            (action_weight / (double) action_dist.total_weight) *
-                            (t.get().prob_weight() / (double) response_dist.total_weight);
-                    */
-                    double denominator =
-                            (action_dist.total_weight() * (double) response_dist.total_weight());
-                    Ensures(denominator != 0);
-                    double probability = (action_weight * (double) r.prob_weight) / denominator;
-                    expected_value += transition_reward * probability;
-                    expected_value += reward_from_target * discount_rate_ * probability;
-                }
-            }
+            double expected_value = backup(s);
             double prev = value_function_.value(s);
             error = std::max(error, std::abs(prev - expected_value));
             value_function_.set_value(s, expected_value);
         }
-        most_recent_delta_ = error;
-        steps_++;
+        return error;
     }
 
-    const ValueTable& value_function() const override {
-        return value_function_;
+    /**
+     * Carries out a Jacobi sweep followed by the McQueen bound correction described for step().
+     *
+     * \returns the certified error.
+     */
+    template<typename BackupFctn>
+    double certified_sweep(const Environment& e, const BackupFctn& backup) {
+        // The bounds are unbounded for undiscounted tasks.
+        Expects(discount_rate_ < 1);
+        backed_up_values_.resize(static_cast<std::size_t>(e.state_count()));
+        double min_difference = std::numeric_limits<double>::infinity();
+        double max_difference = -std::numeric_limits<double>::infinity();
+        bool has_end_state = false;
+        for(const State& s : e.states()) {
+            if(is_end_state(e, s)) {
+                has_end_state = true;
+                continue;
+            }
+            double expected_value = backup(s);
+            double difference = expected_value - value_function_.value(s);
+            min_difference = std::min(min_difference, difference);
+            max_difference = std::max(max_difference, difference);
+            backed_up_values_[s.id()] = expected_value;
+        }
+        if(has_end_state) {
+            min_difference = std::min(min_difference, 0.0);
+            max_difference = std::max(max_difference, 0.0);
+        }
+        double c = discount_rate_ / (1 - discount_rate_);
+        double correction = c * (min_difference + max_difference) / 2;
+        for(const State& s : e.states()) {
+            if(is_end_state(e, s)) {
+                continue;
+            }
+            value_function_.set_value(s, backed_up_values_[s.id()] + correction);
+        }
+        certified_error_ = c * (max_difference - min_difference) / 2;
+        return certified_error_;
+    }
+
+    double distribution_backup(const Environment& e, const Policy& p, const State& s) {
+        double expected_value = 0;
+        Policy::ActionDistributionView action_dist = p.action_distribution(e, s, action_dist_);
+        // A policy must have an action for every non-end state.
+        Expects(action_dist.action_count());
+        // The action_dist can't have zero weight in total.
+        Expects(action_dist.total_weight());
+        // The bulk backup covers every allowed action, so it is only used when the policy weights
+        // most of them. Otherwise, only the policy's actions are backed up.
+        const bool bulk = covers_most_allowed_actions(e, s, action_dist.action_count());
+        if(bulk) {
+            e.action_values(s, value_function_, discount_rate_, action_values_);
+        }
+        for(const Policy::ActionWeight& entry : action_dist.entries()) {
+            const Action& action = *CHECK_NOTNULL(entry.action);
+            Weight action_weight = entry.weight;
+            // A policy's actions can't have zero weight.
+            Expects(action_weight);
+            Expects(e.is_action_allowed(s, action));
+            double probability = action_weight / action_dist.total_weight();
+            double action_value = bulk
+                    ? action_values_[action.id()]
+                    : e.action_value(s, action, value_function_, discount_rate_);
+            expected_value += probability * action_value;
+        }
+        return expected_value;
+    }
+
+    /**
+     * \returns true if \c action_count is more than half of the actions allowed in \c s.
+     */
+    static bool covers_most_allowed_actions(const Environment& e, const State& s,
+                                            ID action_count) {
+        ID allowed_count = 0;
+        for(const Action& a : e.actions()) {
+            if(e.is_action_allowed(s, a) and ++allowed_count >= 2 * action_count) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Fills state_to_action_ if the policy has exactly one action for every non-end state.
+     * Otherwise, state_to_action_ is left empty.
+     *
+     * A DenseDeterministicPolicy's array is copied, rather than querying every state. Evaluators
+     * are given the policy through the Policy interface (by evaluate() and the policy improvers),
+     * so its type is found at run time rather than by an overload.
+     */
+    void inspect_policy(const Environment& e, const Policy& p) {
+        state_to_action_.clear();
+        dense_policy_ = dynamic_cast<const DenseDeterministicPolicy*>(&p);
+        if(dense_policy_) {
+            inspect_dense_policy(e, *dense_policy_);
+            return;
+        }
+        std::vector<ID> state_to_action(static_cast<std::size_t>(e.state_count()), NO_ACTION);
+        for(const State& s : e.states()) {
+            if(e.is_end_state(s)) {
+                continue;
+            }
+            Policy::ActionDistributionView action_dist = p.action_distribution(e, s, action_dist_);
+            if(action_dist.action_count() != 1) {
+                // Leave the checks of the distribution to distribution_backup().
+                policy_inspected_ = true;
+                return;
+            }
+            state_to_action[s.id()] = action_dist.any().id();
+        }
+        state_to_action_ = std::move(state_to_action);
+        policy_inspected_ = true;
+    }
+
+    void inspect_dense_policy(const Environment& e, const DenseDeterministicPolicy& p) {
+        dense_policy_revision_ = p.revision();
+        std::vector<ID> state_to_action = p.state_to_action();
+        CHECK_EQ(static_cast<ID>(state_to_action.size()), e.state_count());
+        for(const State& s : e.states()) {
+            if(e.is_end_state(s)) {
+                state_to_action[s.id()] = NO_ACTION;
+            } else if(state_to_action[s.id()] == DenseDeterministicPolicy::NO_ACTION) {
+                // Leave the error to distribution_backup().
+                policy_inspected_ = true;
+                return;
+            }
+        }
+        state_to_action_ = std::move(state_to_action);
+        policy_inspected_ = true;
+    }
+
+    bool is_end_state(const Environment& e, const State& s) const {
+        // The dense array avoids the environment's end state lookup.
+        if(!state_to_action_.empty()) {
+            return state_to_action_[s.id()] == NO_ACTION;
+        }
+        return e.is_end_state(s);
     }
 
 private:
     ValueTable value_function_;
+    std::string value_table_path_{};
+    util::MappedFile::Options value_table_options_{};
+    // Reused between states to hold the output of Policy::action_distribution().
+    Policy::ActionDistribution action_dist_{};
+    // Reused between states to hold the output of Environment::action_values().
+    std::vector<double> action_values_{};
+    // Dense state->action array. Empty unless the policy has a single action for every state.
+    std::vector<ID> state_to_action_{};
+    bool policy_inspected_ = false;
+    // Set if the policy is a DenseDeterministicPolicy, along with the revision that was read.
+    const DenseDeterministicPolicy* dense_policy_ = nullptr;
+    long dense_policy_revision_ = 0;
+    StoppingMode stopping_mode_ = StoppingMode::DELTA;
+    // Jacobi sweep buffer for the CERTIFIED_ERROR stopping mode.
+    std::vector<double> backed_up_values_{};
+    double certified_error_ = std::numeric_limits<double>::infinity();
 };
 
 } // namespace rl
@@ -2,94 +2,180 @@
 #include "RandomPolicy.h"
 #include <rl/BlendedPolicy.h>
 
+#include <algorithm>
+#include <limits>
+
 namespace rl {
 
 void MCEvaluator3::initialize(const Environment& env, const Policy& policy) {
     impl::PolicyEvaluator::initialize(env, policy);
     // note: these assignments might be switched to heap construction eventually.
     value_function_ = ActionValueTable(env.state_count(), env.action_count());
-    deltas = StateActionMap<double>(env);
-    cumulative_sampling_ratios = StateActionMap<double>(env);
+    // Only the live (state, action) pairs are stored, so end states and disallowed actions are not
+    // considered when calculating the max delta and min visit.
+    deltas = CompactStateActionMap<double>(env);
+    cumulative_sampling_ratios = CompactStateActionMap<double>(env);
+    weighted_m2_ = CompactStateActionMap<double>(env);
+    squared_ratio_sums_ = CompactStateActionMap<double>(env);
+    sampling_ratios_ = CompactStateActionMap<double>(env);
+    sampling_ratio_steps_.assign(static_cast<std::size_t>(env.state_count()), 0);
     long initial_count = 0;
-    // End states wont be visited and they should not be considered when calculating the min visit.
-    long end_state_initial_count = std::numeric_limits<long>::max();
-    visit_counts = StateActionMap<long>(env, initial_count, end_state_initial_count);
+    visit_counts = CompactStateActionMap<long>(env, initial_count);
+    CHECK(!visit_counts.empty()) << "The environment has no allowed (state, action) pairs.";
+    visit_counter_.reset(visit_counts.size());
+    delta_tracker_.reset(visit_counts.size());
+    truncated_trial_count_ = 0;
+    simulated_action_count_ = 0;
+    exploring_starts_.reset(env);
+    start_heap_.reset(visit_counts.size(), std::numeric_limits<double>::infinity());
     double blend = 0.5;
     p_behaviour_policy = std::make_unique<BlendedPolicy>(&policy, &random_policy, blend);
 }
 
 bool MCEvaluator3::finished() const {
+    if(start_scheduling_ == StartScheduling::VARIANCE) {
+        // Pairs below MIN_VARIANCE_VISIT have an infinite priority.
+        return steps_ > 0 and start_heap_.top_priority() <= target_variance_;
+    }
     return most_recent_delta_ < delta_threshold_ and min_visit > MIN_VISIT;
 }
 
 void MCEvaluator3::step() {
     const Environment& env = *CHECK_NOTNULL(env_);
+    // The target policy may have changed since the last step (e.g. a policy that is greedy with
+    // respect to a value function), so the behaviour policy's cache can't be trusted.
+    p_behaviour_policy->invalidate();
+    if(start_scheduling_ == StartScheduling::VARIANCE) {
+        step_by_variance(env);
+    } else {
+        step_least_visited(env);
+    }
+    // The max covers every pair, including those that weren't started from or passed through in
+    // this step, which keep their older delta.
+    most_recent_delta_ = delta_tracker_.max();
+    min_visit = visit_counter_.min();
+    steps_++;
+}
+
+void MCEvaluator3::step_least_visited(const Environment& env) {
     // Breaking from Sutton & Barto, I'm using exploring starts for the off-policy importance
     // sampling so that a full evaluation function can be obtained.
-    for(const State& start_state : env.states()) {
-        if(env.is_end_state(start_state)) {
-            continue;
+    for(long start_index : exploring_starts_.begin_step()) {
+        const State& start_state = env.state(exploring_starts_.pair(start_index).first);
+        const Action& start_action = env.action(exploring_starts_.pair(start_index).second);
+        // For the (start_state, start_action) pair that has been visited least:
+        // Keep trying this state-action pair as start states until the target policy has a
+        // non-zero chance of carrying out the _full_ trial. When this happens, the value
+        // function for our (start_state, start_action) pair will be updated.
+        // This inner loop hopes to reduce the time it takes for the min delta to fall bellow
+        // the threshold.
+        bool least_visited = (visit_counts.data(start_state, start_action) == min_visit);
+        long visit_count_before = visit_counts.data(start_state, start_action);
+        auto finished = [&]() {
+            bool fin = !least_visited or
+                    (least_visited &&
+                     visit_count_before != visit_counts.data(start_state, start_action));
+            return fin;
+        };
+        // Loop until we get 1 visit for the (start_state, start_action) pair.
+        while(!finished()) {
+            run_start(env, start_state, start_action);
         }
-        for(const Action& start_action : env.actions()) {
-            if(!env.is_action_allowed(start_state, start_action)) {
-                continue;
-            }
-            // For the (start_state, start_action) pair that has been visited least:
-            // Keep trying this state-action pair as start states until the target policy has a
-            // non-zero chance of carrying out the _full_ trial. When this happens, the value
-            // function for our (start_state, start_action) pair will be updated.
-            // This inner loop hopes to reduce the time it takes for the min delta to fall bellow
-            // the threshold.
-            bool least_visited = (visit_counts.data(start_state, start_action) == min_visit);
-            long visit_count_before = visit_counts.data(start_state, start_action);
-            auto finished = [&]() {
-                bool fin = !least_visited or
-                        (least_visited &&
-                         visit_count_before != visit_counts.data(start_state, start_action));
-                return fin;
-            };
-            // Loop until we get 1 visit for the (start_state, start_action) pair.
-            while(!finished()) {
-                Trace trace = run_trial(env, *p_behaviour_policy, &start_state, &start_action);
-                update_action_value_fctn(trace);
-            }
+    }
+    exploring_starts_.end_step([this](long index) {
+        return deltas[index] < delta_threshold_ and visit_counts[index] > MIN_VISIT;
+    });
+}
+
+void MCEvaluator3::step_by_variance(const Environment& env) {
+    for(std::size_t i = 0; i < start_heap_.size(); i++) {
+        if(start_heap_.top_priority() <= target_variance_) {
+            break;
+        }
+        long start_index = start_heap_.top();
+        const State& start_state = env.state(exploring_starts_.pair(start_index).first);
+        const Action& start_action = env.action(exploring_starts_.pair(start_index).second);
+        // As for the least visited pairs, repeat until the start pair gets a visit. Its priority
+        // only changes when it does.
+        long visit_count_before = visit_counts[start_index];
+        while(visit_counts[start_index] == visit_count_before) {
+            run_start(env, start_state, start_action);
         }
     }
-    most_recent_delta_ = *std::max_element(std::begin(deltas.data()), std::end(deltas.data()));
-    min_visit = *std::min_element(std::begin(visit_counts.data()), std::end(visit_counts.data()));
-    steps_++;
 }
 
-void MCEvaluator3::update_action_value_fctn(const Trace& trace) {
+void MCEvaluator3::run_start(const Environment& env, const State& start_state,
+                             const Action& start_action) {
+    if(!truncated_trials_) {
+        TrialEnd end = run_trial(env, *p_behaviour_policy, trace_, &start_state, &start_action,
+                                 trial_limits_);
+        simulated_action_count_ += static_cast<long>(trace_.size()) - 1;
+        if(end != TrialEnd::END_STATE) {
+            truncated_trial_count_++;
+        }
+        update_action_value_fctn(trace_);
+        return;
+    }
+    trace_.clear();
+    TrialEnd end = impl::record_trial_while(
+            env, *p_behaviour_policy, &start_state, &start_action,
+            [this](const State& state, const Action* action, double reward) {
+                // The start action is exempt: the start pair is updated whatever its ratio.
+                if(action and !trace_.empty()
+                   and action_sampling_ratio(state, visit_counts.index(state, *action)) == 0.0) {
+                    return false;
+                }
+                ID action_id = action ? action->id() : TraceBuffer::NO_ACTION;
+                trace_.push_back(state.id(), action_id, reward);
+                return true;
+            }, trial_limits_);
+    if(end == TrialEnd::STOPPED) {
+        // The action that stopped the trial wasn't taken.
+        simulated_action_count_ += static_cast<long>(trace_.size());
+        return;
+    }
+    simulated_action_count_ += static_cast<long>(trace_.size()) - 1;
+    if(end != TrialEnd::END_STATE) {
+        truncated_trial_count_++;
+    }
+    update_action_value_fctn(trace_);
+}
+
+void MCEvaluator3::update_action_value_fctn(const TraceBuffer& trace) {
     const Environment& env = *CHECK_NOTNULL(env_);
-    const Policy& policy = *CHECK_NOTNULL(policy_);
     double retrn = 0;
     double sampling_ratio = 1.0;
-    retrn += trace.back().reward;
-    for (auto it = std::next(std::crbegin(trace)); it != std::crend(trace); ++it) {
-        const TimeStep& ts = *it;
-        const Action& action = *CHECK_NOTNULL(ts.action);
+    retrn += trace.rewards().back();
+    // Iterate backwards, starting from the step before the end state.
+    for (std::size_t i = trace.size() - 1; i-- > 0;) {
+        const State& state = env.state(trace.state_id(i));
+        const Action& action = env.action(trace.action_id(i));
+        long index = visit_counts.index(state, action);
+        CHECK_NE(index, CompactStateActionMap<long>::NO_INDEX)
+                << "The (state, action) pair is not live.";
         // Update value function.
-        double updated_cumulative_weight = cumulative_sampling_ratios.data(ts.state, action)
-                                           + sampling_ratio;
-        double current_val = value_function_.value(ts.state, action);
+        double updated_cumulative_weight = cumulative_sampling_ratios[index] + sampling_ratio;
+        double current_val = value_function_.value(state, action);
         double updated_val = current_val + sampling_ratio / updated_cumulative_weight *
                                            (retrn - current_val);
         // Update other data.
-        value_function_.set_value(ts.state, action, updated_val);
-        visit_counts.data(ts.state, action)++;
-        deltas.set(ts.state, action, std::abs(updated_val - current_val));
-        cumulative_sampling_ratios.set(ts.state, action, updated_cumulative_weight);
-        retrn += ts.reward;
+        value_function_.set_value(state, action, updated_val);
+        weighted_m2_[index] += sampling_ratio * (retrn - current_val) * (retrn - updated_val);
+        squared_ratio_sums_[index] += sampling_ratio * sampling_ratio;
+        long n = ++visit_counts[index];
+        visit_counter_.add_visits(n - 1, n);
+        deltas[index] = std::abs(updated_val - current_val);
+        delta_tracker_.set(index, deltas[index]);
+        cumulative_sampling_ratios[index] = updated_cumulative_weight;
+        if(start_scheduling_ == StartScheduling::VARIANCE) {
+            start_heap_.update(index, value_variance(index));
+        }
+        retrn += trace.reward(i);
         // note: The sampling ratio is updated _after_ updating the value function. This is done
         // so that we still get estimates for every state-action pair even if the target policy
         // would never take such an action in a given state. By doing this we are able to answer:
         // "If action a is taken in state s then target policy is followed, what is the return?"
-        double behaviour_action_prob =
-                p_behaviour_policy->possible_actions(env, ts.state).probability(action);
-        double target_action_prob = policy.possible_actions(env, ts.state).probability(action);
-        CHECK_GT(behaviour_action_prob, 0.0);
-        sampling_ratio *= (target_action_prob / behaviour_action_prob);
+        sampling_ratio *= action_sampling_ratio(state, index);
         // If the target policy could never take this route, exit.
         if (sampling_ratio == 0.0) {
             break;
@@ -97,6 +183,94 @@ void MCEvaluator3::update_action_value_fctn(const Trace& trace) {
     }
 }
 
+void MCEvaluator3::set_pair_retirement(bool enabled, int reverify_interval) {
+    exploring_starts_.set_retirement(enabled, reverify_interval);
+}
+
+long MCEvaluator3::retired_pair_count() const {
+    return exploring_starts_.retired_count();
+}
+
+double MCEvaluator3::action_sampling_ratio(const State& state, long index) {
+    CHECK_NE(index, CompactStateActionMap<double>::NO_INDEX)
+            << "The (state, action) pair is not live.";
+    long& filled_step = sampling_ratio_steps_[static_cast<std::size_t>(state.id())];
+    if(filled_step != steps_ + 1) {
+        const Environment& env = *CHECK_NOTNULL(env_);
+        const Policy& policy = *CHECK_NOTNULL(policy_);
+        // One target distribution per state and step, rather than one per time step.
+        Policy::ActionDistributionView target =
+                policy.action_distribution(env, state, target_action_dist_);
+        for(const Action& action : env.actions()) {
+            long i = sampling_ratios_.index(state, action);
+            if(i == CompactStateActionMap<double>::NO_INDEX) {
+                continue;
+            }
+            double behaviour_action_prob = p_behaviour_policy->probability(env, state, action);
+            CHECK_GT(behaviour_action_prob, 0.0);
+            sampling_ratios_[i] = target.probability(action) / behaviour_action_prob;
+        }
+        filled_step = steps_ + 1;
+    }
+    return sampling_ratios_[index];
+}
+
+void MCEvaluator3::set_truncated_trials(bool enabled) {
+    truncated_trials_ = enabled;
+}
+
+bool MCEvaluator3::truncated_trials() const {
+    return truncated_trials_;
+}
+
+long MCEvaluator3::simulated_action_count() const {
+    return simulated_action_count_;
+}
+
+void MCEvaluator3::set_trial_limits(const TrialLimits& limits) {
+    Expects(!limits.detect_cycles or limits.max_length != TrialLimits::NO_MAX_LENGTH);
+    trial_limits_ = limits;
+}
+
+const TrialLimits& MCEvaluator3::trial_limits() const {
+    return trial_limits_;
+}
+
+long MCEvaluator3::truncated_trial_count() const {
+    return truncated_trial_count_;
+}
+
+void MCEvaluator3::set_variance_scheduling(double target_standard_error) {
+    Expects(target_standard_error > 0);
+    start_scheduling_ = StartScheduling::VARIANCE;
+    target_variance_ = target_standard_error * target_standard_error;
+    if(!visit_counts.empty()) {
+        for(long i = 0; i < visit_counts.size(); i++) {
+            start_heap_.update(i, value_variance(i));
+        }
+    }
+}
+
+MCEvaluator3::StartScheduling MCEvaluator3::start_scheduling() const {
+    return start_scheduling_;
+}
+
+double MCEvaluator3::value_variance(const State& s, const Action& a) const {
+    long index = visit_counts.index(s, a);
+    CHECK_NE(index, CompactStateActionMap<long>::NO_INDEX);
+    return value_variance(index);
+}
+
+double MCEvaluator3::value_variance(long index) const {
+    if(visit_counts[index] < MIN_VARIANCE_VISIT) {
+        return std::numeric_limits<double>::infinity();
+    }
+    // The weighted variance of the returns, over the effective sample size (sum w)^2 / sum w^2.
+    double weight_sum = cumulative_sampling_ratios[index];
+    double variance = std::max(weighted_m2_[index], 0.0) / weight_sum;
+    return variance * squared_ratio_sums_[index] / (weight_sum * weight_sum);
+}
+
 void MCEvaluator3::set_averaging_mode(MCEvaluator3::AveragingMode mode) {
     averaging_mode_ = mode;
 }
@@ -1,9 +1,13 @@
 #pragma once
 
+#include "impl/ConvergenceStats.h"
+#include "impl/ExploringStarts.h"
 #include "impl/PolicyEvaluator.h"
+#include "util/IndexedHeap.h"
 #include "StateActionMap.h"
 #include "Trial.h"
 #include "RandomPolicy.h"
+#include "BlendedPolicy.h"
 
 namespace rl {
 
@@ -23,6 +27,20 @@ public:
     enum class AveragingMode {STANDARD, WEIGHTED};
     static const int MIN_VISIT = 100;
 
+    /**
+     * How the exploring starts of a step are chosen.
+     *
+     * LEAST_VISITED: every pair is a start, and the least visited pairs are started from until
+     *                they get a visit. The default.
+     * VARIANCE: each start is the pair with the largest estimated variance of its value: the
+     *           weighted variance of its returns over their effective sample size. A step runs as
+     *           many starts as there are pairs, so trials go to the least certain estimates. See
+     *           set_variance_scheduling().
+     */
+    enum class StartScheduling {LEAST_VISITED, VARIANCE};
+    // In VARIANCE scheduling, a pair's variance estimate is only trusted after this many visits.
+    static constexpr int MIN_VARIANCE_VISIT = 10;
+
 public:
     void set_averaging_mode(AveragingMode mode);
     void initialize(const Environment& env, const Policy& policy) override;
@@ -30,18 +48,106 @@ public:
     bool finished() const override;
     const ActionValueTable& value_function() const override;
 
+    /**
+     * Enables skipping the (state, action) pairs whose own delta is below the delta threshold
+     * and whose visit count is above MIN_VISIT, as for FirstVisitMCActionValuePredictor.
+     */
+    void set_pair_retirement(
+            bool enabled, int reverify_interval=impl::ExploringStarts::DEFAULT_REVERIFY_INTERVAL);
+    long retired_pair_count() const;
+
+    /**
+     * Switches to VARIANCE start scheduling. The evaluator is then finished when the estimated
+     * standard error of every pair's value is at most \c target_standard_error, instead of when
+     * the delta and visit criteria are met. Pair retirement isn't used.
+     */
+    void set_variance_scheduling(double target_standard_error);
+    StartScheduling start_scheduling() const;
+
+    /**
+     * \returns the estimated variance of the value of (s, a) (the square of its standard error).
+     * Infinite before MIN_VARIANCE_VISIT visits.
+     */
+    double value_variance(const State& s, const Action& a) const;
+
+    /**
+     * Enables truncated trials (disabled by default). This is a different estimator from the
+     * default, not just a faster way of computing it.
+     *
+     * A trial is run to update its start pair, which requires the target policy to be able to
+     * take every action after the start. With truncation, the trial is abandoned as soon as the
+     * behaviour policy takes an action that the target policy never would, rather than being
+     * simulated to the end, and none of its returns are used. A full trial also updates the pairs
+     * after the last such action (its tail), whatever happened before it; a truncated trial
+     * throws those updates away. So with truncation, a pair is only updated by trials that the
+     * target policy could have taken from the start pair onwards. Fewer actions are simulated,
+     * but each trial updates fewer pairs, and the pairs that were mostly updated from the tails
+     * of other trials need more starts of their own.
+     *
+     * Both estimators converge to the target policy's values, but give different estimates
+     * along the way. For a deterministic target policy and environment, every update uses the
+     * exact return, so the values match once every pair has been updated.
+     */
+    void set_truncated_trials(bool enabled);
+    bool truncated_trials() const;
+
+    /**
+     * \returns the number of actions taken by the trials since initialize(), including the
+     *          trials that were abandoned.
+     */
+    long simulated_action_count() const;
+
+    /**
+     * Bounds the trials (no bounds by default), as for FirstVisitMCActionValuePredictor. Trials
+     * that are abandoned by set_truncated_trials() aren't counted by truncated_trial_count().
+     */
+    void set_trial_limits(const TrialLimits& limits);
+    const TrialLimits& trial_limits() const;
+    long truncated_trial_count() const;
+
 private:
-    void update_action_value_fctn(const Trace& trace);
+    void step_least_visited(const Environment& env);
+    void step_by_variance(const Environment& env);
+    void run_start(const Environment& env, const State& start_state, const Action& start_action);
+    void update_action_value_fctn(const TraceBuffer& trace);
+    double value_variance(long index) const;
+    double action_sampling_ratio(const State& state, long index);
 
 private:
     AveragingMode averaging_mode_ = AveragingMode::WEIGHTED;
-    std::unique_ptr<Policy> p_behaviour_policy;
+    std::unique_ptr<BlendedPolicy> p_behaviour_policy;
     ActionValueTable value_function_;
+    // Reused by every trial.
+    TraceBuffer trace_{};
     RandomPolicy random_policy;
-    StateActionMap<double> cumulative_sampling_ratios;
-    StateActionMap<double> deltas;
-    StateActionMap<long> visit_counts;
+    CompactStateActionMap<double> cumulative_sampling_ratios;
+    CompactStateActionMap<double> deltas;
+    CompactStateActionMap<long> visit_counts;
+    // The weighted sum of squared deviations of the returns from the value (West's update), and
+    // the sum of the squared sampling ratios, for the effective sample size.
+    CompactStateActionMap<double> weighted_m2_;
+    CompactStateActionMap<double> squared_ratio_sums_;
     long min_visit = 0;
+    impl::ExploringStarts exploring_starts_{};
+    StartScheduling start_scheduling_ = StartScheduling::LEAST_VISITED;
+    double target_variance_ = 0;
+    // The pairs by value_variance(), for VARIANCE scheduling. Keyed by the CompactStateActionMap
+    // index.
+    util::IndexedMaxHeap start_heap_{};
+    impl::MinVisitCounter visit_counter_{};
+    // Keyed by the CompactStateActionMap index.
+    impl::MaxDeltaTracker delta_tracker_{};
+    // Reused to hold the output of Policy::action_distribution().
+    Policy::ActionDistribution target_action_dist_{};
+    bool truncated_trials_ = false;
+    TrialLimits trial_limits_{};
+    long truncated_trial_count_ = 0;
+    long simulated_action_count_ = 0;
+    // The target / behaviour probability ratio of each pair. A state's row is filled on its first
+    // use in a step, as the target policy may change between steps.
+    CompactStateActionMap<double> sampling_ratios_;
+    // By state ID: the step (counting from 1) in which the state's row was filled, or 0.
+    std::vector<long> sampling_ratio_steps_{};
 };
 
 } // namespace rl
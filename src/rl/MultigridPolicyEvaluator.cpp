@@ -0,0 +1,282 @@
+#include "MultigridPolicyEvaluator.h"
+
+#include "rl/impl/PolicyTransitions.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace rl {
+
+namespace {
+
+using Row = std::vector<std::pair<ID, double>>;
+
+/**
+ * Appends a row (next node, probability) to the compressed sparse rows. Duplicate next nodes are
+ * merged.
+ */
+template<typename LevelT>
+void append_row(LevelT& level, Row& row) {
+    std::sort(std::begin(row), std::end(row),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    for(std::size_t i = 0; i < row.size(); i++) {
+        if(i > 0 and row[i].first == row[i-1].first) {
+            level.probabilities.back() += row[i].second;
+        } else {
+            level.next_nodes.push_back(row[i].first);
+            level.probabilities.push_back(row[i].second);
+        }
+    }
+    level.row_begin.push_back(static_cast<long>(level.next_nodes.size()));
+}
+
+} // namespace
+
+void MultigridPolicyEvaluator::initialize(const Environment& env, const Policy& policy) {
+    impl::PolicyEvaluator::initialize(env, policy);
+    value_function_ = ValueTable(env.state_count());
+    // The hierarchy is built on the first step so that an invalid policy causes step() to throw
+    // rather than initialize().
+    levels_.clear();
+    fine_sweeps_ = 0;
+}
+
+void MultigridPolicyEvaluator::step() {
+    const Environment& env = *CHECK_NOTNULL(env_);
+    if(levels_.empty()) {
+        build_hierarchy();
+    }
+    Level& fine = levels_.front();
+    if(levels_.size() == 1) {
+        // Nothing to accelerate with. This is just IterativePolicyEvaluator.
+        most_recent_delta_ = gauss_seidel(fine);
+        fine_sweeps_++;
+    } else {
+        cycle(0);
+    }
+    for(ID id = 0; id < fine.node_count(); id++) {
+        value_function_.set_value(env.state(id), fine.x[id]);
+    }
+    steps_++;
+}
+
+const ValueTable& MultigridPolicyEvaluator::value_function() const {
+    return value_function_;
+}
+
+void MultigridPolicyEvaluator::add_level(int group_count, std::vector<int> node_to_group) {
+    Expects(group_count > 0);
+    for(int group : node_to_group) {
+        CHECK(group == NO_GROUP or (group >= 0 and group < group_count));
+    }
+    groupings_.emplace_back(group_count, std::move(node_to_group));
+    levels_.clear();
+}
+
+void MultigridPolicyEvaluator::set_grid_hierarchy(int height, int width, int block_size) {
+    Expects(height > 0 and width > 0);
+    Expects(block_size > 1);
+    clear_levels();
+    while(height * width > COARSEST_NODE_COUNT) {
+        int coarse_height = (height + block_size - 1) / block_size;
+        int coarse_width = (width + block_size - 1) / block_size;
+        std::vector<int> node_to_group(static_cast<std::size_t>(height * width));
+        for(int y = 0; y < height; y++) {
+            for(int x = 0; x < width; x++) {
+                node_to_group[y * width + x] = (y / block_size) * coarse_width + x / block_size;
+            }
+        }
+        add_level(coarse_height * coarse_width, std::move(node_to_group));
+        height = coarse_height;
+        width = coarse_width;
+    }
+}
+
+void MultigridPolicyEvaluator::clear_levels() {
+    groupings_.clear();
+    levels_.clear();
+}
+
+void MultigridPolicyEvaluator::set_smoothing_sweeps(int sweeps) {
+    Expects(sweeps > 0);
+    smoothing_sweeps_ = sweeps;
+}
+
+long MultigridPolicyEvaluator::fine_sweeps_done() const {
+    return fine_sweeps_;
+}
+
+void MultigridPolicyEvaluator::build_hierarchy() {
+    levels_.clear();
+    levels_.emplace_back();
+    build_fine_level(levels_.front());
+    auto add_coarse_level = [this](int group_count, std::vector<int> node_to_group) {
+        CHECK_EQ(static_cast<int>(node_to_group.size()), levels_.back().node_count())
+            << "A node->group map must have an entry for every node of the previous level.";
+        levels_.back().to_group = std::move(node_to_group);
+        Level coarse;
+        build_coarse_level(levels_.back(), group_count, coarse);
+        levels_.emplace_back(std::move(coarse));
+    };
+    if(groupings_.empty()) {
+        while(levels_.back().node_count() > COARSEST_NODE_COUNT) {
+            int node_count = levels_.back().node_count();
+            int group_count = (node_count + DEFAULT_BLOCK_SIZE - 1) / DEFAULT_BLOCK_SIZE;
+            std::vector<int> node_to_group(static_cast<std::size_t>(node_count));
+            for(int node = 0; node < node_count; node++) {
+                node_to_group[node] = node / DEFAULT_BLOCK_SIZE;
+            }
+            add_coarse_level(group_count, std::move(node_to_group));
+        }
+    } else {
+        for(const auto& grouping : groupings_) {
+            add_coarse_level(grouping.first, grouping.second);
+        }
+    }
+    for(Level& level : levels_) {
+        level.x.assign(static_cast<std::size_t>(level.node_count()), 0.0);
+        if(&level != &levels_.front()) {
+            level.b.assign(static_cast<std::size_t>(level.node_count()), 0.0);
+        }
+    }
+}
+
+void MultigridPolicyEvaluator::build_fine_level(Level& fine) {
+    const Environment& env = *CHECK_NOTNULL(env_);
+    const Policy& policy = *CHECK_NOTNULL(policy_);
+    const auto state_count = static_cast<std::size_t>(env.state_count());
+    fine.row_begin.assign(1, 0);
+    fine.fixed.assign(state_count, 0);
+    fine.b.assign(state_count, 0.0);
+    Row row;
+    for(const State& s : env.states()) {
+        row.clear();
+        if(env.is_end_state(s)) {
+            fine.fixed[s.id()] = 1;
+            append_row(fine, row);
+            continue;
+        }
+        fine.b[s.id()] = impl::policy_transitions(env, policy, s, row);
+        append_row(fine, row);
+    }
+}
+
+void MultigridPolicyEvaluator::build_coarse_level(const Level& fine, int group_count,
+                                                  Level& coarse) {
+    const auto coarse_count = static_cast<std::size_t>(group_count);
+    std::vector<int> group_size(coarse_count, 0);
+    for(int node = 0; node < fine.node_count(); node++) {
+        int group = fine.to_group[node];
+        if(group != NO_GROUP and !fine.fixed[node]) {
+            group_size[group]++;
+        }
+    }
+    coarse.fixed.assign(coarse_count, 0);
+    coarse.inverse_group_size.assign(coarse_count, 0.0);
+    for(std::size_t group = 0; group < coarse_count; group++) {
+        if(group_size[group]) {
+            coarse.inverse_group_size[group] = 1.0 / group_size[group];
+        } else {
+            // An empty group receives no residual, so its correction is always zero.
+            coarse.fixed[group] = 1;
+        }
+    }
+    // Galerkin operator: P_coarse[g][h] = avg over s in g of (sum over s' in h of P[s][s']).
+    // Transitions into fixed nodes or nodes without a group are dropped; the error at those nodes
+    // isn't corrected by the coarse level.
+    std::vector<Row> rows(coarse_count);
+    for(int node = 0; node < fine.node_count(); node++) {
+        int group = fine.to_group[node];
+        if(group == NO_GROUP or fine.fixed[node]) {
+            continue;
+        }
+        for(long i = fine.row_begin[node]; i < fine.row_begin[node + 1]; i++) {
+            int next_node = fine.next_nodes[i];
+            int next_group = fine.to_group[next_node];
+            if(next_group == NO_GROUP or fine.fixed[next_node]) {
+                continue;
+            }
+            rows[group].emplace_back(next_group,
+                                     fine.probabilities[i] * coarse.inverse_group_size[group]);
+        }
+    }
+    coarse.row_begin.assign(1, 0);
+    for(Row& row : rows) {
+        append_row(coarse, row);
+    }
+}
+
+void MultigridPolicyEvaluator::cycle(std::size_t level_index) {
+    Level& level = levels_[level_index];
+    if(level_index + 1 == levels_.size()) {
+        solve_coarsest(level);
+        return;
+    }
+    bool is_fine = (level_index == 0);
+    for(int i = 0; i < smoothing_sweeps_; i++) {
+        gauss_seidel(level);
+    }
+    // Restrict the residual onto the coarse level.
+    Level& coarse = levels_[level_index + 1];
+    std::fill(std::begin(coarse.b), std::end(coarse.b), 0.0);
+    for(int node = 0; node < level.node_count(); node++) {
+        int group = level.to_group[node];
+        if(group == NO_GROUP or level.fixed[node]) {
+            continue;
+        }
+        double backup = level.b[node];
+        for(long i = level.row_begin[node]; i < level.row_begin[node + 1]; i++) {
+            backup += discount_rate_ * level.probabilities[i] * level.x[level.next_nodes[i]];
+        }
+        coarse.b[group] += (backup - level.x[node]) * coarse.inverse_group_size[group];
+    }
+    // Solve for the correction, starting from zero.
+    std::fill(std::begin(coarse.x), std::end(coarse.x), 0.0);
+    cycle(level_index + 1);
+    // Prolongate the correction.
+    for(int node = 0; node < level.node_count(); node++) {
+        int group = level.to_group[node];
+        if(group == NO_GROUP or level.fixed[node]) {
+            continue;
+        }
+        level.x[node] += coarse.x[group];
+    }
+    double delta = 0;
+    for(int i = 0; i < smoothing_sweeps_; i++) {
+        delta = gauss_seidel(level);
+    }
+    if(is_fine) {
+        fine_sweeps_ += 2 * smoothing_sweeps_;
+        most_recent_delta_ = delta;
+    }
+}
+
+double MultigridPolicyEvaluator::gauss_seidel(Level& level) const {
+    double delta = 0;
+    for(int node = 0; node < level.node_count(); node++) {
+        if(level.fixed[node]) {
+            continue;
+        }
+        double updated = level.b[node];
+        for(long i = level.row_begin[node]; i < level.row_begin[node + 1]; i++) {
+            updated += discount_rate_ * level.probabilities[i] * level.x[level.next_nodes[i]];
+        }
+        delta = std::max(delta, std::abs(updated - level.x[node]));
+        level.x[node] = updated;
+    }
+    return delta;
+}
+
+void MultigridPolicyEvaluator::solve_coarsest(Level& level) const {
+    // The coarsest level is small, so it is cheap to solve it more accurately than the threshold.
+    const double tolerance = delta_threshold_ / 10;
+    for(int i = 0; i < COARSEST_MAX_SWEEPS; i++) {
+        if(gauss_seidel(level) < tolerance) {
+            return;
+        }
+    }
+    LOG(WARNING) << "The coarsest level didn't converge within " << COARSEST_MAX_SWEEPS
+                 << " sweeps.";
+}
+
+} // namespace rl
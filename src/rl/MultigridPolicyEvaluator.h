@@ -0,0 +1,133 @@
+#pragma once
+
+#include <vector>
+
+#include "rl/Policy.h"
+#include "rl/impl/PolicyEvaluator.h"
+
+namespace rl {
+
+/**
+ * Policy evaluation accelerated by a hierarchy of aggregated (coarse) versions of the problem.
+ *
+ * IterativePolicyEvaluator's sweeps move value information about one state per sweep. On large
+ * grids, a state far from the rewards/end states doesn't see a meaningful value until O(width +
+ * height) sweeps have been done. This evaluator instead carries out a multigrid V-cycle per step:
+ *
+ *     cycle(level, x, b):                  // solves x = b + discount * P * x
+ *         if level is the coarsest:
+ *             Gauss-Seidel sweeps until converged
+ *             return
+ *         smooth: Gauss-Seidel sweep(s) on x
+ *         r = b + discount * P * x - x     // residual
+ *         b_coarse = average of r over each group
+ *         x_coarse = 0
+ *         cycle(level + 1, x_coarse, b_coarse)
+ *         x[s] += x_coarse[group(s)]         // prolongate the correction
+ *         smooth: Gauss-Seidel sweep(s) on x
+ *
+ * The fine level (level 0) is the policy's Markov chain: P is the state->next state transition
+ * matrix when following the policy and b is the expected immediate reward. It is built from the
+ * environment on the first step after initialize(). A coarse level is built by aggregating groups
+ * of nodes of the level below: the transition probability from group g to group h is the average,
+ * over the members of g, of the probability of moving into any member of h (the Galerkin operator
+ * R * P * prolongation, with R being the group average).
+ *
+ * End states have their value fixed at zero and are not part of any group.
+ *
+ * The groups are set with add_level() (a node->group map, in the same form as used by
+ * StateAggregateValueFunction) or set_grid_hierarchy() for grid shaped environments. If no levels
+ * are given, groups of DEFAULT_BLOCK_SIZE consecutive nodes are used.
+ *
+ * Like IterativePolicyEvaluator, the delta used by finished() is the largest change in a state's
+ * value in the last fine level sweep.
+ */
+class MultigridPolicyEvaluator : public StateBasedEvaluator,
+                                 public impl::PolicyEvaluator {
+public:
+    static constexpr int DEFAULT_SMOOTHING_SWEEPS = 1;
+    // Used for the default hierarchy when no levels have been added.
+    static constexpr int DEFAULT_BLOCK_SIZE = 4;
+    // Levels are not coarsened further once they have this many (or fewer) nodes.
+    static constexpr int COARSEST_NODE_COUNT = 16;
+    static constexpr int COARSEST_MAX_SWEEPS = 10000;
+    // Used in node->group maps for nodes that don't belong to any group.
+    static constexpr int NO_GROUP = -1;
+
+public:
+    void initialize(const Environment& env, const Policy& policy) override;
+    void step() override;
+    const ValueTable& value_function() const override;
+
+    /**
+     * Adds a coarser level to the hierarchy.
+     *
+     * The first call maps states to groups, the second call maps the groups of the first call to
+     * (coarser) groups and so on.
+     *
+     * \param group_count the number of nodes in the new level.
+     * \param node_to_group maps each node of the previous level to a group in [0, group_count),
+     *        or to NO_GROUP.
+     */
+    void add_level(int group_count, std::vector<int> node_to_group);
+
+    /**
+     * Sets the hierarchy to repeated block_size x block_size aggregation of grid tiles. The state
+     * IDs must be the tile IDs of a height x width grid (as is the case for GridWorld).
+     */
+    void set_grid_hierarchy(int height, int width, int block_size=2);
+
+    /**
+     * Removes all levels added by add_level() or set_grid_hierarchy().
+     */
+    void clear_levels();
+
+    void set_smoothing_sweeps(int sweeps);
+
+    /**
+     * \returns the number of Gauss-Seidel sweeps carried out over the full state space. Coarse
+     *          level sweeps are not included.
+     */
+    long fine_sweeps_done() const;
+
+private:
+    /**
+     * The system x = b + discount * P * x for one level of the hierarchy, with P stored in
+     * compressed sparse row form.
+     */
+    struct Level {
+        int node_count() const {
+            return static_cast<int>(fixed.size());
+        }
+
+        std::vector<long> row_begin{};
+        std::vector<int> next_nodes{};
+        std::vector<double> probabilities{};
+        // Nodes whose value is pinned to zero (end states and empty groups).
+        std::vector<char> fixed{};
+        // Maps to the nodes of the next (coarser) level. Empty for the coarsest level.
+        std::vector<int> to_group{};
+        // For coarse levels: 1 / (the number of nodes in the group), or 0 for empty groups.
+        std::vector<double> inverse_group_size{};
+        // Working memory.
+        std::vector<double> x{};
+        std::vector<double> b{};
+    };
+
+    void build_hierarchy();
+    void build_fine_level(Level& fine);
+    static void build_coarse_level(const Level& fine, int group_count, Level& coarse);
+    void cycle(std::size_t level_index);
+    double gauss_seidel(Level& level) const;
+    void solve_coarsest(Level& level) const;
+
+private:
+    ValueTable value_function_;
+    std::vector<Level> levels_{};
+    // User supplied groupings: (group count, node->group map) for each coarse level.
+    std::vector<std::pair<int, std::vector<int>>> groupings_{};
+    int smoothing_sweeps_ = DEFAULT_SMOOTHING_SWEEPS;
+    long fine_sweeps_ = 0;
+};
+
+} // namespace rl
@@ -34,7 +34,8 @@ double calculate_state_value(const Environment& env, const ActionValueTable& val
         return 0;
     }
     double state_val = 0;
-    Policy::ActionDistribution action_dist = policy.possible_actions(env, state);
+    Policy::ActionDistribution scratch;
+    Policy::ActionDistributionView action_dist = policy.action_distribution(env, state, scratch);
     for(const Action& action : env.actions()) {
         // note: adding this check, as it isn't fully described whether it is the policy's
         // responsibility to always return 0 for any action executed from an end state. It seems
@@ -1,12 +1,15 @@
 #pragma once
 
+#include <array>
 #include <memory>
+#include <vector>
 #include <glog/logging.h>
 
 #include "rl/Environment.h"
 #include "rl/ValueTable.h"
 #include "rl/DistributionList.h"
 #include "rl/ActionValueTable.h"
+#include "util/random.h"
 
 namespace rl {
 
@@ -21,15 +24,117 @@ bool greater_than(double val1, double val2, double by_at_least);
  */
 class Policy {
 public:
+    /**
+     * An action with its (unnormalized) weight of being chosen.
+     */
+    struct ActionWeight {
+        const Action* action;
+        Weight weight;
+    };
+
+    /**
+     * A non-owning view of the actions (and their weights) that a policy can take from a state,
+     * along with the precomputed total weight.
+     *
+     * A view is only valid while the ActionDistribution (or policy storage) that it was taken from
+     * is unchanged.
+     */
+    class ActionDistributionView {
+    public:
+        ActionDistributionView() = default;
+
+        ActionDistributionView(gsl::span<const ActionWeight> entries, Weight total_weight) :
+            entries_(entries), total_weight_(total_weight)
+        {}
+
+        /**
+         * Chooses an action with probability proportional to its weight.
+         */
+        const Action& random_action() const {
+            return random_action(util::random::generator());
+        }
+
+        const Action& random_action(util::random::Generator& generator) const {
+            Expects(!entries_.empty());
+            // Short-cut return if there is only one element.
+            if(entries_.size() == 1) {
+                return *CHECK_NOTNULL(entries_[0].action);
+            }
+            Weight cumulative_pos =
+                    util::random::random_in_range<Weight>(0, total_weight_, generator);
+            Weight cumulative_end = 0;
+            for(const ActionWeight& entry : entries_) {
+                cumulative_end += entry.weight;
+                if(cumulative_pos < cumulative_end) {
+                    return *CHECK_NOTNULL(entry.action);
+                }
+            }
+            // Only reachable through rounding in the sum above.
+            return *CHECK_NOTNULL(entries_[entries_.size() - 1].action);
+        }
+
+        const Action& any() const {
+            CHECK(!entries_.empty());
+            return *CHECK_NOTNULL(entries_[0].action);
+        }
+
+        Weight total_weight() const {
+            return total_weight_;
+        }
+
+        /**
+         * Returns the weight of the given action being chosen.
+         *
+         * If the given action has no chance of being chosen, 0 will be returned.
+         */
+        Weight weight(const Action& action) const {
+            for(const ActionWeight& entry : entries_) {
+                if(entry.action == &action) {
+                    return entry.weight;
+                }
+            }
+            return 0;
+        }
+
+        /**
+         * Returns the probability of the given action being chosen.
+         */
+        double probability(const Action& action) const {
+            return weight(action) / total_weight();
+        }
+
+        ID action_count() const {
+            return static_cast<ID>(entries_.size());
+        }
+
+        bool empty() const {
+            return entries_.empty();
+        }
+
+        gsl::span<const ActionWeight> entries() const {
+            return entries_;
+        }
+
+    private:
+        gsl::span<const ActionWeight> entries_{};
+        Weight total_weight_ = 0;
+    };
+
+    /**
+     * An owning action distribution.
+     *
+     * Most policies have a few actions per state, so up to INLINE_CAPACITY actions are stored
+     * inline. Creating or copying such a distribution doesn't allocate.
+     */
     class ActionDistribution {
     public:
-        using WeightMap = std::unordered_map<const Action*, Weight>;
+        static constexpr int INLINE_CAPACITY = 4;
+
     public:
         ActionDistribution() = default;
         ActionDistribution(ActionDistribution&&) = default;
         ActionDistribution& operator=(ActionDistribution&&) = default;
         ~ActionDistribution() = default;
-        // The following two are currently being used by some Policies, e.g. StochasticPolicy.
         ActionDistribution(const ActionDistribution&) = default;
         ActionDistribution& operator=(const ActionDistribution&) = default;
 
@@ -41,28 +146,51 @@ public:
         }
 
         void add_action(const Action& a, Weight weight=1) {
-            action_list_.add(weight, &a);
-            // This weight_map_ was first needed by importance sampling MC evaluation- it needs
-            // a mapping from action->weight. A benefit is the simplification of the weight_map()
-            // function.
-            auto res = weight_map_.emplace(&a, weight);
-            bool inserted_without_override = res.second;
-            CHECK(inserted_without_override);
+            Expects(weight > 0);
+            CHECK(view().weight(a) == 0) << "The action is already in the distribution.";
+            if(count_ < INLINE_CAPACITY) {
+                inline_entries_[count_] = ActionWeight{&a, weight};
+            } else {
+                if(count_ == INLINE_CAPACITY) {
+                    overflow_entries_.assign(std::begin(inline_entries_),
+                                             std::end(inline_entries_));
+                }
+                overflow_entries_.push_back(ActionWeight{&a, weight});
+            }
+            count_++;
+            total_weight_ += weight;
+        }
+
+        /**
+         * Removes all actions. Any overflow storage is kept for reuse.
+         */
+        void clear() {
+            count_ = 0;
+            total_weight_ = 0;
+            overflow_entries_.clear();
+        }
+
+        ActionDistributionView view() const {
+            const ActionWeight* data = count_ <= INLINE_CAPACITY ? inline_entries_.data()
+                                                                 : overflow_entries_.data();
+            return ActionDistributionView(gsl::span<const ActionWeight>(data, count_),
+                                          total_weight_);
         }
 
         const Action& random_action() const {
-            const Action& result = *CHECK_NOTNULL(action_list_.random());
-            return result;
+            return view().random_action();
+        }
+
+        const Action& random_action(util::random::Generator& generator) const {
+            return view().random_action(generator);
         }
 
         const Action& any() const {
-            CHECK(!action_list_.entries().empty());
-            const Action& a = *CHECK_NOTNULL(action_list_.entries()[0].data());
-            return a;
+            return view().any();
         }
 
         Weight total_weight() const {
-            return action_list_.total_weight();
+            return total_weight_;
         }
 
         /**
@@ -71,49 +199,77 @@ public:
          * If the given action has no chance of being chosen, 0 will be returned.
          */
         Weight weight(const Action& action) const {
-            auto it = weight_map_.find(&action);
-            if(it == std::end(weight_map_)) {
-                return 0;
-            } else {
-                double res = it->second;
-                return res;
-            }
+            return view().weight(action);
         }
 
         /**
          * Returns the probability of the given action being chosen.
          */
         double probability(const Action& action) const {
-            return weight(action) / total_weight();
+            return view().probability(action);
         }
 
         ID action_count() const {
-            return static_cast<ID>(action_list_.entries().size());
+            return count_;
         }
 
         bool empty() const {
             return action_count() == 0;
         }
 
-        const WeightMap& weight_map() const {
-            return weight_map_;
+        gsl::span<const ActionWeight> entries() const {
+            return view().entries();
         }
 
     private:
-        using ActionList = DistributionList<const Action*, Weight>;
-        ActionList action_list_{};
-        WeightMap weight_map_{};
+        std::array<ActionWeight, INLINE_CAPACITY> inline_entries_{};
+        // Holds all entries once there are more than INLINE_CAPACITY.
+        std::vector<ActionWeight> overflow_entries_{};
+        ID count_ = 0;
+        Weight total_weight_ = 0;
     };
 
 public:
     virtual const Action& next_action(const Environment& env, const State& from_state) const = 0;
 
+    /**
+     * Samples next_action() using \c generator rather than the calling thread's generator. As
+     * with Environment::next_state(), call it through a Policy reference.
+     */
+    const Action& next_action(const Environment& env, const State& from_state,
+                              util::random::Generator& generator) const {
+        util::random::ScopedGenerator scope(generator);
+        return next_action(env, from_state);
+    }
+
     // TODO: decide behaviour for what should happen when there are no actions.
-    // note: the return type could be changed to shared_ptr<ActionDistribution> to allow for the
-    // option of returning an existing object rather than copying.
     virtual ActionDistribution possible_actions(const Environment& env,
                                                 const State& from_state) const = 0;
 
+    /**
+     * The allocation free version of possible_actions(), for use in inner loops.
+     *
+     * Policies that store their distributions return a view of the stored distribution. Others
+     * fill and return a view of \c scratch, which can be reused between calls. The default
+     * implementation copies the result of possible_actions() into \c scratch.
+     *
+     * \returns a view that is valid until \c scratch or the policy is next modified.
+     */
+    virtual ActionDistributionView action_distribution(const Environment& env,
+                                                       const State& from_state,
+                                                       ActionDistribution& scratch) const {
+        scratch = possible_actions(env, from_state);
+        return scratch.view();
+    }
+
+    /**
+     * Called before the const methods are used for \c env from several threads at once (e.g. by
+     * the trial threads of FirstVisitMCValuePredictor). Once it returns, and until the policy is
+     * changed, the const methods must be safe to call concurrently for \c env. A policy that
+     * fills a cache from its const methods fills it here. The default does nothing.
+     */
+    virtual void prepare(const Environment& /*env*/) const {}
+
     virtual ~Policy() = default;
 };
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "FixedActionValueTable.h"
 #include "Policy.h"
 #include "Trial.h"
 #include "impl/PolicyImprover.h"
@@ -16,10 +17,42 @@ public:
 public:
     /**
      * QLearningImprover doesn't use the input policy parameter.
+     *
+     * Environments with 2 or 4 actions (e.g. Blackjack and the grid worlds) use a
+     * FixedActionValueTable, unless sparse tables are selected. The results are the same as with
+     * an ActionValueTable.
      */
     std::unique_ptr<Policy> improve(const Environment& env, const Policy&) const override {
-        ActionValueTable value_function(env.state_count(), env.action_count());
-        QeGreedyPolicy policy{QeGreedyPolicy::create_pure_greedy_policy(value_function)};
+        // Disallowed actions are masked, so that best_action() never chooses them.
+        if(sparse_tables_) {
+            ActionValueTable value_function = ActionValueTable::create_sparse(env);
+            return improve_using(env, value_function);
+        }
+        switch(env.action_count()) {
+            case 2: {
+                FixedActionValueTable<2> value_function(env);
+                return improve_using(env, value_function);
+            }
+            case 4: {
+                FixedActionValueTable<4> value_function(env);
+                return improve_using(env, value_function);
+            }
+            default: {
+                ActionValueTable value_function(env);
+                value_function.enable_greedy_cache();
+                return improve_using(env, value_function);
+            }
+        }
+    }
+
+    /**
+     * Runs Q-learning, starting from and updating the given action-value function.
+     */
+    template<typename ValueFunction>
+    std::unique_ptr<Policy> improve_using(const Environment& env,
+                                          ValueFunction& value_function) const {
+        using GreedyPolicy = BasicQeGreedyPolicy<ValueFunction>;
+        GreedyPolicy policy{GreedyPolicy::create_pure_greedy_policy(value_function)};
         policy.set_e(greedy_e_);
         for(int i = 0; i < iterations_; i++) {
             Trial trial(env);
@@ -52,10 +85,20 @@ public:
         greedy_e_ = e;
     }
 
+    /**
+     * Uses a sparse ActionValueTable, so that memory use scales with the number of visited states
+     * rather than with the state count. Q-learning only visits the states reachable from the
+     * environment's start state, so this helps when they are a small part of the state space.
+     */
+    void set_sparse_tables(bool sparse_tables) {
+        sparse_tables_ = sparse_tables;
+    }
+
 private:
     int iterations_ = DEFAULT_ITER_COUNT;
     double alpha_ = DEFAULT_ALPHA;
     double greedy_e_ = DEFAULT_GREEDY_E;
+    bool sparse_tables_ = false;
 };
 
 } // namespace rl
@@ -14,29 +14,34 @@ namespace rl {
  * function was initialized to 0 and the e-greedy policy was following this somewhat random value
  * function. In some cases this caused very large trials. For example, in a grid world it would
  * nearly always move up. The up action at the top of the grid would result in transitioning to the
- * same state.
+ * same state. The trials of the evaluators can now be bounded with TrialLimits (a max length, and
+ * cycle detection for deterministic environments), which stops this from running out of memory.
+ *
+ * The value function type is a template parameter, so that the policy can follow either an
+ * ActionValueTable or a FixedActionValueTable. Its best_action() is only used if it is masked().
  */
-class QeGreedyPolicy : public rl::Policy {
+template<class ValueFunction>
+class BasicQeGreedyPolicy : public rl::Policy {
 public:
     // Our default e is quite exploratory.
     static constexpr double DEFAULT_E = 0.1;
 public:
-    explicit QeGreedyPolicy(const ActionValueTable& value_function) :
+    explicit BasicQeGreedyPolicy(const ValueFunction& value_function) :
     value_function(value_function) {}
 
-    explicit QeGreedyPolicy(const ActionValueTable& value_function, double e) :
+    explicit BasicQeGreedyPolicy(const ValueFunction& value_function, double e) :
     value_function(value_function),
     e_(e) {}
 
-    QeGreedyPolicy() = delete;
-    QeGreedyPolicy(const QeGreedyPolicy&) = delete;
-    QeGreedyPolicy& operator=(const QeGreedyPolicy&) = delete;
-    QeGreedyPolicy(QeGreedyPolicy&&) = delete;
-    QeGreedyPolicy&& operator=(QeGreedyPolicy&&) = delete;
-    ~QeGreedyPolicy() override = default;
+    BasicQeGreedyPolicy() = delete;
+    BasicQeGreedyPolicy(const BasicQeGreedyPolicy&) = delete;
+    BasicQeGreedyPolicy& operator=(const BasicQeGreedyPolicy&) = delete;
+    BasicQeGreedyPolicy(BasicQeGreedyPolicy&&) = delete;
+    BasicQeGreedyPolicy&& operator=(BasicQeGreedyPolicy&&) = delete;
+    ~BasicQeGreedyPolicy() override = default;
 
-    static QeGreedyPolicy create_pure_greedy_policy(const ActionValueTable& value_function) {
-        return QeGreedyPolicy(value_function, 0);
+    static BasicQeGreedyPolicy create_pure_greedy_policy(const ValueFunction& value_function) {
+        return BasicQeGreedyPolicy(value_function, 0);
     }
 
     const Action& next_action(const Environment& env, const State& from_state) const override {
@@ -51,6 +56,11 @@ public:
             CHECK(env.is_action_allowed(from_state, env.action(random_action_index)));
             return env.action(random_action_index);
         }
+        // A masked table only considers allowed actions, so it can answer directly (and from its
+        // greedy cache, if enabled).
+        if(value_function.masked()) {
+            return env.action(value_function.best_action(from_state).first);
+        }
         const Action* best_action = nullptr;
         double best_return = std::numeric_limits<double>::lowest();
         for(const Action& a : env.actions()) {
@@ -85,8 +95,10 @@ public:
 
 private:
     // Stored as a pointer if assignment operator or move ctr is needed.
-    const ActionValueTable& value_function;
+    const ValueFunction& value_function;
     double e_ = DEFAULT_E;
 };
 
+using QeGreedyPolicy = BasicQeGreedyPolicy<ActionValueTable>;
+
 } // namespace rl
@@ -10,19 +10,27 @@ namespace rl {
 class RandomPolicy : public rl::Policy {
 public:
     const Action& next_action(const Environment& e, const State& from_state) const override {
-        return possible_actions(e, from_state).random_action();
+        ActionDistribution dist;
+        return action_distribution(e, from_state, dist).random_action();
     }
 
     ActionDistribution
     possible_actions(const Environment& e, const State& from_state) const override {
         ActionDistribution dist;
+        action_distribution(e, from_state, dist);
+        return dist;
+    }
+
+    ActionDistributionView action_distribution(const Environment& e, const State& from_state,
+                                               ActionDistribution& scratch) const override {
+        scratch.clear();
         for(const Action& a : e.actions()) {
             if(!e.is_action_allowed(from_state, a)) {
                 continue;
             }
-            dist.add_action(a);
+            scratch.add_action(a);
         }
-        return dist;
+        return scratch.view();
     }
 };
 
@@ -30,8 +30,9 @@ public:
      */
     std::unique_ptr<Policy> improve(const Environment& env, const Policy&) const override {
         // TODO: improvers should be broken into initialize(), step() & finished() call also.
-        ActionValueTable value_function =
-                ActionValueTable(env.state_count(), env.action_count());
+        // Disallowed actions are masked, so that the greedy result never chooses them.
+        ActionValueTable value_function(env);
+        value_function.enable_greedy_cache();
         // How does the following work? no move or copy ctr...
         QeGreedyPolicy policy{QeGreedyPolicy::create_pure_greedy_policy(value_function)};
         policy.set_e(greedy_e);
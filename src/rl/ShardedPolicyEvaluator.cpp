@@ -0,0 +1,345 @@
+#include "ShardedPolicyEvaluator.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#include "rl/impl/PolicyTransitions.h"
+#include "util/alignment.h"
+
+namespace rl {
+
+namespace {
+
+constexpr std::size_t MESSAGE_SIZE = 256;
+// Keeps the workers' slots on separate cache lines.
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+// The byte sent to start a sweep, and sent back when the sweep is done.
+constexpr char SWEEP = 's';
+
+/**
+ * Sends a byte to the other end of the socket.
+ *
+ * \returns false if the other end has been closed.
+ */
+bool send_byte(int socket) {
+    for(;;) {
+        // MSG_NOSIGNAL: a closed other end gives EPIPE instead of killing this process.
+        ssize_t sent = send(socket, &SWEEP, 1, MSG_NOSIGNAL);
+        if(sent == 1) {
+            return true;
+        }
+        if(sent == -1 and errno == EINTR) {
+            continue;
+        }
+        return false;
+    }
+}
+
+/**
+ * Waits for a byte from the other end of the socket.
+ *
+ * \returns false if the other end has been closed, which is how the death of a process is noticed:
+ *          its end is closed by the kernel however it died.
+ */
+bool receive_byte(int socket) {
+    for(;;) {
+        char byte;
+        ssize_t received = recv(socket, &byte, 1, 0);
+        if(received == 1) {
+            return true;
+        }
+        if(received == -1 and errno == EINTR) {
+            continue;
+        }
+        return false;
+    }
+}
+
+std::string describe_exit(int status) {
+    if(WIFSIGNALED(status)) {
+        return "killed by signal " + std::to_string(WTERMSIG(status));
+    }
+    if(WIFEXITED(status)) {
+        return "exited with status " + std::to_string(WEXITSTATUS(status));
+    }
+    return "died";
+}
+
+} // namespace
+
+struct ShardedPolicyEvaluator::SharedHeader {
+    // Which of the two value vectors holds the current values.
+    int read_index;
+    double discount_rate;
+};
+
+struct alignas(CACHE_LINE_SIZE) ShardedPolicyEvaluator::WorkerSlot {
+    double delta;
+    int failed;
+    char message[MESSAGE_SIZE];
+};
+
+ShardedPolicyEvaluator::ShardedPolicyEvaluator(int process_count) :
+        process_count_(process_count) {
+    Expects(process_count > 0);
+}
+
+ShardedPolicyEvaluator::~ShardedPolicyEvaluator() {
+    stop_workers();
+}
+
+int ShardedPolicyEvaluator::default_process_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? static_cast<int>(count) : 1;
+}
+
+int ShardedPolicyEvaluator::process_count() const {
+    return process_count_;
+}
+
+void ShardedPolicyEvaluator::initialize(const Environment& env, const Policy& policy) {
+    // Workers hold copies of the previous env & policy, so they need to be replaced.
+    stop_workers();
+    impl::PolicyEvaluator::initialize(env, policy);
+    state_count_ = env.state_count();
+    value_function_ = ValueTable(state_count_);
+}
+
+void ShardedPolicyEvaluator::step() {
+    const Environment& env = *CHECK_NOTNULL(env_);
+    // The workers are started here rather than in initialize(), so that a broken policy causes
+    // step() to throw, not initialize().
+    if(workers_.empty()) {
+        start_workers();
+    }
+    header_->discount_rate = discount_rate_;
+    for(int worker = 0; worker < process_count_; worker++) {
+        if(!send_byte(sockets_[worker])) {
+            fail_workers(worker);
+        }
+    }
+    // The workers sweep.
+    for(int worker = 0; worker < process_count_; worker++) {
+        if(!receive_byte(sockets_[worker])) {
+            fail_workers(worker);
+        }
+    }
+    double delta = 0;
+    for(int worker = 0; worker < process_count_; worker++) {
+        const WorkerSlot& slot = slots_[worker];
+        if(slot.failed) {
+            throw std::runtime_error("Sharded evaluation worker " + std::to_string(worker) +
+                                     " failed: " + slot.message);
+        }
+        delta = std::max(delta, slot.delta);
+    }
+    header_->read_index = 1 - header_->read_index;
+    const double* values = values_ + header_->read_index * state_count_;
+    for(const State& s : env.states()) {
+        value_function_.set_value(s, values[s.id()]);
+    }
+    most_recent_delta_ = delta;
+    steps_++;
+}
+
+const ValueTable& ShardedPolicyEvaluator::value_function() const {
+    return value_function_;
+}
+
+ID ShardedPolicyEvaluator::shard_begin(int worker) const {
+    return static_cast<ID>(static_cast<long>(worker) * state_count_ / process_count_);
+}
+
+void ShardedPolicyEvaluator::start_workers() {
+    CHECK(workers_.empty());
+    const std::size_t slots_offset = util::round_up(sizeof(SharedHeader), alignof(WorkerSlot));
+    const std::size_t values_offset = util::round_up(
+            slots_offset + process_count_ * sizeof(WorkerSlot), alignof(double));
+    segment_size_ = values_offset + 2 * static_cast<std::size_t>(state_count_) * sizeof(double);
+    // The name is only needed until the segment is mapped; the mapping is inherited by the
+    // workers.
+    static std::atomic<int> segment_counter{0};
+    std::string name = "/rl_sharded_" + std::to_string(getpid()) + "_" +
+                       std::to_string(segment_counter++);
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "shm_open");
+    }
+    shm_unlink(name.c_str());
+    // A new segment is zero filled, so all values start at 0 and no worker has failed.
+    if(ftruncate(fd, static_cast<off_t>(segment_size_)) == -1) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "ftruncate");
+    }
+    segment_ = mmap(nullptr, segment_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if(segment_ == MAP_FAILED) {
+        segment_ = nullptr;
+        throw std::system_error(error, std::generic_category(), "mmap");
+    }
+    auto* bytes = static_cast<char*>(segment_);
+    header_ = reinterpret_cast<SharedHeader*>(bytes);
+    slots_ = reinterpret_cast<WorkerSlot*>(bytes + slots_offset);
+    values_ = reinterpret_cast<double*>(bytes + values_offset);
+    header_->read_index = 0;
+
+    for(int worker = 0; worker < process_count_; worker++) {
+        int pair[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == -1) {
+            int socket_error = errno;
+            kill_workers();
+            throw std::system_error(socket_error, std::generic_category(), "socketpair");
+        }
+        pid_t pid = fork();
+        if(pid == 0) {
+            // Only this worker's end may stay open, so that closing the other end (or the death
+            // of the process holding it) is seen by whichever process is waiting.
+            for(int socket : sockets_) {
+                close(socket);
+            }
+            close(pair[0]);
+            worker_loop(worker, pair[1]);
+        }
+        close(pair[1]);
+        if(pid == -1) {
+            int fork_error = errno;
+            close(pair[0]);
+            kill_workers();
+            throw std::system_error(fork_error, std::generic_category(), "fork");
+        }
+        workers_.push_back(pid);
+        sockets_.push_back(pair[0]);
+    }
+}
+
+void ShardedPolicyEvaluator::stop_workers() {
+    if(!segment_) {
+        return;
+    }
+    // A worker exits when its socket is closed.
+    for(int socket : sockets_) {
+        close(socket);
+    }
+    sockets_.clear();
+    for(pid_t worker : workers_) {
+        waitpid(worker, nullptr, 0);
+    }
+    workers_.clear();
+    release_segment();
+}
+
+void ShardedPolicyEvaluator::kill_workers() {
+    for(pid_t worker : workers_) {
+        kill(worker, SIGKILL);
+    }
+    stop_workers();
+}
+
+void ShardedPolicyEvaluator::fail_workers(int dead_worker) {
+    // Killing an exited worker has no effect, so its exit status is kept.
+    for(pid_t worker : workers_) {
+        kill(worker, SIGKILL);
+    }
+    int status = 0;
+    waitpid(workers_[dead_worker], &status, 0);
+    workers_.erase(workers_.begin() + dead_worker);
+    stop_workers();
+    throw std::runtime_error("Sharded evaluation worker " + std::to_string(dead_worker) + " " +
+                             describe_exit(status) + ".");
+}
+
+void ShardedPolicyEvaluator::release_segment() {
+    munmap(segment_, segment_size_);
+    segment_ = nullptr;
+    header_ = nullptr;
+    slots_ = nullptr;
+    values_ = nullptr;
+}
+
+void ShardedPolicyEvaluator::worker_loop(int worker, int socket) {
+    const Environment& env = *CHECK_NOTNULL(env_);
+    const Policy& policy = *CHECK_NOTNULL(policy_);
+    const ID begin = shard_begin(worker);
+    const ID end = shard_begin(worker + 1);
+    WorkerSlot& slot = slots_[worker];
+    // This shard's rows of the policy's transition matrix, in compressed sparse row form.
+    bool built = false;
+    std::vector<long> row_begin;
+    std::vector<ID> next_states;
+    std::vector<double> probabilities;
+    std::vector<double> expected_rewards;
+    std::vector<char> is_end_state;
+    std::vector<std::pair<ID, double>> row;
+    for(;;) {
+        if(!receive_byte(socket)) {
+            // Stopped, or the coordinating process died. Skip the parent's atexit handlers and
+            // stream flushing.
+            _exit(0);
+        }
+        try {
+            if(!built) {
+                row_begin.assign(1, 0);
+                for(ID id = begin; id < end; id++) {
+                    const State& s = env.state(id);
+                    row.clear();
+                    double expected_reward = 0;
+                    is_end_state.push_back(env.is_end_state(s));
+                    if(!is_end_state.back()) {
+                        expected_reward = impl::policy_transitions(env, policy, s, row);
+                    }
+                    for(const auto& transition : row) {
+                        next_states.push_back(transition.first);
+                        probabilities.push_back(transition.second);
+                    }
+                    row_begin.push_back(static_cast<long>(next_states.size()));
+                    expected_rewards.push_back(expected_reward);
+                }
+                built = true;
+            }
+            const double discount_rate = header_->discount_rate;
+            const double* read = values_ + header_->read_index * state_count_;
+            double* write = values_ + (1 - header_->read_index) * state_count_;
+            double delta = 0;
+            for(ID id = begin; id < end; id++) {
+                const ID row_id = id - begin;
+                if(is_end_state[row_id]) {
+                    write[id] = 0;
+                    continue;
+                }
+                double value = expected_rewards[row_id];
+                for(long i = row_begin[row_id]; i < row_begin[row_id + 1]; i++) {
+                    value += discount_rate * probabilities[i] * read[next_states[i]];
+                }
+                delta = std::max(delta, std::abs(value - read[id]));
+                write[id] = value;
+            }
+            slot.delta = delta;
+        } catch(const std::exception& e) {
+            slot.failed = 1;
+            std::strncpy(slot.message, e.what(), MESSAGE_SIZE - 1);
+        } catch(...) {
+            slot.failed = 1;
+            std::strncpy(slot.message, "unknown exception", MESSAGE_SIZE - 1);
+        }
+        if(!send_byte(socket)) {
+            _exit(0);
+        }
+    }
+}
+
+} // namespace rl
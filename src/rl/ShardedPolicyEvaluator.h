@@ -0,0 +1,85 @@
+#pragma once
+
+#include <sys/types.h>
+#include <vector>
+
+#include "rl/Policy.h"
+#include "rl/impl/PolicyEvaluator.h"
+
+namespace rl {
+
+/**
+ * Jacobi policy evaluation with the states sharded across worker processes.
+ *
+ * On the first step after initialize(), a POSIX shared memory segment is created holding:
+ *     * a slot per worker for its delta and any error,
+ *     * two copies of the value vector (the values being read, and the values being written).
+ * Then process_count workers are forked, each connected to the coordinating process by a socket
+ * pair. Worker i owns the states with IDs in [i * N / process_count, (i + 1) * N / process_count)
+ * and builds the policy's transitions for just those states, so the transitions are never all
+ * held by a single process. Workers inherit the environment and policy from the forking process,
+ * so they are expected not to change between initialize() and the end of the evaluation.
+ *
+ * Each step, every worker writes new values for its states, reading the previous values of all
+ * states (including other shards' states) directly from the shared segment. The coordinating
+ * process then takes the max of the workers' deltas and swaps the read/write value vectors.
+ *
+ * A sweep is started by sending a byte to each worker, and each worker sends a byte back when it
+ * is done. A worker that dies (a failed CHECK, abort() or a signal) has its socket closed by the
+ * kernel, so the coordinating process sees the end of the stream rather than waiting forever;
+ * the remaining workers are then killed and step() throws a std::runtime_error. Likewise, workers
+ * exit if the coordinating process dies.
+ *
+ * The workers stay alive between steps and are stopped by initialize() and the destructor. An
+ * exception thrown by a worker (for example, due to a broken policy) is rethrown from step() as a
+ * std::runtime_error.
+ *
+ * Linux only: fork(), shm_open() and Unix domain socket pairs are used.
+ */
+class ShardedPolicyEvaluator : public StateBasedEvaluator,
+                               public impl::PolicyEvaluator {
+public:
+    explicit ShardedPolicyEvaluator(int process_count=default_process_count());
+    ShardedPolicyEvaluator(const ShardedPolicyEvaluator&) = delete;
+    ShardedPolicyEvaluator& operator=(const ShardedPolicyEvaluator&) = delete;
+    ~ShardedPolicyEvaluator() override;
+
+    void initialize(const Environment& env, const Policy& policy) override;
+    void step() override;
+    const ValueTable& value_function() const override;
+
+    int process_count() const;
+
+    /**
+     * \returns the number of online processors.
+     */
+    static int default_process_count();
+
+private:
+    struct SharedHeader;
+    struct WorkerSlot;
+
+    void start_workers();
+    void stop_workers();
+    void kill_workers();
+    [[noreturn]] void fail_workers(int dead_worker);
+    void release_segment();
+    [[noreturn]] void worker_loop(int worker, int socket);
+    ID shard_begin(int worker) const;
+
+private:
+    int process_count_;
+    ID state_count_ = 0;
+    ValueTable value_function_;
+    std::vector<pid_t> workers_{};
+    // This process's end of each worker's socket pair.
+    std::vector<int> sockets_{};
+    void* segment_ = nullptr;
+    std::size_t segment_size_ = 0;
+    // Views into segment_.
+    SharedHeader* header_ = nullptr;
+    WorkerSlot* slots_ = nullptr;
+    double* values_ = nullptr;
+};
+
+} // namespace rl
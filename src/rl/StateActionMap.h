@@ -2,6 +2,8 @@
 
 #include "rl/Environment.h"
 #include <glog/logging.h>
+#include <algorithm>
+#include <vector>
 
 namespace rl {
 
@@ -84,4 +86,113 @@ private:
     std::vector<T> data_;
 };
 
+/**
+ * A map from the allowed (state, action) pairs of an environment to T.
+ *
+ * Unlike StateActionMap, only the live pairs are stored: the pairs from non-end states with an
+ * allowed action. The entries are held in compressed sparse row form: the entries of state s are
+ * [row_begin[s], row_begin[s + 1]), one per allowed action in increasing action ID order. Thus,
+ * reductions over data() (e.g. min/max) only cover live pairs.
+ *
+ * Accessing a pair that isn't live is an error.
+ */
+template<class T>
+class CompactStateActionMap {
+public:
+    using SizeType = long;
+    using Container = std::vector<T>;
+    // Returned by index() for pairs that are not live.
+    static constexpr SizeType NO_INDEX = -1;
+
+public:
+    CompactStateActionMap() = default;
+
+    explicit CompactStateActionMap(const Environment& env, const T& default_val=T{}) :
+            action_count_(env.action_count())
+    {
+        row_begin_.reserve(static_cast<std::size_t>(env.state_count()) + 1);
+        row_begin_.push_back(0);
+        for(const State& s : env.states()) {
+            if(!env.is_end_state(s)) {
+                for(const Action& a : env.actions()) {
+                    if(env.is_action_allowed(s, a)) {
+                        action_ids_.push_back(a.id());
+                    }
+                }
+            }
+            row_begin_.push_back(static_cast<SizeType>(action_ids_.size()));
+        }
+        data_.assign(action_ids_.size(), default_val);
+    }
+
+    const T& data(const State& s, const Action& a) const {
+        SizeType i = index(s, a);
+        CHECK_NE(i, NO_INDEX) << "The (state, action) pair is not live.";
+        return data_[static_cast<std::size_t>(i)];
+    }
+
+    T& data(const State& s, const Action& a) {
+        return const_cast<T&>(static_cast<const CompactStateActionMap*>(this)->data(s, a));
+    }
+
+    // Note: the data is copied.
+    void set(const State& s, const Action& a, T data) {
+        this->data(s, a) = data;
+    }
+
+    /**
+     * \returns the position of the pair in data(), or NO_INDEX if the pair isn't live.
+     */
+    SizeType index(const State& s, const Action& a) const {
+        CHECK_GT(static_cast<SizeType>(row_begin_.size()) - 1, s.id());
+        SizeType begin = row_begin_[s.id()];
+        SizeType end = row_begin_[s.id() + 1];
+        // The common case: every action is allowed.
+        if(end - begin == action_count_) {
+            return begin + a.id();
+        }
+        auto first = std::begin(action_ids_) + begin;
+        auto last = std::begin(action_ids_) + end;
+        auto it = std::lower_bound(first, last, a.id());
+        if(it == last or *it != a.id()) {
+            return NO_INDEX;
+        }
+        return static_cast<SizeType>(it - std::begin(action_ids_));
+    }
+
+    // Access by the index() of a pair.
+    const T& operator[](SizeType index) const {
+        DCHECK(index >= 0 and index < size());
+        return data_[static_cast<std::size_t>(index)];
+    }
+
+    T& operator[](SizeType index) {
+        DCHECK(index >= 0 and index < size());
+        return data_[static_cast<std::size_t>(index)];
+    }
+
+    /**
+     * \returns the number of live pairs.
+     */
+    SizeType size() const {
+        return static_cast<SizeType>(data_.size());
+    }
+
+    bool empty() const {
+        return data_.empty();
+    }
+
+    // The entries for all live pairs.
+    const Container& data() const {
+        return data_;
+    }
+
+private:
+    ID action_count_ = 0;
+    std::vector<SizeType> row_begin_{};
+    // The action ID of each entry.
+    std::vector<ID> action_ids_{};
+    std::vector<T> data_{};
+};
+
 } // namespace rl
@@ -2,6 +2,7 @@
 
 #include "rl/Policy.h"
 #include "DeterministicPolicy.h"
+#include "FixedActionValueTable.h"
 
 namespace rl {
 
@@ -11,11 +12,9 @@ public:
     StochasticPolicy(ID state_count) : state_to_action_dist_(state_count)
     {}
 
-    // Our need for this method resulted in a refactor of ActionDistribution that saw the class get
-    // a DistributionList member. We created the DistributionList because we couldn't use
-    // DistributionTree- the latter is not copyable, and we want a copyable ActionDistribution.
     const Action& next_action(const Environment &e, const State &from_state) const override {
-        return possible_actions(e, from_state).random_action();
+        CHECK_GT(state_to_action_dist_.size(), static_cast<std::size_t>(from_state.id()));
+        return state_to_action_dist_[from_state.id()].random_action();
     }
 
     ActionDistribution
@@ -25,6 +24,12 @@ public:
         return dist;
     }
 
+    ActionDistributionView action_distribution(const Environment& e, const State& from_state,
+                                               ActionDistribution& scratch) const override {
+        CHECK_GT(state_to_action_dist_.size(), static_cast<std::size_t>(from_state.id()));
+        return state_to_action_dist_[from_state.id()].view();
+    }
+
     void add_action_for_state(const State& s, const Action& a, Weight weight) {
         CHECK_GT(state_to_action_dist_.size(), static_cast<std::size_t>(s.id()));
         ActionDistribution& action_dist = state_to_action_dist_.at(s.id());
@@ -68,15 +73,15 @@ public:
                 continue;
             }
             // As the ActionDistribution is returned by value, the full statement
-            // other.possible_actions(env, s).weight_map() cannot be placed in the for loop, as
+            // other.possible_actions(env, s).entries() cannot be placed in the for loop, as
             // ActionDistribution object is destroyed before the loop can begin. This is an easy
             // language trap to fall into. There are suggestions to extend the lifetime of
             // temporaries in such for loop expressions:
             //     http://open-std.org/JTC1/SC22/WG21/docs/cwg_closed.html#900
             ActionDistribution dist = other.possible_actions(env, s);
-            for(auto const& entry : dist.weight_map()) {
-                const Action& a = *CHECK_NOTNULL(entry.first);
-                Weight weight = entry.second;
+            for(const ActionWeight& entry : dist.entries()) {
+                const Action& a = *CHECK_NOTNULL(entry.action);
+                Weight weight = entry.weight;
                 out.add_action_for_state(s, a, weight);
             }
         }
@@ -88,6 +93,19 @@ public:
      */
     static StochasticPolicy create_from(const Environment& env,
                                         const ActionValueTable& value_function) {
+        return create_greedy_from(env, value_function);
+    }
+
+    template<ID ACTION_COUNT>
+    static StochasticPolicy create_from(const Environment& env,
+                                        const FixedActionValueTable<ACTION_COUNT>& value_function) {
+        return create_greedy_from(env, value_function);
+    }
+
+private:
+    template<typename ValueFunction>
+    static StochasticPolicy create_greedy_from(const Environment& env,
+                                               const ValueFunction& value_function) {
         // as I'm curious if it will ever become an issue.
         StochasticPolicy out(env.state_count());
         for(const State& s : env.states()) {
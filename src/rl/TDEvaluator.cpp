@@ -12,57 +12,98 @@ bool TDEvaluator::finished() const {
     return most_recent_delta_ < delta_threshold_ and min_visit > MIN_VISIT;
 }
 
+void TDEvaluator::set_pair_retirement(bool enabled, int reverify_interval) {
+    exploring_starts_.set_retirement(enabled, reverify_interval);
+}
+
+long TDEvaluator::retired_pair_count() const {
+    return exploring_starts_.retired_count();
+}
+
+void TDEvaluator::set_trial_limits(const TrialLimits& limits) {
+    trial_limits_ = limits;
+}
+
+const TrialLimits& TDEvaluator::trial_limits() const {
+    return trial_limits_;
+}
+
+long TDEvaluator::truncated_trial_count() const {
+    return truncated_trial_count_;
+}
+
 void TDEvaluator::initialize(const Environment& env, const Policy& policy) {
     impl::PolicyEvaluator::initialize(env, policy);
+    truncated_trial_count_ = 0;
+    exploring_starts_.reset(env);
     // note: these assignments might be switched to heap construction eventually.
     value_function_ = ActionValueTable(env.state_count(), env.action_count());
-    deltas = StateActionMap<double>(env);
+    // Only the live (state, action) pairs are stored, so end states and disallowed actions are not
+    // considered when calculating the max delta and min visit.
+    deltas = CompactStateActionMap<double>(env);
     long initial_count = 0;
-    // End states wont be visited and they should not be considered when calculating the min visit.
-    long end_state_initial_count = std::numeric_limits<long>::max();
-    visit_counts = StateActionMap<long>(env, initial_count, end_state_initial_count);
+    visit_counts = CompactStateActionMap<long>(env, initial_count);
+    CHECK(!visit_counts.empty()) << "The environment has no allowed (state, action) pairs.";
+    visit_counter_.reset(visit_counts.size());
+    delta_tracker_.reset(visit_counts.size());
 }
 
 void TDEvaluator::step() {
     const Environment& env = *CHECK_NOTNULL(env_);
-    for (const State& start_state : env.states()) {
-        if (env.is_end_state(start_state)) {
-            continue;
+    for (long index : exploring_starts_.begin_step()) {
+        const std::pair<ID, ID>& start = exploring_starts_.pair(index);
+        TrialEnd end = run_trial(env, *CHECK_NOTNULL(policy_), trace_, &env.state(start.first),
+                                 &env.action(start.second), trial_limits_);
+        std::size_t transition_count = trace_.size() - 1;
+        if(end != TrialEnd::END_STATE) {
+            truncated_trial_count_++;
         }
-        for (const Action& start_action : env.actions()) {
-            if (!env.is_action_allowed(start_state, start_action)) {
-                continue;
-            }
-            Trace trace = run_trial(env, *CHECK_NOTNULL(policy_), &start_state, &start_action);
-            update_value_fctn(trace);
+        // With a max_length, the last reward of a cycle includes the rewards up to the horizon.
+        if(end == TrialEnd::CYCLE and trial_limits_.max_length != TrialLimits::NO_MAX_LENGTH) {
+            transition_count--;
         }
+        update_value_fctn(trace_, transition_count);
     }
-    most_recent_delta_ = *std::max_element(std::begin(deltas.data()), std::end(deltas.data()));
-    min_visit = *std::min_element(std::begin(visit_counts.data()), std::end(visit_counts.data()));
+    exploring_starts_.end_step([this](long index) { return is_pair_converged(index); });
+    // Unvisited pairs have a zero delta, and retired pairs keep the delta that met the threshold.
+    most_recent_delta_ = delta_tracker_.max();
+    min_visit = visit_counter_.min();
     steps_++;
 }
 
-void TDEvaluator::update_value_fctn(const Trace& trace) {
-    const TimeStep* p_prev_ts = &trace.back();
-    for (auto it = std::next(std::crbegin(trace)); it != std::crend(trace); ++it) {
-        const TimeStep prev_ts = *CHECK_NOTNULL(p_prev_ts);
-        const TimeStep& ts = *it;
-        const Action& action = *CHECK_NOTNULL(ts.action);
+bool TDEvaluator::is_pair_converged(long index) const {
+    return deltas[index] < delta_threshold_ and visit_counts[index] > MIN_VISIT;
+}
+
+void TDEvaluator::update_value_fctn(const TraceBuffer& trace, std::size_t transition_count) {
+    const Environment& env = *CHECK_NOTNULL(env_);
+    CHECK_LT(transition_count, trace.size());
+    // Iterate backwards, starting from the step before the last state used (the end state for a
+    // complete trial). The step after step i is i + 1.
+    for (std::size_t i = transition_count; i-- > 0;) {
+        const State& state = env.state(trace.state_id(i));
+        const Action& action = env.action(trace.action_id(i));
+        const State& next_state = env.state(trace.state_id(i + 1));
+        const double next_reward = trace.reward(i + 1);
         // Update value function.
-        double current_val = value_function_.value(ts.state, action);
+        double current_val = value_function_.value(state, action);
         // This line below distinguishes TD from MC. The next state's state value is being used
         // (like Expected Sarsa) instead of the subsequent state-action pair's state action value.
-        double state_val = calculate_state_value(*CHECK_NOTNULL(env_), value_function_,
-                                                 prev_ts.state, *CHECK_NOTNULL(policy_));
-        double td_error = prev_ts.reward + state_val - value_function_.value(ts.state, action);
-        long n = ++visit_counts.data(ts.state, action);
+        double state_val = calculate_state_value(env, value_function_,
+                                                 next_state, *CHECK_NOTNULL(policy_));
+        double td_error = next_reward + state_val - value_function_.value(state, action);
+        long key = visit_counts.index(state, action);
+        CHECK(key != CompactStateActionMap<long>::NO_INDEX)
+                << "The (state, action) pair is not live.";
+        long n = ++visit_counts[key];
         CHECK_GT(n, 0);
+        visit_counter_.add_visits(n - 1, n);
         // Is it wrong or lacking meaning to use n here given that we are bootstrapping?
         double updated_val = current_val +  1.0/n * td_error;
         // Update data.
-        value_function_.set_value(ts.state, action, updated_val);
-        deltas.set(ts.state, action, std::abs(updated_val - current_val));
-        p_prev_ts = &ts;
+        value_function_.set_value(state, action, updated_val);
+        deltas[key] = std::abs(updated_val - current_val);
+        delta_tracker_.set(key, deltas[key]);
     }
 }
 
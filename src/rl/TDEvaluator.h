@@ -1,5 +1,7 @@
 #pragma once
 
+#include "impl/ConvergenceStats.h"
+#include "impl/ExploringStarts.h"
 #include "impl/PolicyEvaluator.h"
 #include "Trial.h"
 #include "StateActionMap.h"
@@ -25,14 +27,44 @@ public:
     const ActionValueTable& value_function() const override;
     bool finished() const override;
 
+    /**
+     * Enables skipping the (state, action) pairs whose own delta is below the delta threshold
+     * and whose visit count is above MIN_VISIT, as for FirstVisitMCActionValuePredictor.
+     */
+    void set_pair_retirement(
+            bool enabled, int reverify_interval=impl::ExploringStarts::DEFAULT_REVERIFY_INTERVAL);
+    long retired_pair_count() const;
+
+    /**
+     * Bounds the trials (no bounds by default). The last step of a trial that is cut short
+     * bootstraps from the value of the state it reached, as for any other step, and so does the
+     * last step of a trial that entered a cycle. Unlike the Monte Carlo evaluators, cycle
+     * detection doesn't need a max_length, as the rest of a cycle is bootstrapped from the earlier
+     * visit. With a max_length, though, the last reward of a cycle has the cycle's rewards up to
+     * the horizon folded in, so that step is dropped. The truncated trials are counted by
+     * truncated_trial_count().
+     */
+    void set_trial_limits(const TrialLimits& limits);
+    const TrialLimits& trial_limits() const;
+    long truncated_trial_count() const;
+
 private:
-    void update_value_fctn(const Trace& trace);
+    void update_value_fctn(const TraceBuffer& trace, std::size_t transition_count);
+    bool is_pair_converged(long index) const;
 
 private:
     ActionValueTable value_function_;
-    StateActionMap<double> deltas;
-    StateActionMap<long> visit_counts;
+    // Reused by every trial.
+    TraceBuffer trace_{};
+    CompactStateActionMap<double> deltas;
+    CompactStateActionMap<long> visit_counts;
     long min_visit = 0;
+    impl::ExploringStarts exploring_starts_{};
+    impl::MinVisitCounter visit_counter_{};
+    // Keyed by the CompactStateActionMap index.
+    impl::MaxDeltaTracker delta_tracker_{};
+    TrialLimits trial_limits_{};
+    long truncated_trial_count_ = 0;
 };
 
 } // namespace rl
@@ -2,7 +2,11 @@
 
 #include "rl/Environment.h"
 #include "rl/Policy.h"
+#include "util/FlatIdMap.h"
 #include "glog/logging.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
 
 namespace rl {
 
@@ -20,6 +24,260 @@ struct TimeStep {
 };
 using Trace = std::vector<TimeStep>;
 
+/**
+ * A trace held as columns (struct of arrays): for each time step, the state ID, the action ID
+ * (NO_ACTION for the final end state) and the reward obtained on entering the state.
+ *
+ * The buffer is owned by the caller and reused across trials: clear() keeps the columns' capacity,
+ * so once the buffer has grown to the longest trial, filling it doesn't allocate.
+ */
+class TraceBuffer {
+public:
+    static constexpr ID NO_ACTION = -1;
+
+public:
+    void clear() {
+        state_ids_.clear();
+        action_ids_.clear();
+        rewards_.clear();
+    }
+
+    void push_back(ID state_id, ID action_id, double reward) {
+        state_ids_.push_back(state_id);
+        action_ids_.push_back(action_id);
+        rewards_.push_back(reward);
+    }
+
+    std::size_t size() const {
+        return state_ids_.size();
+    }
+
+    bool empty() const {
+        return state_ids_.empty();
+    }
+
+    ID state_id(std::size_t i) const {
+        return state_ids_[i];
+    }
+
+    ID action_id(std::size_t i) const {
+        return action_ids_[i];
+    }
+
+    double reward(std::size_t i) const {
+        return rewards_[i];
+    }
+
+    const std::vector<ID>& state_ids() const {
+        return state_ids_;
+    }
+
+    const std::vector<ID>& action_ids() const {
+        return action_ids_;
+    }
+
+    const std::vector<double>& rewards() const {
+        return rewards_;
+    }
+
+private:
+    std::vector<ID> state_ids_{};
+    std::vector<ID> action_ids_{};
+    std::vector<double> rewards_{};
+};
+
+/**
+ * The time step of the first occurrence of each key (a state ID or a state-action pair index) in
+ * a trace, for first-visit Monte Carlo.
+ *
+ * In dense mode, the steps are held in an array indexed by key. Each entry is stamped with the
+ * trace (epoch) that wrote it, so that starting a new trace is a counter increment rather than a
+ * clear. In sparse mode, a FlatIdMap is used instead, so that memory use scales with the trace
+ * length rather than the key count.
+ *
+ * The index is reused across traces: neither mode allocates once it has grown to the longest
+ * trace.
+ */
+class FirstVisitIndex {
+public:
+    static constexpr int NOT_VISITED = -1;
+
+public:
+    /**
+     * Switches to dense mode, for keys in [0, key_count).
+     */
+    void reset(std::size_t key_count) {
+        sparse_ = false;
+        entries_.assign(key_count, Entry{0, NOT_VISITED});
+        epoch_ = 1;
+        sparse_steps_.clear();
+    }
+
+    /**
+     * Switches to sparse mode.
+     */
+    void reset_sparse() {
+        sparse_ = true;
+        entries_.clear();
+        entries_.shrink_to_fit();
+        sparse_steps_.clear();
+    }
+
+    /**
+     * Forgets the visits of the previous trace.
+     */
+    void next_trace() {
+        if(sparse_) {
+            sparse_steps_.clear();
+            return;
+        }
+        if(++epoch_ == 0) {
+            // The stamps have wrapped around: entries from 2^32 traces ago would look current.
+            std::fill(entries_.begin(), entries_.end(), Entry{0, NOT_VISITED});
+            epoch_ = 1;
+        }
+    }
+
+    /**
+     * Records a visit to \c key at time step \c step, if it's the key's first in this trace.
+     */
+    void visit(long key, int step) {
+        if(sparse_) {
+            int& first = sparse_steps_[key];
+            if(first == NOT_VISITED) {
+                first = step;
+            }
+            return;
+        }
+        DCHECK_LT(static_cast<std::size_t>(key), entries_.size());
+        Entry& entry = entries_[static_cast<std::size_t>(key)];
+        if(entry.epoch != epoch_) {
+            entry = Entry{epoch_, step};
+        }
+    }
+
+    /**
+     * \returns the first step at which \c key was visited in this trace, or NOT_VISITED.
+     */
+    int first_step(long key) const {
+        if(sparse_) {
+            return sparse_steps_.get(key);
+        }
+        DCHECK_LT(static_cast<std::size_t>(key), entries_.size());
+        const Entry& entry = entries_[static_cast<std::size_t>(key)];
+        return entry.epoch == epoch_ ? entry.step : NOT_VISITED;
+    }
+
+private:
+    struct Entry {
+        std::uint32_t epoch;
+        int step;
+    };
+
+private:
+    bool sparse_ = false;
+    std::vector<Entry> entries_{};
+    // Never 0, which is the stamp of entries that have not been visited.
+    std::uint32_t epoch_ = 1;
+    util::FlatIdMap<int> sparse_steps_{NOT_VISITED};
+};
+
+/**
+ * How a trial ended.
+ *
+ * END_STATE: an end state was reached.
+ * STOPPED: the record function stopped the trial.
+ * MAX_LENGTH: the trial was cut short after TrialLimits::max_length actions.
+ * CYCLE: the trial entered a cycle that it can never leave (see TrialLimits::detect_cycles).
+ */
+enum class TrialEnd {END_STATE, STOPPED, MAX_LENGTH, CYCLE};
+
+/**
+ * Bounds on a trial, so that a policy that never reaches an end state costs bounded time and
+ * memory. A trial that is cut short is recorded with the state it reached in place of an end state
+ * (with a null action), so its returns are returns truncated at the horizon.
+ *
+ * max_length: the most actions a trial takes, counting from its start. NO_MAX_LENGTH (the default)
+ *     for no limit.
+ * detect_cycles: for a deterministic environment (Environment::is_deterministic()), stop the trial
+ *     once it returns to a state without any stochastic choice of action since its last visit, as
+ *     it would then loop forever. With a max_length, the cycle's rewards up to max_length actions
+ *     are added to the last reward, so the returns are those of the trial run to max_length.
+ */
+struct TrialLimits {
+    static constexpr long NO_MAX_LENGTH = 0;
+
+    long max_length = NO_MAX_LENGTH;
+    bool detect_cycles = false;
+};
+
+/**
+ * The states visited by a trial since its last stochastic choice of action, as a bitset, for
+ * TrialLimits::detect_cycles. It is reused across trials: only the set words are cleared.
+ */
+class CycleDetector {
+public:
+    void begin_trial(std::size_t state_count) {
+        std::size_t word_count = (state_count + 63) / 64;
+        if(bits_.size() != word_count) {
+            bits_.assign(word_count, 0);
+            marked_words_.clear();
+            return;
+        }
+        forget();
+    }
+
+    /**
+     * Forgets the visited states, as a stochastic choice was made.
+     */
+    void forget() {
+        for(std::size_t word : marked_words_) {
+            bits_[word] = 0;
+        }
+        marked_words_.clear();
+    }
+
+    /**
+     * Marks a state as visited.
+     *
+     * \returns true if the state was already marked.
+     */
+    bool visit(ID state_id) {
+        auto word = static_cast<std::size_t>(state_id) / 64;
+        std::uint64_t bit = std::uint64_t{1} << (static_cast<std::size_t>(state_id) % 64);
+        DCHECK_LT(word, bits_.size());
+        if(bits_[word] & bit) {
+            return true;
+        }
+        if(!bits_[word]) {
+            marked_words_.push_back(word);
+        }
+        bits_[word] |= bit;
+        return false;
+    }
+
+    /**
+     * Reused to hold a policy's action distribution.
+     */
+    Policy::ActionDistribution& action_distribution() {
+        return action_distribution_;
+    }
+
+    /**
+     * Reused to hold the rewards of one pass around a cycle.
+     */
+    std::vector<double>& cycle_rewards() {
+        return cycle_rewards_;
+    }
+
+private:
+    std::vector<std::uint64_t> bits_{};
+    // The words of bits_ that are non-zero.
+    std::vector<std::size_t> marked_words_{};
+    Policy::ActionDistribution action_distribution_{};
+    std::vector<double> cycle_rewards_{};
+};
+
 class Trial {
 public:
     explicit Trial(const Environment& env) :
@@ -38,9 +296,17 @@ public:
         Response response = env().next_state(current_state(), a);
         accumulated_reward_ += response.reward.value();
         current_state_ = &(response.next_state);
+        step_count_++;
         return response;
     }
 
+    /**
+     * \returns the number of actions executed.
+     */
+    long step_count() const {
+        return step_count_;
+    }
+
     const State& current_state() const {
         return *CHECK_NOTNULL(current_state_);
     }
@@ -64,37 +330,168 @@ private:
     const Environment* env_;
     const State* current_state_ = nullptr;
     double accumulated_reward_ = 0;
+    long step_count_ = 0;
 };
 
-// TODO: move to .cc
-inline Trace run_trial(
-        const Environment& env,
-        const Policy&      policy,
-        const State*       custom_start_state=nullptr,
-        const Action*      custom_start_action=nullptr) {
+namespace impl {
+
+/**
+ * The calling thread's CycleDetector, for record_trial_while().
+ */
+inline CycleDetector& cycle_detector() {
+    thread_local CycleDetector detector;
+    return detector;
+}
+
+/**
+ * \returns the sum of the rewards of the next \c action_count actions of a trial that is in a
+ * cycle: \c action is taken in \c state, and the cycle is followed back to \c state.
+ */
+inline double cycle_rewards(const rl::Environment& env, const Policy& policy, const State& state,
+                            const Action& action, long action_count, CycleDetector& detector) {
+    std::vector<double>& rewards = detector.cycle_rewards();
+    rewards.clear();
+    Trial replay(env, state);
+    const Action* next_action = &action;
+    double cycle_sum = 0;
+    // The cycle can't be longer than the state count.
+    for(ID i = 0; i < env.state_count(); i++) {
+        double reward = replay.execute_action(*next_action).reward.value();
+        rewards.push_back(reward);
+        cycle_sum += reward;
+        if(replay.current_state().id() == state.id()) {
+            break;
+        }
+        CHECK(!replay.is_finished()) << "A cycle reached an end state.";
+        next_action = &policy.action_distribution(env, replay.current_state(),
+                                                  detector.action_distribution()).any();
+    }
+    CHECK_EQ(replay.current_state().id(), state.id())
+            << "The cycle didn't return to " << state.name();
+    auto length = static_cast<long>(rewards.size());
+    double sum = static_cast<double>(action_count / length) * cycle_sum;
+    for(long i = 0; i < action_count % length; i++) {
+        sum += rewards[static_cast<std::size_t>(i)];
+    }
+    return sum;
+}
+
+/**
+ * Runs a trial and calls record(state, action, reward) for each time step, the last being the
+ * end state with a null action. If record() returns false, the trial stops before the action is
+ * executed.
+ *
+ * If the trial reaches one of the \c limits, the last time step is the state the trial reached
+ * (see TrialLimits).
+ */
+template<typename RecordFctn>
+// Environment is qualified, as impl::Environment would be found otherwise.
+TrialEnd record_trial_while(const rl::Environment& env, const Policy& policy,
+                            const State* custom_start_state, const Action* custom_start_action,
+                            RecordFctn record, const TrialLimits& limits=TrialLimits{}) {
     const State& start_state = custom_start_state ? *custom_start_state : env.start_state();
     const Action& start_action =
             custom_start_action ? *custom_start_action : policy.next_action(env, start_state);
-    Trace trace;
     Trial trial(env, start_state);
+    CycleDetector* detector = nullptr;
+    if(limits.detect_cycles and env.is_deterministic()) {
+        detector = &cycle_detector();
+        detector->begin_trial(static_cast<std::size_t>(env.state_count()));
+    }
     // Run the first loop with the start state and start action.
     // This is duplication, but is required to insure we don't call policy.next_action() while in an
     // end state. For this, execute_action() must be after policy.next_action() in the loop.
     // TODO: clarify the API behaviour of policy.next_action(). Is it valid to call it when
     //       from_state is an end state?
     double reward = 0;
-    trace.emplace_back(TimeStep{trial.current_state(), &start_action, reward});
+    if(!record(trial.current_state(), &start_action, reward)) {
+        return TrialEnd::STOPPED;
+    }
     Response first_response = trial.execute_action(start_action);
     reward = first_response.reward.value();
     while(!trial.is_finished()) {
-        const Action& action = policy.next_action(env, trial.current_state());
-        trace.emplace_back(TimeStep{trial.current_state(), &action, reward});
+        const State& state = trial.current_state();
+        if(limits.max_length != TrialLimits::NO_MAX_LENGTH
+           and trial.step_count() >= limits.max_length) {
+            record(state, nullptr, reward);
+            return TrialEnd::MAX_LENGTH;
+        }
+        const Action& action = policy.next_action(env, state);
+        if(detector) {
+            // The start state isn't marked, as its action wasn't chosen by the policy.
+            if(policy.action_distribution(env, state, detector->action_distribution())
+                       .action_count() != 1) {
+                detector->forget();
+            } else if(detector->visit(state.id())) {
+                if(limits.max_length != TrialLimits::NO_MAX_LENGTH) {
+                    reward += cycle_rewards(env, policy, state, action,
+                                            limits.max_length - trial.step_count(), *detector);
+                }
+                record(state, nullptr, reward);
+                return TrialEnd::CYCLE;
+            }
+        }
+        if(!record(state, &action, reward)) {
+            return TrialEnd::STOPPED;
+        }
         Response response = trial.execute_action(action);
         reward = response.reward.value();
     }
     // Place the end state in the trace.
-    trace.emplace_back(TimeStep{trial.current_state(), nullptr, reward});
+    record(trial.current_state(), nullptr, reward);
+    return TrialEnd::END_STATE;
+}
+
+/**
+ * As record_trial_while(), for a record(state, action, reward) that never stops the trial.
+ */
+template<typename RecordFctn>
+TrialEnd record_trial(const rl::Environment& env, const Policy& policy,
+                      const State* custom_start_state, const Action* custom_start_action,
+                      RecordFctn record, const TrialLimits& limits=TrialLimits{}) {
+    return record_trial_while(env, policy, custom_start_state, custom_start_action,
+                              [&record](const State& state, const Action* action, double reward) {
+                                  record(state, action, reward);
+                                  return true;
+                              }, limits);
+}
+
+} // namespace impl
+
+// TODO: move to .cc
+inline Trace run_trial(
+        const Environment& env,
+        const Policy&      policy,
+        const State*       custom_start_state=nullptr,
+        const Action*      custom_start_action=nullptr) {
+    Trace trace;
+    impl::record_trial(env, policy, custom_start_state, custom_start_action,
+                       [&trace](const State& state, const Action* action, double reward) {
+                           trace.emplace_back(TimeStep{state, action, reward});
+                       });
     return trace;
 }
 
+/**
+ * As above, but the trace is written to \c buffer (which is cleared first) rather than returned,
+ * and the trial is bounded by \c limits.
+ *
+ * \returns how the trial ended. Unless it's TrialEnd::END_STATE, the last time step isn't an end
+ *          state.
+ */
+inline TrialEnd run_trial(
+        const Environment& env,
+        const Policy&      policy,
+        TraceBuffer&       buffer,
+        const State*       custom_start_state=nullptr,
+        const Action*      custom_start_action=nullptr,
+        const TrialLimits& limits=TrialLimits{}) {
+    buffer.clear();
+    return impl::record_trial(env, policy, custom_start_state, custom_start_action,
+                              [&buffer](const State& state, const Action* action, double reward) {
+                                  ID action_id = action ? action->id() : TraceBuffer::NO_ACTION;
+                                  buffer.push_back(state.id(), action_id, reward);
+                              }, limits);
+}
+
 } // namespace
@@ -2,7 +2,9 @@
 
 #include <vector>
 
-#include "rl/MappedEnvironment.h"
+#include "rl/Environment.h"
+#include "rl/impl/TableStorage.h"
+#include "util/FlatIdMap.h"
 
 namespace rl {
 
@@ -14,6 +16,10 @@ namespace rl {
 
 /**
  * Represents a state-value function.
+ *
+ * The values are held on the heap, or in a memory mapped file for tables created by open_mapped().
+ * A sparse table (create_sparse()) instead holds only the values that have been set, in a hash
+ * table; the other values are zero.
  */
 class ValueTable {
 
@@ -26,25 +32,93 @@ public:
     // change and store via pointers to heap allocated mem. Allowing the default construction allows
     // for a somewhat invalid state to be permitted.
     ValueTable() = default;
-    explicit ValueTable(ID state_count) : state_values_(state_count, 0) {}
+    explicit ValueTable(ID state_count) : state_values_(static_cast<std::size_t>(state_count), 0) {}
     ValueTable(const ValueTable&) = default;
     ValueTable& operator=(const ValueTable&) = default;
     ValueTable(ValueTable&&) = default;
     ValueTable& operator=(ValueTable&&) = default;
     ~ValueTable() = default;
 
+    /**
+     * Creates a table backed by the file at \c path. A new file starts with all values at zero;
+     * an existing file (e.g. from an earlier run) keeps its values, so a run can be resumed.
+     *
+     * \throws std::runtime_error if an existing file holds a different table.
+     */
+    static ValueTable open_mapped(const std::string& path, ID state_count,
+                                  util::MappedFile::Options options={}) {
+        ValueTable table;
+        table.state_values_ = impl::TableStorage(path, impl::TableStorage::Kind::VALUE_TABLE,
+                                                 state_count, 1, 1, options);
+        return table;
+    }
+
+    /**
+     * Creates a table whose memory use scales with the number of states that have been set,
+     * rather than with the state count.
+     */
+    static ValueTable create_sparse(ID state_count) {
+        Expects(state_count > 0);
+        ValueTable table;
+        table.sparse_ = true;
+        table.sparse_state_count_ = state_count;
+        return table;
+    }
+
     double value(const State& state) const {
+        if(sparse_) {
+            Expects(state.id() < sparse_state_count_);
+            return sparse_values_.get(state.id());
+        }
         Expects(state.id() < static_cast<ID>(state_values_.size()));
-        return state_values_[state.id()];
+        return state_values_.data()[state.id()];
     }
 
     void set_value(const State& state, double value) {
+        if(sparse_) {
+            Expects(state.id() < sparse_state_count_);
+            sparse_values_[state.id()] = value;
+            return;
+        }
         Expects(state.id() < static_cast<ID>(state_values_.size()));
-        state_values_[state.id()] = value;
+        state_values_.data()[state.id()] = value;
+    }
+
+    bool is_sparse() const {
+        return sparse_;
+    }
+
+    bool is_mapped() const {
+        return state_values_.is_mapped();
+    }
+
+    /**
+     * \returns false if the values were read from an existing file by open_mapped().
+     */
+    bool created() const {
+        return state_values_.created();
+    }
+
+    /**
+     * Sets the madvise() access pattern hint of a mapped table. E.g. SEQUENTIAL for sweeps in
+     * state order.
+     */
+    void advise(util::MappedFile::AccessPattern access_pattern) {
+        state_values_.advise(access_pattern);
+    }
+
+    /**
+     * Writes a mapped table's values back to its file.
+     */
+    void sync() {
+        state_values_.sync();
     }
 
 private:
-    std::vector<double> state_values_{};
+    impl::TableStorage state_values_{};
+    bool sparse_ = false;
+    ID sparse_state_count_ = 0;
+    util::FlatIdMap<double> sparse_values_{};
 };
 
 } // namespace rl
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+
+#include <glog/logging.h>
+#include <gsl/gsl>
+
+#include "util/IndexedHeap.h"
+
+namespace rl {
+namespace impl {
+
+/**
+ * The largest delta over a fixed set of keys, maintained as the deltas are written.
+ *
+ * The deltas are held in a util::IndexedMaxHeap, so each set() is O(log key_count) and max() is a
+ * lookup, rather than a scan of the whole delta table. Keys that are not written keep their last
+ * delta. All keys start at a delta of zero.
+ */
+class MaxDeltaTracker {
+public:
+    void reset(long key_count) {
+        heap_.reset(key_count, 0.0);
+    }
+
+    void set(long key, double delta) {
+        heap_.update(key, delta);
+    }
+
+    double max() const {
+        return heap_.top_priority();
+    }
+
+private:
+    util::IndexedMaxHeap heap_{};
+};
+
+/**
+ * The smallest visit count over a fixed set of keys.
+ *
+ * Only the number of keys with each count in use is stored, so the memory is bounded by the number
+ * of distinct counts (at most the key count), not by the largest count. The keys themselves are
+ * not stored: the caller reports each change of a key's count. All keys start at a count of zero.
+ */
+class MinVisitCounter {
+public:
+    void reset(long key_count) {
+        Expects(key_count > 0);
+        key_counts_.clear();
+        key_counts_[0] = key_count;
+    }
+
+    /**
+     * Moves a key from \c previous_count to \c count visits, in O(log distinct counts).
+     */
+    void add_visits(long previous_count, long count) {
+        DCHECK_GT(count, previous_count);
+        auto from = key_counts_.find(previous_count);
+        CHECK(from != key_counts_.end()) << "No key has " << previous_count << " visits.";
+        if(--from->second == 0) {
+            key_counts_.erase(from);
+        }
+        key_counts_[count]++;
+    }
+
+    long min() const {
+        return key_counts_.begin()->first;
+    }
+
+private:
+    // Visit count -> the number of keys with that count. Counts no key has are erased.
+    std::map<long, long> key_counts_{};
+};
+
+/**
+ * \returns z such that a standard normal variable is in [-z, z] with probability
+ * \c confidence_level (e.g. 1.96 for 0.95).
+ */
+inline double two_sided_z(double confidence_level) {
+    Expects(confidence_level > 0 and confidence_level < 1);
+    // Bisection on erf(z / sqrt(2)), which is increasing. It is only called when a level is set.
+    double low = 0;
+    double high = 40;
+    for(int i = 0; i < 100; i++) {
+        double mid = (low + high) / 2;
+        if(std::erf(mid / std::sqrt(2.0)) < confidence_level) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return (low + high) / 2;
+}
+
+/**
+ * \returns the half-width of the normal confidence interval of a sample mean: z times the standard
+ * error, from the sum of squared deviations \c m2 of \c n samples. Infinite for fewer than two
+ * samples.
+ */
+inline double confidence_half_width(double m2, long n, double z) {
+    if(n < 2) {
+        return std::numeric_limits<double>::infinity();
+    }
+    double variance = std::max(m2, 0.0) / (n - 1);
+    return z * std::sqrt(variance / n);
+}
+
+} // namespace impl
+} // namespace rl
@@ -5,8 +5,10 @@
 #include <vector>
 #include <unordered_set>
 #include <memory>
+#include <limits>
 
 #include "rl/Environment.h"
+#include "rl/ValueTable.h"
 #include "util/DereferenceIterator.h"
 #include "util/RangeWrapper.h"
 
@@ -138,6 +140,44 @@ public:
         end_states_.insert(state.id());
     }
 
+    /**
+     * Environments are assumed to be stochastic unless they override this.
+     */
+    bool is_deterministic() const override {
+        return false;
+    }
+
+    /**
+     * Default backup, calculated from transition_list().
+     */
+    double action_value(const State& from_state, const Action& action,
+                        const ValueTable& value_function, double discount_rate) const override {
+        ResponseDistribution transitions = transition_list(from_state, action);
+        double expect_value_sum = 0;
+        for(const Response& r : transitions.responses()) {
+            double next_state_value = discount_rate * value_function.value(r.next_state);
+            expect_value_sum += r.prob_weight * (r.reward.value() + next_state_value);
+        }
+        Ensures(transitions.total_weight() != 0);
+        return expect_value_sum / transitions.total_weight();
+    }
+
+    /**
+     * Default bulk backup: one action_value() call per allowed action. Override this if the
+     * actions of a state share work.
+     */
+    void action_values(const State& from_state, const ValueTable& value_function,
+                       double discount_rate, std::vector<double>& out) const override {
+        out.assign(static_cast<std::size_t>(action_count()),
+                   std::numeric_limits<double>::lowest());
+        for(const Action& a : actions()) {
+            if(!is_action_allowed(from_state, a)) {
+                continue;
+            }
+            out[a.id()] = action_value(from_state, a, value_function, discount_rate);
+        }
+    }
+
 protected:
     const State& add_state(std::string name) {
         ID id = state_count();
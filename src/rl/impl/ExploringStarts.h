@@ -0,0 +1,140 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "rl/Environment.h"
+
+#include <glog/logging.h>
+#include <gsl/gsl>
+
+namespace rl {
+namespace impl {
+
+/**
+ * The (state, action) pairs that an exploring starts evaluator launches trials from.
+ *
+ * The pairs are the allowed pairs of non-end states, indexed in the same order as
+ * CompactStateActionMap, so a pair's index is also its position in the evaluator's compact maps.
+ *
+ * By default, every pair is a start in every step. With retirement enabled, a pair that meets its
+ * own convergence criteria after being started is retired: it is skipped in the following steps,
+ * so that the trials go to the pairs that are still holding up finished(). Every
+ * reverify_interval steps, all pairs are started again. A retired pair that no longer meets the
+ * criteria is then reinstated.
+ */
+class ExploringStarts {
+public:
+    static constexpr int DEFAULT_REVERIFY_INTERVAL = 20;
+
+public:
+    void reset(const rl::Environment& env) {
+        pairs_.clear();
+        for(const State& s : env.states()) {
+            if(env.is_end_state(s)) {
+                continue;
+            }
+            for(const Action& a : env.actions()) {
+                if(env.is_action_allowed(s, a)) {
+                    pairs_.emplace_back(s.id(), a.id());
+                }
+            }
+        }
+        retired_.assign(pairs_.size(), false);
+        retired_count_ = 0;
+        step_ = 0;
+        starts_.clear();
+        active_.clear();
+        for(long i = 0; i < static_cast<long>(pairs_.size()); i++) {
+            active_.push_back(i);
+        }
+    }
+
+    void set_retirement(bool enabled, int reverify_interval=DEFAULT_REVERIFY_INTERVAL) {
+        Expects(reverify_interval > 0);
+        retirement_ = enabled;
+        reverify_interval_ = reverify_interval;
+    }
+
+    bool retirement() const {
+        return retirement_;
+    }
+
+    std::size_t pair_count() const {
+        return pairs_.size();
+    }
+
+    /**
+     * \returns the (state ID, action ID) of a pair.
+     */
+    const std::pair<ID, ID>& pair(long index) const {
+        return pairs_[static_cast<std::size_t>(index)];
+    }
+
+    long retired_count() const {
+        return retired_count_;
+    }
+
+    bool is_retired(long index) const {
+        return retired_[static_cast<std::size_t>(index)];
+    }
+
+    /**
+     * \returns the indexes of the pairs to start from in this step.
+     */
+    const std::vector<long>& begin_step() {
+        bool reverify = retirement_ and retired_count_ > 0
+                        and (step_ + 1) % reverify_interval_ == 0;
+        if(!retirement_ or reverify) {
+            starts_.resize(pairs_.size());
+            for(long i = 0; i < static_cast<long>(pairs_.size()); i++) {
+                starts_[static_cast<std::size_t>(i)] = i;
+            }
+        } else {
+            starts_ = active_;
+        }
+        return starts_;
+    }
+
+    /**
+     * Retires the started pairs that are converged, and reinstates the retired ones that aren't.
+     *
+     * \param is_converged(index): whether a pair meets its delta and visit criteria.
+     */
+    template<typename ConvergedFctn>
+    void end_step(const ConvergedFctn& is_converged) {
+        step_++;
+        if(!retirement_) {
+            return;
+        }
+        active_.clear();
+        for(long i : starts_) {
+            auto& retired = retired_[static_cast<std::size_t>(i)];
+            bool converged = is_converged(i);
+            if(converged != static_cast<bool>(retired)) {
+                retired_count_ += converged ? 1 : -1;
+                retired = converged;
+            }
+            if(!retired) {
+                active_.push_back(i);
+            }
+        }
+        // Pairs that weren't started keep their state: only retired pairs are skipped.
+        DCHECK_EQ(static_cast<long>(active_.size()) + retired_count_,
+                  static_cast<long>(pairs_.size()));
+    }
+
+private:
+    std::vector<std::pair<ID, ID>> pairs_{};
+    std::vector<char> retired_{};
+    long retired_count_ = 0;
+    // The pairs that aren't retired, in index order.
+    std::vector<long> active_{};
+    std::vector<long> starts_{};
+    long step_ = 0;
+    bool retirement_ = false;
+    int reverify_interval_ = DEFAULT_REVERIFY_INTERVAL;
+};
+
+} // namespace impl
+} // namespace rl
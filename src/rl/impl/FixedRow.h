@@ -0,0 +1,39 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+
+#include "rl/Environment.h"
+
+namespace rl {
+namespace impl {
+
+/**
+ * \returns the smallest power of two that is >= n.
+ */
+constexpr ID next_power_of_two(ID n) {
+    ID power = 1;
+    while(power < n) {
+        power *= 2;
+    }
+    return power;
+}
+
+/**
+ * A row of per-action entries for FixedActionValueTable, which has a compile-time action count.
+ *
+ * The row length is ACTION_COUNT rounded up to a power of two, and rows are aligned to their size
+ * (up to a cache line). In a vector of rows, locating a state's row is then a shift, and a row
+ * never straddles two cache lines. For entry types whose size isn't a power of two, the alignment
+ * adds padding to each row.
+ */
+template<class T, ID ACTION_COUNT>
+struct alignas(std::min<ID>(next_power_of_two(next_power_of_two(ACTION_COUNT) * sizeof(T)), 64))
+FixedRow {
+    static_assert(ACTION_COUNT > 0, "There must be at least one action.");
+    static constexpr ID STRIDE = next_power_of_two(ACTION_COUNT);
+    std::array<T, STRIDE> values;
+};
+
+} // namespace impl
+} // namespace rl
@@ -0,0 +1,235 @@
+#pragma once
+
+#include "rl/Trial.h"
+#include "util/FlatIdMap.h"
+#include "util/WorkStealingPool.h"
+#include "util/random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gsl/gsl>
+
+namespace rl {
+namespace impl {
+
+/**
+ * The first-visit returns of a batch of trials, summed per key (a state ID or a state-action pair
+ * index). Keys are kept in the order they were first added.
+ *
+ * The last return added for each key is kept as well, so that a merge can give the same per-key
+ * delta as updating the value after every trial. The sum of squared deviations from the shard mean
+ * is kept with Welford's update, for evaluators that track the variance of the returns.
+ */
+class ReturnShard {
+public:
+    static constexpr long NO_SLOT = -1;
+
+public:
+    void add(long key, double retrn) {
+        long& slot = slots_[key];
+        if(slot == NO_SLOT) {
+            slot = static_cast<long>(keys_.size());
+            keys_.push_back(key);
+            sums_.push_back(0.0);
+            counts_.push_back(0);
+            last_returns_.push_back(0.0);
+            m2s_.push_back(0.0);
+        }
+        double previous_mean = counts_[slot] ? sums_[slot] / counts_[slot] : 0.0;
+        sums_[slot] += retrn;
+        counts_[slot]++;
+        last_returns_[slot] = retrn;
+        m2s_[slot] += (retrn - previous_mean) * (retrn - sums_[slot] / counts_[slot]);
+    }
+
+    void clear() {
+        slots_.clear();
+        keys_.clear();
+        sums_.clear();
+        counts_.clear();
+        last_returns_.clear();
+        m2s_.clear();
+        truncated_trial_count_ = 0;
+    }
+
+    /**
+     * Counts a trial that didn't reach an end state (see TrialLimits).
+     */
+    void add_truncated_trial() {
+        truncated_trial_count_++;
+    }
+
+    long truncated_trial_count() const {
+        return truncated_trial_count_;
+    }
+
+    std::size_t size() const {
+        return keys_.size();
+    }
+
+    long key(std::size_t i) const {
+        return keys_[i];
+    }
+
+    double sum(std::size_t i) const {
+        return sums_[i];
+    }
+
+    int count(std::size_t i) const {
+        return counts_[i];
+    }
+
+    double last_return(std::size_t i) const {
+        return last_returns_[i];
+    }
+
+    /**
+     * \returns the sum of the squared deviations of the returns from their mean, sum(i) / count(i).
+     */
+    double m2(std::size_t i) const {
+        return m2s_[i];
+    }
+
+private:
+    util::FlatIdMap<long> slots_{NO_SLOT};
+    std::vector<long> keys_{};
+    std::vector<double> sums_{};
+    std::vector<int> counts_{};
+    std::vector<double> last_returns_{};
+    std::vector<double> m2s_{};
+    long truncated_trial_count_ = 0;
+};
+
+/**
+ * Applies a shard entry to a sample average: \c value and \c visits are updated as if the
+ * shard's returns had been averaged in one at a time.
+ *
+ * \returns the change in value caused by the last of the returns.
+ */
+inline double merge_returns(const ReturnShard& shard, std::size_t i, double& value, int& visits) {
+    int count = shard.count(i);
+    Expects(count > 0);
+    double last = shard.last_return(i);
+    double before_last = value;
+    int n = visits + count;
+    if(count > 1) {
+        // All returns but the last are added at once.
+        before_last += (shard.sum(i) - last - (count - 1) * value) / (n - 1);
+    }
+    double updated = before_last + (last - before_last) / n;
+    value = updated;
+    visits = n;
+    return std::abs(updated - before_last);
+}
+
+/**
+ * Applies a shard entry to a sum of squared deviations, \c m2, of \c visits returns with mean
+ * \c mean (Chan et al.'s pairwise update). Call this before merge_returns(), with the value and
+ * visits from before the merge.
+ */
+inline void merge_m2(const ReturnShard& shard, std::size_t i, double mean, int visits,
+                     double& m2) {
+    int count = shard.count(i);
+    Expects(count > 0);
+    double difference = shard.sum(i) / count - mean;
+    double weight = static_cast<double>(visits) * count / (visits + count);
+    m2 += shard.m2(i) + difference * difference * weight;
+}
+
+/**
+ * Runs a list of exploring start trials on a WorkStealingPool.
+ *
+ * The starts are split into chunks of CHUNK_SIZE. Each chunk is a pool task with its own random
+ * stream and its own ReturnShard. The stream is the Philox stream of the chunk index, keyed by the
+ * step seed, so it costs nothing to create. As neither depends on which thread runs the chunk,
+ * merging the shards in chunk order gives the same result for any thread count.
+ */
+class ParallelTrialRunner {
+public:
+    static constexpr std::size_t CHUNK_SIZE = 16;
+
+    /**
+     * The working memory of a worker, reused by every trial it runs.
+     */
+    struct Scratch {
+        TraceBuffer trace{};
+        FirstVisitIndex first_visits{};
+    };
+
+    // trial(start_index, scratch, shard): runs the trial for a start and adds its returns to shard.
+    using TrialFctn = std::function<void(std::size_t, Scratch&, ReturnShard&)>;
+
+public:
+    void set_thread_count(int thread_count) {
+        Expects(thread_count > 0);
+        if(thread_count != thread_count_) {
+            thread_count_ = thread_count;
+            pool_.reset();
+        }
+    }
+
+    int thread_count() const {
+        return thread_count_;
+    }
+
+    /**
+     * Sets up each worker's FirstVisitIndex for keys in [0, key_count).
+     */
+    void set_first_visit_keys(std::size_t key_count) {
+        first_visit_key_count_ = key_count;
+        scratch_stale_ = true;
+    }
+
+    /**
+     * Runs trial() for every start in [0, start_count).
+     *
+     * A single seed is drawn from util::random::generator() on the calling thread.
+     *
+     * \returns the shards, one per chunk, in start order.
+     */
+    const std::vector<ReturnShard>& run(std::size_t start_count, const TrialFctn& trial) {
+        if(!pool_) {
+            pool_ = std::make_unique<util::WorkStealingPool>(thread_count_);
+            scratch_.assign(static_cast<std::size_t>(thread_count_), Scratch{});
+            scratch_stale_ = true;
+        }
+        if(scratch_stale_) {
+            for(Scratch& scratch : scratch_) {
+                scratch.first_visits.reset(first_visit_key_count_);
+            }
+            scratch_stale_ = false;
+        }
+        std::size_t chunk_count = (start_count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        shards_.resize(chunk_count);
+        std::uint64_t step_seed = util::random::generator().next64();
+        pool_->run(chunk_count, [&](std::size_t chunk, int worker) {
+            util::random::Generator chunk_generator(util::random::Philox4x32(step_seed, chunk));
+            util::random::ScopedGenerator scope(chunk_generator);
+            ReturnShard& shard = shards_[chunk];
+            shard.clear();
+            std::size_t end = std::min(start_count, (chunk + 1) * CHUNK_SIZE);
+            for(std::size_t i = chunk * CHUNK_SIZE; i < end; i++) {
+                trial(i, scratch_[worker], shard);
+            }
+        });
+        return shards_;
+    }
+
+private:
+    int thread_count_ = 1;
+    std::unique_ptr<util::WorkStealingPool> pool_{};
+    // One per worker.
+    std::vector<Scratch> scratch_{};
+    std::size_t first_visit_key_count_ = 0;
+    bool scratch_stale_ = true;
+    std::vector<ReturnShard> shards_{};
+};
+
+} // namespace impl
+} // namespace rl
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "rl/Environment.h"
+#include "rl/Policy.h"
+
+namespace rl {
+namespace impl {
+
+/**
+ * Calculates a state's row of the policy's Markov chain: the probability of each next state when
+ * following \c policy from \c from_state, and the expected immediate reward.
+ *
+ * Next states are appended to \c transitions as (next state ID, probability) pairs. A next state
+ * may appear more than once.
+ *
+ * \returns the expected reward.
+ */
+inline double policy_transitions(const Environment& env, const Policy& policy,
+                                 const State& from_state,
+                                 std::vector<std::pair<ID, double>>& transitions) {
+    Policy::ActionDistribution scratch;
+    Policy::ActionDistributionView action_dist = policy.action_distribution(env, from_state,
+                                                                            scratch);
+    // A policy must have an action for every non-end state.
+    Expects(action_dist.action_count());
+    // The action_dist can't have zero weight in total.
+    Expects(action_dist.total_weight());
+    double expected_reward = 0;
+    for(const Policy::ActionWeight& entry : action_dist.entries()) {
+        const Action& action = *CHECK_NOTNULL(entry.action);
+        Weight action_weight = entry.weight;
+        // A policy's actions can't have zero weight.
+        Expects(action_weight);
+        double action_probability = action_weight / action_dist.total_weight();
+        ResponseDistribution response_dist = env.transition_list(from_state, action);
+        Ensures(response_dist.total_weight() != 0);
+        for(const Response& r : response_dist.responses()) {
+            double probability =
+                    action_probability * r.prob_weight / response_dist.total_weight();
+            expected_reward += probability * r.reward.value();
+            transitions.emplace_back(r.next_state.id(), probability);
+        }
+    }
+    return expected_reward;
+}
+
+} // namespace impl
+} // namespace rl
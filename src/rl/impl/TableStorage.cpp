@@ -0,0 +1,52 @@
+#include "TableStorage.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace rl {
+namespace impl {
+
+constexpr char TableStorage::MAGIC[8];
+
+TableStorage::TableStorage(const std::string& path, Kind kind, ID state_count, ID column_count,
+                           ID row_length, util::MappedFile::Options options) {
+    Expects(state_count > 0);
+    Expects(column_count > 0);
+    Expects(row_length >= column_count);
+    // The values start on the (huge) page after the header, so that they are (huge) page aligned.
+    const std::size_t values_offset =
+            options.huge_pages ? util::MappedFile::HUGE_PAGE_SIZE : util::MappedFile::page_size();
+    static_assert(sizeof(FileHeader) <= 4096, "The header must fit in a page.");
+    size_ = static_cast<std::size_t>(state_count) * static_cast<std::size_t>(row_length);
+    file_ = std::make_unique<util::MappedFile>(path, values_offset + size_ * sizeof(double),
+                                               options);
+    FileHeader* h = header();
+    if(file_->created()) {
+        std::memcpy(h->magic, MAGIC, sizeof(MAGIC));
+        h->version = VERSION;
+        h->kind = kind;
+        h->state_count = state_count;
+        h->column_count = column_count;
+        h->row_length = row_length;
+        h->flags = 0;
+        h->values_offset = values_offset;
+    } else if(std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 or h->version != VERSION or
+              h->kind != kind or h->state_count != state_count or
+              h->column_count != column_count or h->row_length != row_length or
+              h->values_offset != values_offset) {
+        throw std::runtime_error("The file " + path + " doesn't hold a table of the requested "
+                                 "type and size.");
+    }
+    data_ = reinterpret_cast<double*>(static_cast<char*>(file_->data()) + values_offset);
+}
+
+void TableStorage::set_flags(std::uint32_t flags) {
+    if(file_) {
+        header()->flags = flags;
+    } else {
+        flags_ = flags;
+    }
+}
+
+} // namespace impl
+} // namespace rl
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rl/Environment.h"
+#include "util/MappedFile.h"
+
+namespace rl {
+namespace impl {
+
+/**
+ * The backing store of ValueTable and ActionValueTable: state_count rows of row_length doubles,
+ * with the first column_count doubles of each row in use.
+ *
+ * The values are either held on the heap or in a memory mapped file. The file starts with a one
+ * page header describing the table, followed by the page aligned values. With huge pages, the
+ * header takes a whole huge page instead, so that the values are huge page aligned. Reopening a
+ * file resumes from the stored values; the header, including whether huge pages were requested,
+ * must then match the requested table.
+ *
+ * Copies are always held on the heap, so that two tables never share a file.
+ */
+class TableStorage {
+public:
+    // Identifies the table type in the file header.
+    enum class Kind : std::uint32_t {VALUE_TABLE = 1, ACTION_VALUE_TABLE = 2};
+
+public:
+    TableStorage() = default;
+
+    TableStorage(std::size_t size, double fill) : heap_(size, fill) {
+        data_ = heap_.data();
+        size_ = heap_.size();
+    }
+
+    /**
+     * Opens the table file at \c path, creating it if it doesn't exist. The values of a new file
+     * are zero.
+     *
+     * \throws std::runtime_error if an existing file doesn't hold a table of the given kind and
+     *         dimensions, or was created with a different huge_pages option.
+     */
+    TableStorage(const std::string& path, Kind kind, ID state_count, ID column_count,
+                 ID row_length, util::MappedFile::Options options);
+
+    TableStorage(const TableStorage& other) : TableStorage(other.size_, 0.0) {
+        std::copy(other.data_, other.data_ + other.size_, data_);
+        flags_ = other.flags_;
+    }
+
+    TableStorage& operator=(const TableStorage& other) {
+        if(this != &other) {
+            *this = TableStorage(other);
+        }
+        return *this;
+    }
+
+    TableStorage(TableStorage&& other) noexcept { swap(other); }
+
+    TableStorage& operator=(TableStorage&& other) noexcept {
+        TableStorage moved(std::move(other));
+        swap(moved);
+        return *this;
+    }
+
+    ~TableStorage() = default;
+
+    double* data() {
+        return data_;
+    }
+
+    const double* data() const {
+        return data_;
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    bool is_mapped() const {
+        return static_cast<bool>(file_);
+    }
+
+    /**
+     * \returns true if the values are new (heap storage, or a newly created file), false if they
+     *          were read from an existing file.
+     */
+    bool created() const {
+        return !file_ or file_->created();
+    }
+
+    /**
+     * Table specific flags, stored in the file header.
+     */
+    std::uint32_t flags() const {
+        return file_ ? header()->flags : flags_;
+    }
+
+    void set_flags(std::uint32_t flags);
+
+    /**
+     * Sets the access pattern hint. Does nothing for heap storage.
+     */
+    void advise(util::MappedFile::AccessPattern access_pattern) {
+        if(file_) {
+            file_->advise(access_pattern);
+        }
+    }
+
+    /**
+     * Writes the values back to the file. Does nothing for heap storage.
+     */
+    void sync() {
+        if(file_) {
+            file_->sync();
+        }
+    }
+
+private:
+    struct FileHeader {
+        char magic[8];
+        std::uint32_t version;
+        Kind kind;
+        std::int64_t state_count;
+        std::int64_t column_count;
+        std::int64_t row_length;
+        std::uint32_t flags;
+        std::uint64_t values_offset;
+    };
+    static constexpr char MAGIC[8] = {'R', 'L', 'T', 'A', 'B', 'L', 'E', '\0'};
+    static constexpr std::uint32_t VERSION = 2;
+
+    FileHeader* header() const {
+        return static_cast<FileHeader*>(file_->data());
+    }
+
+    void swap(TableStorage& other) noexcept {
+        std::swap(heap_, other.heap_);
+        std::swap(file_, other.file_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(flags_, other.flags_);
+    }
+
+private:
+    std::vector<double> heap_{};
+    std::unique_ptr<util::MappedFile> file_{};
+    double* data_ = nullptr;
+    std::size_t size_ = 0;
+    // Used for heap storage. Mapped storage keeps its flags in the header.
+    std::uint32_t flags_ = 0;
+};
+
+} // namespace impl
+} // namespace rl
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gsl/gsl>
+
+namespace rl {
+namespace util {
+
+/**
+ * A hash map from non-negative integer keys (state IDs, or state-action pair indexes) to V.
+ *
+ * The map uses open addressing with linear probing over a single flat array of (key, value)
+ * slots, so a lookup is usually a single cache line access. The capacity is a power of two and the
+ * map grows once it is half full. Entries can't be erased; clear() removes all of them.
+ *
+ * Lookups of missing keys give a default value, so the map can stand in for a dense array that
+ * is only sparsely written.
+ */
+template<class V>
+class FlatIdMap {
+public:
+    using Key = long;
+    static constexpr Key EMPTY = -1;
+    static constexpr std::size_t MIN_CAPACITY = 16;
+
+    struct Slot {
+        Key key;
+        V value;
+    };
+
+public:
+    explicit FlatIdMap(V default_value=V{}) : default_value_(default_value) {}
+
+    /**
+     * \returns the value of \c key, or nullptr if the key is missing.
+     */
+    const V* find(Key key) const {
+        DCHECK_GE(key, 0);
+        if(slots_.empty()) {
+            return nullptr;
+        }
+        for(std::size_t i = home(key);; i = (i + 1) & mask_) {
+            const Slot& slot = slots_[i];
+            if(slot.key == key) {
+                return &slot.value;
+            }
+            if(slot.key == EMPTY) {
+                return nullptr;
+            }
+        }
+    }
+
+    V* find(Key key) {
+        return const_cast<V*>(static_cast<const FlatIdMap*>(this)->find(key));
+    }
+
+    /**
+     * \returns the value of \c key, or the default value if the key is missing.
+     */
+    const V& get(Key key) const {
+        const V* value = find(key);
+        return value ? *value : default_value_;
+    }
+
+    /**
+     * \returns the value of \c key, inserting the default value if the key is missing.
+     */
+    V& operator[](Key key) {
+        DCHECK_GE(key, 0);
+        // Keep the load factor at or below one half.
+        if(2 * (size_ + 1) > slots_.size()) {
+            rehash(std::max(MIN_CAPACITY, 2 * slots_.size()));
+        }
+        for(std::size_t i = home(key);; i = (i + 1) & mask_) {
+            Slot& slot = slots_[i];
+            if(slot.key == key) {
+                return slot.value;
+            }
+            if(slot.key == EMPTY) {
+                slot.key = key;
+                slot.value = default_value_;
+                size_++;
+                return slot.value;
+            }
+        }
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    std::size_t capacity() const {
+        return slots_.size();
+    }
+
+    const V& default_value() const {
+        return default_value_;
+    }
+
+    /**
+     * Removes all entries. The capacity is kept, so refilling the map to the same size doesn't
+     * allocate.
+     */
+    void clear() {
+        std::fill(slots_.begin(), slots_.end(), Slot{EMPTY, default_value_});
+        size_ = 0;
+    }
+
+    /**
+     * Calls fctn(key, value) for each entry, in slot order.
+     */
+    template<typename Fctn>
+    void for_each(Fctn fctn) const {
+        for(const Slot& slot : slots_) {
+            if(slot.key != EMPTY) {
+                fctn(slot.key, slot.value);
+            }
+        }
+    }
+
+private:
+    std::size_t home(Key key) const {
+        // Fibonacci hashing: consecutive IDs are spread over the table.
+        auto h = static_cast<std::uint64_t>(key) * UINT64_C(0x9E3779B97F4A7C15);
+        return static_cast<std::size_t>(h >> 32) & mask_;
+    }
+
+    void rehash(std::size_t capacity) {
+        std::vector<Slot> old = std::move(slots_);
+        slots_.assign(capacity, Slot{EMPTY, default_value_});
+        mask_ = capacity - 1;
+        for(const Slot& slot : old) {
+            if(slot.key == EMPTY) {
+                continue;
+            }
+            std::size_t i = home(slot.key);
+            while(slots_[i].key != EMPTY) {
+                i = (i + 1) & mask_;
+            }
+            slots_[i] = slot;
+        }
+    }
+
+private:
+    std::vector<Slot> slots_{};
+    std::size_t mask_ = 0;
+    std::size_t size_ = 0;
+    V default_value_;
+};
+
+} // namespace util
+} // namespace rl
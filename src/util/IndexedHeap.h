@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gsl/gsl>
+
+namespace rl {
+namespace util {
+
+/**
+ * A binary max-heap of the keys [0, key_count), ordered by a priority per key.
+ *
+ * Every key is always in the heap. A key's priority can be changed in O(log key_count), so the
+ * heap can track a per-key score that changes as the keys are updated. Ties are broken by the
+ * smaller key, so the order doesn't depend on the order of the updates.
+ */
+class IndexedMaxHeap {
+public:
+    using Key = long;
+
+public:
+    /**
+     * Fills the heap with the keys [0, key_count), all with the same priority.
+     */
+    void reset(Key key_count, double priority) {
+        Expects(key_count > 0);
+        auto size = static_cast<std::size_t>(key_count);
+        heap_.resize(size);
+        positions_.resize(size);
+        priorities_.assign(size, priority);
+        for(std::size_t i = 0; i < size; i++) {
+            heap_[i] = static_cast<Key>(i);
+            positions_[i] = i;
+        }
+    }
+
+    std::size_t size() const {
+        return heap_.size();
+    }
+
+    /**
+     * \returns the key with the largest priority.
+     */
+    Key top() const {
+        Expects(!heap_.empty());
+        return heap_.front();
+    }
+
+    double top_priority() const {
+        return priorities_[static_cast<std::size_t>(top())];
+    }
+
+    double priority(Key key) const {
+        return priorities_[static_cast<std::size_t>(key)];
+    }
+
+    void update(Key key, double priority) {
+        auto k = static_cast<std::size_t>(key);
+        CHECK_LT(k, priorities_.size());
+        double previous = priorities_[k];
+        priorities_[k] = priority;
+        if(priority > previous) {
+            sift_up(positions_[k]);
+        } else if(priority < previous) {
+            sift_down(positions_[k]);
+        }
+    }
+
+private:
+    // Whether the key at heap position a should be above the key at position b.
+    bool before(std::size_t a, std::size_t b) const {
+        Key key_a = heap_[a];
+        Key key_b = heap_[b];
+        double pa = priorities_[static_cast<std::size_t>(key_a)];
+        double pb = priorities_[static_cast<std::size_t>(key_b)];
+        return pa > pb or (pa == pb and key_a < key_b);
+    }
+
+    void swap_positions(std::size_t a, std::size_t b) {
+        std::swap(heap_[a], heap_[b]);
+        positions_[static_cast<std::size_t>(heap_[a])] = a;
+        positions_[static_cast<std::size_t>(heap_[b])] = b;
+    }
+
+    void sift_up(std::size_t i) {
+        while(i > 0) {
+            std::size_t parent = (i - 1) / 2;
+            if(!before(i, parent)) {
+                break;
+            }
+            swap_positions(i, parent);
+            i = parent;
+        }
+    }
+
+    void sift_down(std::size_t i) {
+        for(;;) {
+            std::size_t first = i;
+            std::size_t left = 2 * i + 1;
+            std::size_t right = left + 1;
+            if(left < heap_.size() and before(left, first)) {
+                first = left;
+            }
+            if(right < heap_.size() and before(right, first)) {
+                first = right;
+            }
+            if(first == i) {
+                break;
+            }
+            swap_positions(i, first);
+            i = first;
+        }
+    }
+
+private:
+    std::vector<Key> heap_{};
+    // positions_[key]: the key's position in heap_.
+    std::vector<std::size_t> positions_{};
+    std::vector<double> priorities_{};
+};
+
+} // namespace util
+} // namespace rl
@@ -0,0 +1,158 @@
+#include "MappedFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+#include <utility>
+
+#include "util/alignment.h"
+
+namespace rl {
+namespace util {
+
+namespace {
+
+int to_advice(MappedFile::AccessPattern access_pattern) {
+    switch(access_pattern) {
+        case MappedFile::AccessPattern::SEQUENTIAL:
+            return MADV_SEQUENTIAL;
+        case MappedFile::AccessPattern::RANDOM:
+            return MADV_RANDOM;
+        case MappedFile::AccessPattern::NORMAL:
+        default:
+            return MADV_NORMAL;
+    }
+}
+
+/**
+ * Maps the file at an address that is a multiple of alignment. mmap() only aligns to the page
+ * size, so an aligned range is picked from a larger reservation, and the rest is unmapped.
+ */
+void* map_aligned(int fd, std::size_t size, std::size_t alignment) {
+    const std::size_t reserved_size = size + alignment;
+    void* reserved = mmap(nullptr, reserved_size, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(reserved == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    const auto start = reinterpret_cast<std::uintptr_t>(reserved);
+    const std::uintptr_t aligned = round_up(start, alignment);
+    void* data = mmap(reinterpret_cast<void*>(aligned), size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_FIXED, fd, 0);
+    if(data == MAP_FAILED) {
+        int error = errno;
+        munmap(reserved, reserved_size);
+        errno = error;
+        return MAP_FAILED;
+    }
+    if(aligned > start) {
+        munmap(reserved, aligned - start);
+    }
+    const std::uintptr_t end = aligned + size;
+    if(end < start + reserved_size) {
+        munmap(reinterpret_cast<void*>(end), start + reserved_size - end);
+    }
+    return data;
+}
+
+} // namespace
+
+MappedFile::MappedFile(const std::string& path, std::size_t size, Options options) :
+    path_(path)
+{
+    std::size_t alignment = options.huge_pages ? HUGE_PAGE_SIZE : page_size();
+    size_ = round_up(std::max<std::size_t>(size, 1), alignment);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    created_ = fd != -1;
+    if(!created_ and errno == EEXIST) {
+        fd = open(path.c_str(), O_RDWR);
+    }
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+    }
+    struct stat file_stat{};
+    if(fstat(fd, &file_stat) == -1) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "fstat " + path);
+    }
+    // Growing the file zero fills the new region. An existing file is never shrunk.
+    if(static_cast<std::size_t>(file_stat.st_size) < size_ and
+       ftruncate(fd, static_cast<off_t>(size_)) == -1) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "ftruncate " + path);
+    }
+    data_ = options.huge_pages ? map_aligned(fd, size_, HUGE_PAGE_SIZE)
+                               : mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    // The mapping keeps the file open.
+    close(fd);
+    if(data_ == MAP_FAILED) {
+        data_ = nullptr;
+        throw std::system_error(error, std::generic_category(), "mmap " + path);
+    }
+#ifdef MADV_HUGEPAGE
+    if(options.huge_pages) {
+        // Only a hint; not all file systems support huge pages for file mappings.
+        madvise(data_, size_, MADV_HUGEPAGE);
+    }
+#endif
+    advise(options.access_pattern);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept :
+    path_(std::move(other.path_)),
+    data_(std::exchange(other.data_, nullptr)),
+    size_(std::exchange(other.size_, 0)),
+    created_(other.created_)
+{}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if(this != &other) {
+        unmap();
+        path_ = std::move(other.path_);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        created_ = other.created_;
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile() {
+    unmap();
+}
+
+void MappedFile::advise(AccessPattern access_pattern) {
+    if(data_ and madvise(data_, size_, to_advice(access_pattern)) == -1) {
+        throw std::system_error(errno, std::generic_category(), "madvise " + path_);
+    }
+}
+
+void MappedFile::sync() {
+    if(data_ and msync(data_, size_, MS_SYNC) == -1) {
+        throw std::system_error(errno, std::generic_category(), "msync " + path_);
+    }
+}
+
+std::size_t MappedFile::page_size() {
+    static const std::size_t size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+void MappedFile::unmap() noexcept {
+    if(data_) {
+        munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+} // namespace util
+} // namespace rl
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace rl {
+namespace util {
+
+/**
+ * A file mapped read-write into memory (MAP_SHARED), so that the OS can page out cold regions and
+ * the contents persist after the mapping is closed.
+ *
+ * The mapped size and the mapping's address are aligned to the page size (or the huge page size,
+ * if huge pages are requested). If the file doesn't exist, it is created and zero filled. If it
+ * exists, its contents are kept; created() tells the two cases apart.
+ *
+ * Errors from the system calls are thrown as std::system_error.
+ */
+class MappedFile {
+public:
+    // Hints passed to madvise().
+    enum class AccessPattern {NORMAL, SEQUENTIAL, RANDOM};
+
+    struct Options {
+        AccessPattern access_pattern = AccessPattern::NORMAL;
+        // Requests transparent huge pages (MADV_HUGEPAGE). This is only a hint: it is ignored
+        // if the kernel or file system doesn't support huge pages for file mappings.
+        bool huge_pages = false;
+    };
+
+    static constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+public:
+    MappedFile(const std::string& path, std::size_t size, Options options);
+    MappedFile(const std::string& path, std::size_t size) : MappedFile(path, size, Options{}) {}
+
+    // Core guidelines C21:
+    // If you define or delete any default operations, define or delete them all.
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    ~MappedFile();
+
+    void* data() {
+        return data_;
+    }
+
+    const void* data() const {
+        return data_;
+    }
+
+    // The mapped size. At least the requested size.
+    std::size_t size() const {
+        return size_;
+    }
+
+    const std::string& path() const {
+        return path_;
+    }
+
+    /**
+     * \returns true if the file was created when it was mapped, false if an existing file was
+     *          opened.
+     */
+    bool created() const {
+        return created_;
+    }
+
+    /**
+     * Sets the access pattern hint for the whole mapping.
+     */
+    void advise(AccessPattern access_pattern);
+
+    /**
+     * Writes dirty pages back to the file, blocking until done.
+     */
+    void sync();
+
+    static std::size_t page_size();
+
+private:
+    void unmap() noexcept;
+
+private:
+    std::string path_{};
+    void* data_ = nullptr;
+    std::size_t size_ = 0;
+    bool created_ = false;
+};
+
+} // namespace util
+} // namespace rl
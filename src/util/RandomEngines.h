@@ -0,0 +1,319 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+namespace rl {
+namespace util {
+namespace random {
+
+/**
+ * The splitmix64 generator. It is used to expand a single seed into the larger states of the
+ * engines below.
+ */
+class SplitMix64 {
+public:
+    using result_type = std::uint64_t;
+
+public:
+    explicit SplitMix64(std::uint64_t seed) : state_(seed) {}
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    result_type operator()() {
+        std::uint64_t z = (state_ += UINT64_C(0x9E3779B97F4A7C15));
+        z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+        z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+        return z ^ (z >> 31);
+    }
+
+private:
+    std::uint64_t state_;
+};
+
+/**
+ * xoshiro256** (Blackman & Vigna): 256 bits of state, a period of 2^256 - 1 and a few
+ * shifts/rotations per output.
+ *
+ * jump() advances the state by 2^128 outputs, so 2^128 non-overlapping streams are available.
+ */
+class Xoshiro256StarStar {
+public:
+    using result_type = std::uint64_t;
+    static constexpr std::uint64_t DEFAULT_SEED = 0;
+
+public:
+    explicit Xoshiro256StarStar(std::uint64_t seed=DEFAULT_SEED) {
+        this->seed(seed);
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    void seed(std::uint64_t seed) {
+        SplitMix64 expand(seed);
+        for(std::uint64_t& word : s_) {
+            word = expand();
+        }
+    }
+
+    result_type operator()() {
+        const std::uint64_t result = rotl(s_[1] * 5, 7) * 9;
+        const std::uint64_t t = s_[1] << 17;
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = rotl(s_[3], 45);
+        return result;
+    }
+
+    void jump() {
+        static constexpr std::uint64_t JUMP[] = {
+                UINT64_C(0x180EC6D33CFD0ABA), UINT64_C(0xD5A61266F0C9392C),
+                UINT64_C(0xA9582618E03FC9AA), UINT64_C(0x39ABDC4529B1661C)};
+        std::uint64_t s[4] = {0, 0, 0, 0};
+        for(std::uint64_t jump : JUMP) {
+            for(int b = 0; b < 64; b++) {
+                if(jump & (UINT64_C(1) << b)) {
+                    for(int i = 0; i < 4; i++) {
+                        s[i] ^= s_[i];
+                    }
+                }
+                (*this)();
+            }
+        }
+        for(int i = 0; i < 4; i++) {
+            s_[i] = s[i];
+        }
+    }
+
+    bool operator==(const Xoshiro256StarStar& other) const {
+        return s_[0] == other.s_[0] and s_[1] == other.s_[1] and s_[2] == other.s_[2]
+               and s_[3] == other.s_[3];
+    }
+
+private:
+    static std::uint64_t rotl(std::uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+private:
+    std::uint64_t s_[4];
+};
+
+/**
+ * PCG64 (O'Neill): a 128 bit linear congruential generator with the XSL-RR output function. The
+ * stream (the LCG increment) is chosen at construction.
+ *
+ * advance() jumps by any number of outputs in O(log n). jump() advances by 2^64 outputs.
+ */
+class Pcg64 {
+public:
+    using result_type = std::uint64_t;
+    static constexpr std::uint64_t DEFAULT_SEED = 0;
+
+public:
+    explicit Pcg64(std::uint64_t seed=DEFAULT_SEED, std::uint64_t stream=0) {
+        this->seed(seed, stream);
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    void seed(std::uint64_t seed, std::uint64_t stream=0) {
+        SplitMix64 expand(seed);
+        UInt128 initial_state = (static_cast<UInt128>(expand()) << 64) | expand();
+        state_ = 0;
+        increment_ = (static_cast<UInt128>(stream) << 1) | 1u;
+        step();
+        state_ += initial_state;
+        step();
+    }
+
+    result_type operator()() {
+        step();
+        auto xored = static_cast<std::uint64_t>(state_ >> 64) ^ static_cast<std::uint64_t>(state_);
+        auto rotation = static_cast<unsigned>(state_ >> 122);
+        return (xored >> rotation) | (xored << ((64 - rotation) & 63));
+    }
+
+    /**
+     * Advances the state as if operator() had been called \c high * 2^64 + \c low times.
+     */
+    void advance(std::uint64_t low, std::uint64_t high=0) {
+        UInt128 delta = (static_cast<UInt128>(high) << 64) | low;
+        UInt128 acc_mult = 1;
+        UInt128 acc_plus = 0;
+        UInt128 cur_mult = multiplier();
+        UInt128 cur_plus = increment_;
+        while(delta > 0) {
+            if(delta & 1u) {
+                acc_mult *= cur_mult;
+                acc_plus = acc_plus * cur_mult + cur_plus;
+            }
+            cur_plus = (cur_mult + 1) * cur_plus;
+            cur_mult *= cur_mult;
+            delta >>= 1;
+        }
+        state_ = acc_mult * state_ + acc_plus;
+    }
+
+    void jump() {
+        advance(0, 1);
+    }
+
+    bool operator==(const Pcg64& other) const {
+        return state_ == other.state_ and increment_ == other.increment_;
+    }
+
+private:
+    // __extension__ silences -pedantic: 128 bit integers are a GCC/Clang extension.
+    __extension__ using UInt128 = unsigned __int128;
+
+    static UInt128 multiplier() {
+        return (static_cast<UInt128>(UINT64_C(0x2360ED051FC65DA4)) << 64)
+               | UINT64_C(0x4385DF649FCCF645);
+    }
+
+    void step() {
+        state_ = state_ * multiplier() + increment_;
+    }
+
+private:
+    UInt128 state_;
+    UInt128 increment_;
+};
+
+/**
+ * Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"): a counter-based
+ * generator. Each 128 bit counter value is encrypted with the 64 bit key to give 4 outputs.
+ *
+ * As the output only depends on (key, counter), a stream is cheap to create: the seed is the key
+ * and the upper 64 bits of the counter select the stream. This makes it a good fit for giving each
+ * of many parallel tasks its own reproducible stream. jump() moves to the next stream, at the same
+ * position.
+ */
+class Philox4x32 {
+public:
+    using result_type = std::uint32_t;
+    static constexpr std::uint64_t DEFAULT_SEED = 0;
+
+public:
+    explicit Philox4x32(std::uint64_t seed=DEFAULT_SEED, std::uint64_t stream=0) {
+        this->seed(seed, stream);
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    void seed(std::uint64_t seed, std::uint64_t stream=0) {
+        key_[0] = static_cast<std::uint32_t>(seed);
+        key_[1] = static_cast<std::uint32_t>(seed >> 32);
+        counter_[0] = 0;
+        counter_[1] = 0;
+        counter_[2] = static_cast<std::uint32_t>(stream);
+        counter_[3] = static_cast<std::uint32_t>(stream >> 32);
+        generate_block();
+        index_ = 0;
+    }
+
+    result_type operator()() {
+        if(index_ == 4) {
+            // Increment the lower 64 bits of the counter (the position in the stream).
+            if(++counter_[0] == 0) {
+                ++counter_[1];
+            }
+            generate_block();
+            index_ = 0;
+        }
+        return block_[index_++];
+    }
+
+    void jump() {
+        if(++counter_[2] == 0) {
+            ++counter_[3];
+        }
+        generate_block();
+    }
+
+    /**
+     * \returns the 4 outputs for a counter value, without changing the generator's position.
+     */
+    static void block(const std::uint32_t (&key)[2], const std::uint32_t (&counter)[4],
+                      std::uint32_t (&out)[4]) {
+        std::uint32_t k0 = key[0];
+        std::uint32_t k1 = key[1];
+        std::uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+        for(int round = 0; round < 10; round++) {
+            if(round > 0) {
+                k0 += W0;
+                k1 += W1;
+            }
+            std::uint64_t p0 = static_cast<std::uint64_t>(M0) * c0;
+            std::uint64_t p1 = static_cast<std::uint64_t>(M1) * c2;
+            auto hi0 = static_cast<std::uint32_t>(p0 >> 32), lo0 = static_cast<std::uint32_t>(p0);
+            auto hi1 = static_cast<std::uint32_t>(p1 >> 32), lo1 = static_cast<std::uint32_t>(p1);
+            c0 = hi1 ^ c1 ^ k0;
+            c1 = lo1;
+            c2 = hi0 ^ c3 ^ k1;
+            c3 = lo0;
+        }
+        out[0] = c0;
+        out[1] = c1;
+        out[2] = c2;
+        out[3] = c3;
+    }
+
+    bool operator==(const Philox4x32& other) const {
+        for(int i = 0; i < 4; i++) {
+            if(counter_[i] != other.counter_[i]) {
+                return false;
+            }
+        }
+        return key_[0] == other.key_[0] and key_[1] == other.key_[1] and index_ == other.index_;
+    }
+
+private:
+    static constexpr std::uint32_t M0 = 0xD2511F53;
+    static constexpr std::uint32_t M1 = 0xCD9E8D57;
+    static constexpr std::uint32_t W0 = 0x9E3779B9;
+    static constexpr std::uint32_t W1 = 0xBB67AE85;
+
+    void generate_block() {
+        block(key_, counter_, block_);
+    }
+
+private:
+    std::uint32_t key_[2];
+    // The counter of the block held in block_.
+    std::uint32_t counter_[4];
+    std::uint32_t block_[4];
+    int index_;
+};
+
+} // namespace random
+} // namespace util
+} // namespace rl
@@ -0,0 +1,135 @@
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+
+#include <gsl/gsl>
+
+namespace rl {
+namespace util {
+
+WorkStealingPool::WorkStealingPool(int thread_count) {
+    Expects(thread_count > 0);
+    for(int i = 0; i < thread_count; i++) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for(int worker = 1; worker < thread_count; worker++) {
+        threads_.emplace_back(&WorkStealingPool::worker_loop, this, worker);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    start_cv_.notify_all();
+    for(std::thread& thread : threads_) {
+        thread.join();
+    }
+}
+
+int WorkStealingPool::default_thread_count() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void WorkStealingPool::run(std::size_t task_count, const Task& task) {
+    if(task_count == 0) {
+        return;
+    }
+    const std::size_t worker_count = queues_.size();
+    for(std::size_t worker = 0; worker < worker_count; worker++) {
+        std::lock_guard<std::mutex> lock(queues_[worker]->mutex);
+        std::size_t begin = task_count * worker / worker_count;
+        std::size_t end = task_count * (worker + 1) / worker_count;
+        for(std::size_t i = begin; i < end; i++) {
+            queues_[worker]->tasks.push_back(i);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        error_ = nullptr;
+        failed_ = false;
+        busy_workers_ = static_cast<int>(worker_count);
+        batch_++;
+    }
+    start_cv_.notify_all();
+    work(0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this]() { return busy_workers_ == 0; });
+    task_ = nullptr;
+    if(error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+void WorkStealingPool::worker_loop(int worker) {
+    std::uint64_t seen_batch = 0;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_cv_.wait(lock, [this, seen_batch]() {
+                return stopping_ or batch_ != seen_batch;
+            });
+            if(stopping_) {
+                return;
+            }
+            seen_batch = batch_;
+        }
+        work(worker);
+    }
+}
+
+void WorkStealingPool::work(int worker) {
+    std::size_t task = 0;
+    while(next_task(worker, task)) {
+        bool failed;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            failed = failed_;
+        }
+        // After a failure, the remaining tasks are drained without being run.
+        if(failed) {
+            continue;
+        }
+        try {
+            (*task_)(task, worker);
+        } catch(...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(!error_) {
+                error_ = std::current_exception();
+            }
+            failed_ = true;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(--busy_workers_ == 0) {
+        done_cv_.notify_all();
+    }
+}
+
+bool WorkStealingPool::next_task(int worker, std::size_t& task) {
+    {
+        Queue& own = *queues_[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.tasks.empty()) {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    const int worker_count = thread_count();
+    for(int offset = 1; offset < worker_count; offset++) {
+        Queue& victim = *queues_[(worker + offset) % worker_count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty()) {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace util
+} // namespace rl
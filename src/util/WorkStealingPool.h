@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rl {
+namespace util {
+
+/**
+ * A fixed set of threads that run batches of indexed tasks.
+ *
+ * run() splits the tasks into one contiguous block per worker and places each block in that
+ * worker's queue. A worker takes tasks from the front of its own queue; once it is empty, it
+ * steals from the back of the other workers' queues. The thread calling run() is worker 0, so a
+ * pool with a thread count of 1 runs everything on the calling thread.
+ *
+ * Which worker runs a task is not deterministic. Tasks that need reproducible results should only
+ * depend on their task index.
+ */
+class WorkStealingPool {
+public:
+    // task(task_index, worker_index)
+    using Task = std::function<void(std::size_t, int)>;
+
+public:
+    explicit WorkStealingPool(int thread_count);
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+    WorkStealingPool(WorkStealingPool&&) = delete;
+    WorkStealingPool& operator=(WorkStealingPool&&) = delete;
+    ~WorkStealingPool();
+
+    /**
+     * Runs task(i, worker) for each i in [0, task_count) and waits for all of them to finish.
+     *
+     * If a task throws, the remaining tasks are skipped and the exception is rethrown here.
+     */
+    void run(std::size_t task_count, const Task& task);
+
+    int thread_count() const {
+        return static_cast<int>(queues_.size());
+    }
+
+    static int default_thread_count();
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::size_t> tasks;
+    };
+
+    void worker_loop(int worker);
+    void work(int worker);
+    bool next_task(int worker, std::size_t& task);
+
+private:
+    std::vector<std::unique_ptr<Queue>> queues_{};
+    std::vector<std::thread> threads_{};
+    std::mutex mutex_{};
+    std::condition_variable start_cv_{};
+    std::condition_variable done_cv_{};
+    // Incremented by each run(), so the background workers can tell a new batch from a spurious
+    // wakeup.
+    std::uint64_t batch_ = 0;
+    int busy_workers_ = 0;
+    bool stopping_ = false;
+    const Task* task_ = nullptr;
+    std::exception_ptr error_{};
+    bool failed_ = false;
+};
+
+} // namespace util
+} // namespace rl
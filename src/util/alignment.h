@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+
+namespace rl {
+namespace util {
+
+/**
+ * \returns the smallest multiple of alignment that is at least size.
+ */
+inline std::size_t round_up(std::size_t size, std::size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+} // namespace util
+} // namespace rl
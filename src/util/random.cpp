@@ -1,20 +1,148 @@
 #include "random.h"
 
+#include <array>
+#include <stdexcept>
+
 namespace {
-    std::random_device rd{};
-    std::mt19937 gen{rd()};
+    rl::util::random::Generator& own_generator() {
+        thread_local rl::util::random::Generator gen{rl::util::random::Engine::MT19937,
+                                                     std::random_device{}()};
+        return gen;
+    }
+    // Set by ScopedGenerator.
+    thread_local rl::util::random::Generator* scoped_gen = nullptr;
+
+    // 53 random bits as a double in [0, 1).
+    double to_unit(std::uint64_t bits) {
+        return static_cast<double>(bits >> 11) * 0x1.0p-53;
+    }
+
+    template<typename Engine64>
+    void fill_uniform_64(Engine64& engine, double* first, double* last) {
+        for(; first != last; ++first) {
+            *first = to_unit(engine());
+        }
+    }
+
+    template<typename Engine32>
+    void fill_uniform_32(Engine32& engine, double* first, double* last) {
+        for(; first != last; ++first) {
+            std::uint64_t high = static_cast<std::uint32_t>(engine());
+            std::uint64_t low = static_cast<std::uint32_t>(engine());
+            *first = to_unit((high << 32) | low);
+        }
+    }
 }
 
 namespace rl {
 namespace util {
 namespace random {
 
-std::mt19937& generator() {
-    return gen;
+Generator::Generator(Engine engine, std::uint64_t seed) {
+    switch(engine) {
+        case Engine::MT19937:
+            engine_.emplace<0>(static_cast<std::mt19937::result_type>(seed));
+            break;
+        case Engine::XOSHIRO256:
+            engine_.emplace<1>(seed);
+            break;
+        case Engine::PCG64:
+            engine_.emplace<2>(seed);
+            break;
+        case Engine::PHILOX:
+            engine_.emplace<3>(seed);
+            break;
+    }
+}
+
+std::uint64_t Generator::next64() {
+    switch(engine_.index()) {
+        case 1:
+            has_spare_ = false;
+            return std::get<1>(engine_)();
+        case 2:
+            has_spare_ = false;
+            return std::get<2>(engine_)();
+        default: {
+            std::uint64_t high = (*this)();
+            return (high << 32) | (*this)();
+        }
+    }
+}
+
+void Generator::seed(std::uint64_t seed) {
+    *this = Generator(engine(), seed);
+}
+
+void Generator::jump() {
+    has_spare_ = false;
+    switch(engine()) {
+        case Engine::MT19937:
+            throw std::logic_error("MT19937 doesn't support jump(). Use split() instead.");
+        case Engine::XOSHIRO256:
+            std::get<1>(engine_).jump();
+            break;
+        case Engine::PCG64:
+            std::get<2>(engine_).jump();
+            break;
+        case Engine::PHILOX:
+            std::get<3>(engine_).jump();
+            break;
+    }
+}
+
+Generator Generator::split() {
+    if(engine() == Engine::MT19937) {
+        std::array<std::uint32_t, 8> seeds{};
+        for(std::uint32_t& s : seeds) {
+            s = (*this)();
+        }
+        std::seed_seq seed_seq(seeds.begin(), seeds.end());
+        return Generator(std::mt19937(seed_seq));
+    }
+    has_spare_ = false;
+    Generator child = *this;
+    jump();
+    return child;
+}
+
+void Generator::fill_uniform(double* first, double* last) {
+    Expects(first <= last);
+    has_spare_ = false;
+    switch(engine_.index()) {
+        case 0:
+            fill_uniform_32(std::get<0>(engine_), first, last);
+            break;
+        case 1:
+            fill_uniform_64(std::get<1>(engine_), first, last);
+            break;
+        case 2:
+            fill_uniform_64(std::get<2>(engine_), first, last);
+            break;
+        default:
+            fill_uniform_32(std::get<3>(engine_), first, last);
+            break;
+    }
+}
+
+Generator& generator() {
+    return scoped_gen ? *scoped_gen : own_generator();
 }
 
 void reseed_generator(uint seed) {
-    gen = std::mt19937(seed);
+    own_generator().seed(seed);
+}
+
+void set_engine(Engine engine, std::uint64_t seed) {
+    own_generator() = Generator(engine, seed);
+}
+
+ScopedGenerator::ScopedGenerator(Generator& generator) : previous_(scoped_gen) {
+    scoped_gen = &generator;
+}
+
+ScopedGenerator::~ScopedGenerator() {
+    scoped_gen = previous_;
 }
 
 } // namespace random
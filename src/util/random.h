@@ -1,47 +1,187 @@
 #pragma once
 
+#include <cstdint>
+#include <limits>
 #include <random>
+#include <variant>
 #include <gsl/gsl>
 
+#include "util/RandomEngines.h"
+
 namespace rl {
 namespace util {
 namespace random {
 
 /**
- * \returns the random number generator being used by all methods in rl::util::random.
+ * The engines that a Generator can use.
+ *
+ * MT19937: std::mt19937. The default, which keeps the sequences of existing seeds.
+ * XOSHIRO256: xoshiro256**, the fastest of the engines.
+ * PCG64: PCG XSL-RR 128/64.
+ * PHILOX: Philox4x32-10, a counter-based engine with cheap, reproducible streams.
+ */
+enum class Engine {MT19937, XOSHIRO256, PCG64, PHILOX};
+
+/**
+ * A random bit generator (32 bit outputs) backed by one of the Engine types.
+ *
+ * The 64 bit engines give two outputs per step. For MT19937, the outputs are the same as those of
+ * a std::mt19937 with the same seed.
+ */
+class Generator {
+public:
+    using result_type = std::uint32_t;
+    static constexpr std::uint64_t DEFAULT_SEED = std::mt19937::default_seed;
+
+public:
+    explicit Generator(Engine engine=Engine::MT19937, std::uint64_t seed=DEFAULT_SEED);
+    explicit Generator(const std::mt19937& engine) : engine_(engine) {}
+    explicit Generator(const Xoshiro256StarStar& engine) : engine_(engine) {}
+    explicit Generator(const Pcg64& engine) : engine_(engine) {}
+    explicit Generator(const Philox4x32& engine) : engine_(engine) {}
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    result_type operator()() {
+        switch(engine_.index()) {
+            case 0:
+                return static_cast<result_type>(std::get<0>(engine_)());
+            case 1:
+                return half_of_64(std::get<1>(engine_));
+            case 2:
+                return half_of_64(std::get<2>(engine_));
+            default:
+                return std::get<3>(engine_)();
+        }
+    }
+
+    std::uint64_t next64();
+
+    Engine engine() const {
+        return static_cast<Engine>(engine_.index());
+    }
+
+    /**
+     * Restarts the current engine from \c seed.
+     */
+    void seed(std::uint64_t seed);
+
+    /**
+     * Advances to a position that won't be reached by the current position in practice: 2^128
+     * outputs for XOSHIRO256, 2^64 steps for PCG64 and the next stream for PHILOX.
+     *
+     * \throws std::logic_error for MT19937.
+     */
+    void jump();
+
+    /**
+     * \returns a generator for an independent stream, and moves this generator past it.
+     *
+     * For the jumpable engines, the returned generator continues from the current position and
+     * this generator jumps. A MT19937 child is seeded from this generator's outputs, which only
+     * makes overlap unlikely.
+     */
+    Generator split();
+
+    /**
+     * Fills [first, last) with doubles uniformly distributed in [0, 1), with 53 bits of
+     * randomness each. The engine is only selected once, so this is faster than calling a
+     * distribution per number.
+     */
+    void fill_uniform(double* first, double* last);
+
+private:
+    template<typename Engine64>
+    result_type half_of_64(Engine64& engine) {
+        if(has_spare_) {
+            has_spare_ = false;
+            return spare_;
+        }
+        std::uint64_t bits = engine();
+        spare_ = static_cast<result_type>(bits >> 32);
+        has_spare_ = true;
+        return static_cast<result_type>(bits);
+    }
+
+private:
+    // The alternatives are in the order of Engine.
+    std::variant<std::mt19937, Xoshiro256StarStar, Pcg64, Philox4x32> engine_;
+    // The unused upper half of a 64 bit output.
+    result_type spare_ = 0;
+    bool has_spare_ = false;
+};
+
+/**
+ * \returns the calling thread's generator, used by all methods in rl::util::random. Each thread
+ * has its own generator, seeded from std::random_device, unless a ScopedGenerator is in scope.
  */
-std::mt19937& generator();
+Generator& generator();
 
 /**
- * Recreate a mt19937 generator with the given seed.
+ * Restarts the calling thread's generator from the given seed, keeping its engine.
  */
 void reseed_generator(uint seed);
 
+/**
+ * Replaces the calling thread's generator with a new one.
+ */
+void set_engine(Engine engine, std::uint64_t seed);
+
+/**
+ * While in scope, generator() on the constructing thread returns \c generator instead of the
+ * thread's own generator. Scopes nest.
+ *
+ * This gives a task a specific stream (e.g. one that depends on the task, not the thread running
+ * it). reseed_generator() and set_engine() still act on the thread's own generator.
+ */
+class ScopedGenerator {
+public:
+    explicit ScopedGenerator(Generator& generator);
+    ScopedGenerator(const ScopedGenerator&) = delete;
+    ScopedGenerator& operator=(const ScopedGenerator&) = delete;
+    ScopedGenerator(ScopedGenerator&&) = delete;
+    ScopedGenerator& operator=(ScopedGenerator&&) = delete;
+    ~ScopedGenerator();
+
+private:
+    Generator* previous_;
+};
+
 // For ints, longs etc.
-template<typename NUM>
+template<typename NUM, typename URBG>
 std::enable_if_t<std::is_integral<NUM>::value, NUM>
-random_in_range(NUM from_inclusive, NUM to_exclusive) {
+random_in_range(NUM from_inclusive, NUM to_exclusive, URBG& generator) {
     Expects(from_inclusive < to_exclusive);
     std::uniform_int_distribution<NUM> dist(from_inclusive, to_exclusive - 1);
-    NUM ans = dist(generator());
+    NUM ans = dist(generator);
     Ensures(ans >= from_inclusive);
     Ensures(ans < to_exclusive);
     return ans;
 }
 
 // For floats, doubles, etc.
-template<typename NUM>
+template<typename NUM, typename URBG>
 std::enable_if_t<std::is_floating_point<NUM>::value, NUM>
-random_in_range(NUM from_inclusive, NUM to_exclusive) {
+random_in_range(NUM from_inclusive, NUM to_exclusive, URBG& generator) {
     Expects(from_inclusive < to_exclusive);
     std::uniform_real_distribution<NUM> dist(from_inclusive, to_exclusive);
-    NUM ans = dist(generator());
+    NUM ans = dist(generator);
     Ensures(ans >= from_inclusive);
     Ensures(ans < to_exclusive);
     return ans;
 }
 
+template<typename NUM>
+NUM random_in_range(NUM from_inclusive, NUM to_exclusive) {
+    return random_in_range(from_inclusive, to_exclusive, generator());
+}
+
 } // namespace random
 } // namespace util
 } // namespace rl
-
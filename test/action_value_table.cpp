@@ -0,0 +1,304 @@
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "rl/ActionValueTable.h"
+#include "rl/FixedActionValueTable.h"
+#include "rl/GridWorld.h"
+#include "rl/ValueTable.h"
+#include "rl/impl/TableStorage.h"
+#include "util/random.h"
+
+/**
+ * Tests that best_action() returns the first action with the max value, for action counts that
+ * fill a varying number of the padded row's lanes.
+ */
+TEST(ActionValueTable, best_action_is_first_max) {
+    for(rl::ID action_count = 1; action_count <= 9; action_count++) {
+        // Setup
+        std::vector<rl::Action> actions;
+        for(rl::ID i = 0; i < action_count; i++) {
+            actions.emplace_back(i, "Action " + std::to_string(i));
+        }
+        rl::State state(0, "State 0");
+        for(rl::ID best = 0; best < action_count; best++) {
+            rl::ActionValueTable table(1, action_count);
+            for(const rl::Action& a : actions) {
+                table.set_value(state, a, -10.0 + a.id());
+            }
+            // Two actions share the max value: best and the last action.
+            table.set_value(state, actions[best], 5.0);
+            table.set_value(state, actions.back(), 5.0);
+
+            // Test
+            rl::ActionValueTable::ActionValuePair result = table.best_action(state);
+            ASSERT_EQ(best, result.first) << "Action count: " << action_count;
+            ASSERT_EQ(5.0, result.second);
+        }
+    }
+}
+
+/**
+ * Tests that a table created from an environment never chooses a disallowed action, even if all
+ * allowed actions have negative values, and that end states aren't masked.
+ */
+TEST(ActionValueTable, masked_disallowed_actions) {
+    // Setup
+    rl::GridWorld<2, 2> grid_world(rl::GridWorldBoundsBehaviour::NO_OUT_OF_BOUNDS);
+    const rl::State& end_state = grid_world.pos_to_state(grid::Position{1, 1});
+    grid_world.mark_as_end_state(end_state);
+    rl::ActionValueTable table(grid_world);
+    for(const rl::State& s : grid_world.states()) {
+        for(const rl::Action& a : grid_world.actions()) {
+            if(grid_world.is_end_state(s) or grid_world.is_action_allowed(s, a)) {
+                table.set_value(s, a, -1.0 - a.id());
+            }
+        }
+    }
+
+    // Test
+    for(const rl::State& s : grid_world.states()) {
+        if(grid_world.is_end_state(s)) {
+            continue;
+        }
+        const rl::Action& best = grid_world.action(table.best_action(s).first);
+        ASSERT_TRUE(grid_world.is_action_allowed(s, best));
+        for(const rl::Action& a : grid_world.actions()) {
+            if(!grid_world.is_action_allowed(s, a)) {
+                ASSERT_EQ(-std::numeric_limits<double>::infinity(), table.value(s, a));
+            }
+        }
+    }
+    rl::ActionValueTable unset_table(grid_world);
+    for(const rl::Action& a : grid_world.actions()) {
+        ASSERT_EQ(0, unset_table.value(end_state, a));
+    }
+}
+
+/**
+ * Tests that best_action() with the greedy cache matches a full scan after a sequence of
+ * increases and decreases, including decreases of the current best value.
+ */
+TEST(ActionValueTable, greedy_cache_matches_scan) {
+    // Setup
+    rl::util::random::reseed_generator(1);
+    const rl::ID state_count = 3;
+    const rl::ID action_count = 6;
+    std::vector<rl::State> states;
+    for(rl::ID i = 0; i < state_count; i++) {
+        states.emplace_back(i, "State " + std::to_string(i));
+    }
+    std::vector<rl::Action> actions;
+    for(rl::ID i = 0; i < action_count; i++) {
+        actions.emplace_back(i, "Action " + std::to_string(i));
+    }
+    rl::ActionValueTable cached(state_count, action_count);
+    cached.enable_greedy_cache();
+    rl::ActionValueTable uncached(state_count, action_count);
+    const int update_count = 2000;
+
+    // Test
+    for(int i = 0; i < update_count; i++) {
+        const rl::State& s = states[rl::util::random::random_in_range<rl::ID>(0, state_count)];
+        const rl::Action& a = actions[rl::util::random::random_in_range<rl::ID>(0, action_count)];
+        // Small integers, so that ties are common.
+        double value = rl::util::random::random_in_range<int>(-3, 4);
+        cached.set_value(s, a, value);
+        uncached.set_value(s, a, value);
+        ASSERT_EQ(uncached.best_action(s), cached.best_action(s));
+    }
+}
+
+namespace {
+
+template<rl::ID ACTION_COUNT>
+void check_fixed_table_matches(int update_count) {
+    const rl::ID state_count = 3;
+    std::vector<rl::State> states;
+    for(rl::ID i = 0; i < state_count; i++) {
+        states.emplace_back(i, "State " + std::to_string(i));
+    }
+    std::vector<rl::Action> actions;
+    for(rl::ID i = 0; i < ACTION_COUNT; i++) {
+        actions.emplace_back(i, "Action " + std::to_string(i));
+    }
+    rl::FixedActionValueTable<ACTION_COUNT> fixed(state_count);
+    rl::ActionValueTable dynamic(state_count, ACTION_COUNT);
+    ASSERT_EQ(ACTION_COUNT, fixed.action_count());
+    ASSERT_EQ(state_count, fixed.state_count());
+    for(int i = 0; i < update_count; i++) {
+        const rl::State& s = states[rl::util::random::random_in_range<rl::ID>(0, state_count)];
+        const rl::Action& a = actions[rl::util::random::random_in_range<rl::ID>(0, ACTION_COUNT)];
+        // Small integers, so that ties are common.
+        double value = rl::util::random::random_in_range<int>(-3, 4);
+        fixed.set_value(s, a, value);
+        dynamic.set_value(s, a, value);
+        ASSERT_EQ(dynamic.value(s, a), fixed.value(s, a));
+        ASSERT_EQ(dynamic.best_action(s), fixed.best_action(s));
+    }
+}
+
+} // namespace
+
+/**
+ * Tests that FixedActionValueTable gives the same values and best actions as ActionValueTable,
+ * for action counts that are and aren't a power of two.
+ */
+TEST(FixedActionValueTable, matches_action_value_table) {
+    // Setup
+    rl::util::random::reseed_generator(1);
+    const int update_count = 500;
+
+    // Test
+    ASSERT_EQ(1, rl::FixedActionValueTable<1>::STRIDE);
+    ASSERT_EQ(4, rl::FixedActionValueTable<3>::STRIDE);
+    ASSERT_EQ(4, rl::FixedActionValueTable<4>::STRIDE);
+    ASSERT_EQ(8, rl::FixedActionValueTable<5>::STRIDE);
+    check_fixed_table_matches<1>(update_count);
+    check_fixed_table_matches<2>(update_count);
+    check_fixed_table_matches<3>(update_count);
+    check_fixed_table_matches<4>(update_count);
+    check_fixed_table_matches<5>(update_count);
+}
+
+/**
+ * Tests that a FixedActionValueTable created from an environment masks the same pairs as an
+ * ActionValueTable.
+ */
+TEST(FixedActionValueTable, masked_disallowed_actions) {
+    // Setup
+    rl::GridWorld<2, 3> grid_world(rl::GridWorldBoundsBehaviour::NO_OUT_OF_BOUNDS);
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{1, 2}));
+    rl::FixedActionValueTable<4> fixed(grid_world);
+    rl::ActionValueTable dynamic(grid_world);
+
+    // Test
+    ASSERT_TRUE(fixed.masked());
+    for(const rl::State& s : grid_world.states()) {
+        for(const rl::Action& a : grid_world.actions()) {
+            ASSERT_EQ(dynamic.value(s, a), fixed.value(s, a));
+        }
+        ASSERT_EQ(dynamic.best_action(s), fixed.best_action(s));
+    }
+}
+
+/**
+ * Tests that a mapped table keeps its values and mask when reopened.
+ */
+TEST(ActionValueTable, mapped_table_reopen) {
+    // Setup
+    rl::GridWorld<3, 3> grid_world(rl::GridWorldBoundsBehaviour::NO_OUT_OF_BOUNDS);
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{2, 2}));
+    const std::string path = testing::TempDir() + "rl_mapped_table_reopen";
+    std::remove(path.c_str());
+    rl::ActionValueTable heap_table(grid_world);
+    {
+        rl::ActionValueTable table = rl::ActionValueTable::open_mapped(path, grid_world);
+        ASSERT_TRUE(table.is_mapped());
+        ASSERT_TRUE(table.created());
+        for(const rl::State& s : grid_world.states()) {
+            for(const rl::Action& a : grid_world.actions()) {
+                if(grid_world.is_action_allowed(s, a) and !grid_world.is_end_state(s)) {
+                    double value = s.id() + 0.1 * a.id();
+                    table.set_value(s, a, value);
+                    heap_table.set_value(s, a, value);
+                }
+            }
+        }
+    }
+
+    // Test
+    rl::ActionValueTable reopened = rl::ActionValueTable::open_mapped(path, grid_world);
+    ASSERT_FALSE(reopened.created());
+    ASSERT_TRUE(reopened.masked());
+    for(const rl::State& s : grid_world.states()) {
+        for(const rl::Action& a : grid_world.actions()) {
+            ASSERT_EQ(heap_table.value(s, a), reopened.value(s, a));
+        }
+        ASSERT_EQ(heap_table.best_action(s), reopened.best_action(s));
+    }
+    ASSERT_THROW(rl::ActionValueTable::open_mapped(path, grid_world.state_count(), 5),
+                 std::runtime_error);
+    std::remove(path.c_str());
+}
+
+/**
+ * Tests that the values of a table file opened with huge pages are huge page aligned, and that
+ * the file can't be reopened without huge pages, as its values are at a different offset.
+ */
+TEST(TableStorage, mapped_huge_pages) {
+    // Setup
+    using Storage = rl::impl::TableStorage;
+    const std::string path = testing::TempDir() + "rl_mapped_huge_pages";
+    std::remove(path.c_str());
+    rl::util::MappedFile::Options options;
+    options.huge_pages = true;
+    const rl::ID state_count = 10;
+    const rl::ID column_count = 4;
+
+    // Test
+    {
+        Storage storage(path, Storage::Kind::VALUE_TABLE, state_count, column_count, column_count,
+                        options);
+        ASSERT_EQ(0u, reinterpret_cast<std::uintptr_t>(storage.data()) %
+                      rl::util::MappedFile::HUGE_PAGE_SIZE);
+        storage.data()[storage.size() - 1] = 1.5;
+    }
+    Storage reopened(path, Storage::Kind::VALUE_TABLE, state_count, column_count, column_count,
+                     options);
+    ASSERT_FALSE(reopened.created());
+    ASSERT_EQ(1.5, reopened.data()[reopened.size() - 1]);
+    ASSERT_THROW(Storage(path, Storage::Kind::VALUE_TABLE, state_count, column_count,
+                         column_count, rl::util::MappedFile::Options{}),
+                 std::runtime_error);
+    std::remove(path.c_str());
+}
+
+/**
+ * Tests that sparse tables give the same values and best actions as dense tables, and only
+ * allocate the rows that have been set.
+ */
+TEST(ActionValueTable, sparse_matches_dense) {
+    // Setup
+    rl::util::random::reseed_generator(1);
+    rl::GridWorld<4, 4> grid_world(rl::GridWorldBoundsBehaviour::NO_OUT_OF_BOUNDS);
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{3, 3}));
+    rl::ActionValueTable dense(grid_world);
+    rl::ActionValueTable sparse = rl::ActionValueTable::create_sparse(grid_world);
+    rl::ValueTable dense_values(grid_world.state_count());
+    rl::ValueTable sparse_values = rl::ValueTable::create_sparse(grid_world.state_count());
+    const int update_count = 10;
+    for(int i = 0; i < update_count; i++) {
+        const rl::State& s = grid_world.state(
+                rl::util::random::random_in_range<rl::ID>(0, grid_world.state_count()));
+        const rl::Action& a = grid_world.action(
+                rl::util::random::random_in_range<rl::ID>(0, grid_world.action_count()));
+        double value = rl::util::random::random_in_range<int>(-3, 4);
+        dense.set_value(s, a, value);
+        sparse.set_value(s, a, value);
+        dense_values.set_value(s, value);
+        sparse_values.set_value(s, value);
+    }
+
+    // Test
+    ASSERT_TRUE(sparse.is_sparse());
+    ASSERT_TRUE(sparse.masked());
+    ASSERT_LE(sparse.sparse_row_count(), static_cast<std::size_t>(update_count));
+    for(const rl::State& s : grid_world.states()) {
+        for(const rl::Action& a : grid_world.actions()) {
+            ASSERT_EQ(dense.value(s, a), sparse.value(s, a));
+        }
+        ASSERT_EQ(dense.best_action(s), sparse.best_action(s));
+        ASSERT_EQ(dense_values.value(s), sparse_values.value(s));
+    }
+    // Copies are independent.
+    rl::ActionValueTable copy = sparse;
+    copy.set_value(grid_world.state(0), grid_world.action(0), 100);
+    ASSERT_EQ(dense.value(grid_world.state(0), grid_world.action(0)),
+              sparse.value(grid_world.state(0), grid_world.action(0)));
+}
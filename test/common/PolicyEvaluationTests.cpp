@@ -1,4 +1,5 @@
 #include "PolicyEvaluationTests.h"
+#include "rl/MappedEnvironment.h"
 #include "suttonbarto/Exercise4_1.h"
 #include "suttonbarto/Exercise5_1.h"
 
@@ -139,5 +140,21 @@ void BlackjackSpecificCase::check(ActionBasedEvaluator& evaluator) const {
         allowed_error);
 }
 
+void assert_same_values(const Environment& env, const ValueTable& expected,
+                        const ValueTable& result) {
+    for(const State& s : env.states()) {
+        ASSERT_EQ(expected.value(s), result.value(s));
+    }
+}
+
+void assert_same_values(const Environment& env, const ActionValueTable& expected,
+                        const ActionValueTable& result) {
+    for(const State& s : env.states()) {
+        for(const Action& a : env.actions()) {
+            ASSERT_EQ(expected.value(s, a), result.value(s, a));
+        }
+    }
+}
+
 } // namespace test
 } // namespace rl
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "rl/Environment.h"
 #include "rl/Policy.h"
 #include "rl/DeterministicPolicy.h"
+#include "util/random.h"
 #include "ExamplePolicies.h"
 
 
@@ -137,6 +138,53 @@ public:
     void check(ActionBasedEvaluator& evaluator) const override;
 };
 
+/**
+ * A random walk over a HEIGHT x WIDTH grid world to a single end state. All actions produce a
+ * reward of -1.
+ */
+template<int HEIGHT, int WIDTH>
+class RandomWalkGrid {
+public:
+    explicit RandomWalkGrid(grid::Position end=grid::Position{0, 0}) {
+        grid_world.mark_as_end_state(grid_world.pos_to_state(end));
+        grid_world.set_all_rewards_to(-1.0);
+    }
+
+public:
+    GridWorld<HEIGHT, WIDTH> grid_world{};
+    RandomPolicy policy{};
+};
+
+void assert_same_values(const Environment& env, const ValueTable& expected,
+                        const ValueTable& result);
+void assert_same_values(const Environment& env, const ActionValueTable& expected,
+                        const ActionValueTable& result);
+
+/**
+ * Tests that the values after a number of steps depend only on the seed, not on the number of
+ * threads running the trials.
+ */
+template<typename Evaluator>
+void check_thread_count_reproducible(Evaluator& evaluator) {
+    // Setup
+    RandomWalkGrid<4, 4> walk;
+    auto run_steps = [&](Evaluator& e) {
+        util::random::reseed_generator(1);
+        e.initialize(walk.grid_world, walk.policy);
+        for(int i = 0; i < 20; i++) {
+            e.step();
+        }
+    };
+    run_steps(evaluator);
+    Evaluator threaded_evaluator;
+    threaded_evaluator.set_thread_count(3);
+
+    // Test
+    run_steps(threaded_evaluator);
+    assert_same_values(walk.grid_world, evaluator.value_function(),
+                       threaded_evaluator.value_function());
+}
+
 
 } // namespace rl
 } // namespace test
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <limits>
 #include <stdexcept>
 #include "rl/impl/Environment.h"
 #include "gsl/gsl_randist.h"
@@ -230,6 +232,55 @@ public:
         return ans;
     }
 
+    double action_value(const State& from_state, const Action& action,
+                        const ValueTable& value_function, double discount_rate) const override {
+        Expects(is_action_allowed(from_state, action));
+        LocationParts loc1_parts;
+        LocationParts loc2_parts;
+        int loc1_start = cars_in_loc_1(from_state) + change_in_car_count(action, Location::LOC1);
+        int loc2_start = cars_in_loc_2(from_state) + change_in_car_count(action, Location::LOC2);
+        fill_location_parts(loc1_parts, loc1_start, LOC1_RENTAL_MEAN, LOC1_RETURN_MEAN);
+        fill_location_parts(loc2_parts, loc2_start, LOC2_RENTAL_MEAN, LOC2_RETURN_MEAN);
+        return expected_value(action, loc1_parts, loc2_parts, value_function, discount_rate);
+    }
+
+    /**
+     * The rentals and returns at a location only depend on the number of cars at the location
+     * after the transfer. Many actions share these counts, so the possibilities for each count are
+     * calculated once per state rather than once per action (as transition_list() would).
+     */
+    void action_values(const State& from_state, const ValueTable& value_function,
+                       double discount_rate, std::vector<double>& out) const override {
+        out.assign(action_count(), std::numeric_limits<double>::lowest());
+        // Indexed by the car count at the location after the transfer.
+        std::array<LocationParts, MAX_CAR_COUNT + 1> loc1_parts;
+        std::array<LocationParts, MAX_CAR_COUNT + 1> loc2_parts;
+        std::array<bool, MAX_CAR_COUNT + 1> loc1_filled{};
+        std::array<bool, MAX_CAR_COUNT + 1> loc2_filled{};
+        for(const Action& action : actions()) {
+            if(!is_action_allowed(from_state, action)) {
+                continue;
+            }
+            int loc1_start =
+                    cars_in_loc_1(from_state) + change_in_car_count(action, Location::LOC1);
+            int loc2_start =
+                    cars_in_loc_2(from_state) + change_in_car_count(action, Location::LOC2);
+            if(!loc1_filled[loc1_start]) {
+                fill_location_parts(loc1_parts[loc1_start], loc1_start,
+                                    LOC1_RENTAL_MEAN, LOC1_RETURN_MEAN);
+                loc1_filled[loc1_start] = true;
+            }
+            if(!loc2_filled[loc2_start]) {
+                fill_location_parts(loc2_parts[loc2_start], loc2_start,
+                                    LOC2_RENTAL_MEAN, LOC2_RETURN_MEAN);
+                loc2_filled[loc2_start] = true;
+            }
+            out[action.id()] = expected_value(action, loc1_parts[loc1_start],
+                                              loc2_parts[loc2_start], value_function,
+                                              discount_rate);
+        }
+    }
+
     Response next_state(const State& from_state, const Action& action) const override {
         // If ResponseDistribution used a DistributionList as it's storage type, then this
         // method would be trivial to implement.
@@ -237,6 +288,46 @@ public:
     }
 
 private:
+    // The possibilities for every end-of-day car count at a single location.
+    using LocationParts = std::array<TransitionPart, MAX_CAR_COUNT + 1>;
+
+    void fill_location_parts(LocationParts& parts, int start_count, int rent_mean,
+                             int return_mean) const {
+        for(int end_count = 0; end_count <= MAX_CAR_COUNT; end_count++) {
+            parts[end_count] = possibilities(start_count, end_count, rent_mean, return_mean);
+        }
+    }
+
+    /**
+     * The same calculation as done by transition_list() and the default action_value(), but
+     * without creating the intermediate ResponseDistribution.
+     */
+    double expected_value(const Action& action, const LocationParts& loc1_parts,
+                          const LocationParts& loc2_parts, const ValueTable& value_function,
+                          double discount_rate) const {
+        int transfer_cost =
+                std::abs(change_in_car_count(action, Location::LOC1)) * TRANSFER_COST;
+        double expected_value_sum = 0;
+        double total_probability = 0;
+        for(int loc1_end = 0; loc1_end <= MAX_CAR_COUNT; loc1_end++) {
+            const TransitionPart& t1 = loc1_parts[loc1_end];
+            for(int loc2_end = 0; loc2_end <= MAX_CAR_COUNT; loc2_end++) {
+                const TransitionPart& t2 = loc2_parts[loc2_end];
+                double probability = t1.probability * t2.probability;
+                // Skip the same low probability transitions as transition_list().
+                if(probability < MIN_PROB) {
+                    continue;
+                }
+                double income = t1.revenue + t2.revenue - transfer_cost;
+                double next_state_value = value_function.value(state(loc1_end, loc2_end));
+                expected_value_sum += probability * (income + discount_rate * next_state_value);
+                total_probability += probability;
+            }
+        }
+        Ensures(total_probability != 0);
+        return expected_value_sum / total_probability;
+    }
+
     void init_poisson_cache() {
         for (int mu = 0; mu < MEAN_RANGE; mu++) {
             for (int j = 0; j <= MAX_CAR_COUNT; j++) {
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "rl/impl/ConvergenceStats.h"
+#include "rl/impl/ParallelTrials.h"
+#include "util/random.h"
+
+/**
+ * Tests MinVisitCounter against the minimum of an array of counts, for increments of one and
+ * larger jumps.
+ */
+TEST(MinVisitCounter, matches_min_element) {
+    // Setup
+    rl::util::random::reseed_generator(1);
+    const int key_count = 50;
+    std::vector<long> counts(key_count, 0);
+    rl::impl::MinVisitCounter counter;
+    counter.reset(key_count);
+
+    // Test
+    ASSERT_EQ(0, counter.min());
+    for(int i = 0; i < 5000; i++) {
+        int key = rl::util::random::random_in_range(0, key_count);
+        long added = rl::util::random::random_in_range(0, 4) == 0
+                     ? rl::util::random::random_in_range(2L, 20L) : 1;
+        counter.add_visits(counts[key], counts[key] + added);
+        counts[key] += added;
+        ASSERT_EQ(*std::min_element(counts.begin(), counts.end()), counter.min());
+    }
+}
+
+/**
+ * Tests MaxDeltaTracker against the maximum of an array of deltas, as the deltas rise and fall.
+ * Keys that aren't written keep their delta.
+ */
+TEST(MaxDeltaTracker, matches_max_element) {
+    // Setup
+    rl::util::random::reseed_generator(1);
+    const int key_count = 50;
+    std::vector<double> deltas(key_count, 0.0);
+    rl::impl::MaxDeltaTracker tracker;
+    tracker.reset(key_count);
+
+    // Test
+    ASSERT_EQ(0.0, tracker.max());
+    for(int i = 0; i < 5000; i++) {
+        int key = rl::util::random::random_in_range(0, key_count);
+        // The deltas shrink over time, so the max often falls back to a key written earlier.
+        double delta = rl::util::random::random_in_range(0, 1000) / (1.0 + i);
+        deltas[key] = delta;
+        tracker.set(key, delta);
+        ASSERT_EQ(*std::max_element(deltas.begin(), deltas.end()), tracker.max());
+    }
+}
+
+/**
+ * Tests that merging shards with merge_m2() gives the sum of squared deviations of all the
+ * returns, and that the confidence interval uses the normal quantile.
+ */
+TEST(ConfidenceInterval, merged_variance) {
+    // Setup
+    std::vector<double> returns = {-3, 1.5, 4, 4, -0.25, 7, 2, 2.5, -1};
+    rl::impl::ReturnShard first;
+    rl::impl::ReturnShard second;
+    for(std::size_t i = 0; i < returns.size(); i++) {
+        (i < 4 ? first : second).add(0, returns[i]);
+    }
+    double mean = 0;
+    for(double r : returns) {
+        mean += r / returns.size();
+    }
+    double expected_m2 = 0;
+    for(double r : returns) {
+        expected_m2 += (r - mean) * (r - mean);
+    }
+
+    // Test
+    double value = 0;
+    int visits = 0;
+    double m2 = 0;
+    for(const rl::impl::ReturnShard* shard : {&first, &second}) {
+        rl::impl::merge_m2(*shard, 0, value, visits, m2);
+        rl::impl::merge_returns(*shard, 0, value, visits);
+    }
+    ASSERT_NEAR(mean, value, 1e-12);
+    ASSERT_NEAR(expected_m2, m2, 1e-9);
+    ASSERT_NEAR(1.959964, rl::impl::two_sided_z(0.95), 1e-6);
+    double z = rl::impl::two_sided_z(0.99);
+    ASSERT_NEAR(2.575829, z, 1e-6);
+    ASSERT_NEAR(z * std::sqrt(expected_m2 / 8 / 9),
+                rl::impl::confidence_half_width(m2, visits, z), 1e-9);
+    ASSERT_TRUE(std::isinf(rl::impl::confidence_half_width(0.0, 1, z)));
+}
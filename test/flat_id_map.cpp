@@ -0,0 +1,53 @@
+#include <map>
+
+#include "gtest/gtest.h"
+
+#include "util/FlatIdMap.h"
+#include "util/random.h"
+
+/**
+ * Tests FlatIdMap against std::map over a sequence of inserts and updates that triggers several
+ * rehashes.
+ */
+TEST(FlatIdMap, matches_std_map) {
+    // Setup
+    rl::util::random::reseed_generator(1);
+    const long default_value = -7;
+    rl::util::FlatIdMap<long> map(default_value);
+    std::map<long, long> expected;
+    const int update_count = 5000;
+    const long max_key = 2000;
+
+    // Test
+    ASSERT_EQ(nullptr, map.find(0));
+    ASSERT_EQ(default_value, map.get(0));
+    for(int i = 0; i < update_count; i++) {
+        long key = rl::util::random::random_in_range<long>(0, max_key);
+        long value = rl::util::random::random_in_range<long>(0, 100);
+        map[key] += value;
+        auto inserted = expected.emplace(key, default_value);
+        inserted.first->second += value;
+    }
+    ASSERT_EQ(expected.size(), map.size());
+    // The load factor is at most one half.
+    ASSERT_LE(2 * map.size(), map.capacity());
+    for(long key = 0; key < max_key; key++) {
+        auto it = expected.find(key);
+        if(it == expected.end()) {
+            ASSERT_EQ(nullptr, map.find(key));
+            ASSERT_EQ(default_value, map.get(key));
+        } else {
+            ASSERT_NE(nullptr, map.find(key));
+            ASSERT_EQ(it->second, map.get(key));
+        }
+    }
+    long entry_count = 0;
+    map.for_each([&](long key, long value) {
+        ASSERT_EQ(expected.at(key), value);
+        entry_count++;
+    });
+    ASSERT_EQ(static_cast<long>(expected.size()), entry_count);
+    map.clear();
+    ASSERT_TRUE(map.empty());
+    ASSERT_EQ(nullptr, map.find(0));
+}
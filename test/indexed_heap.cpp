@@ -0,0 +1,37 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "util/IndexedHeap.h"
+#include "util/random.h"
+
+/**
+ * Tests IndexedMaxHeap against a scan for the largest priority (smallest key on ties), over
+ * random increases and decreases.
+ */
+TEST(IndexedMaxHeap, matches_max_scan) {
+    // Setup
+    rl::util::random::reseed_generator(1);
+    const long key_count = 40;
+    std::vector<double> priorities(key_count, 1.0);
+    rl::util::IndexedMaxHeap heap;
+    heap.reset(key_count, 1.0);
+
+    // Test
+    ASSERT_EQ(0, heap.top());
+    for(int i = 0; i < 5000; i++) {
+        long key = rl::util::random::random_in_range(0L, key_count);
+        // Few distinct priorities, so that ties are common.
+        double priority = rl::util::random::random_in_range(0, 8);
+        heap.update(key, priority);
+        priorities[key] = priority;
+        long expected = 0;
+        for(long k = 1; k < key_count; k++) {
+            if(priorities[k] > priorities[expected]) {
+                expected = k;
+            }
+        }
+        ASSERT_EQ(expected, heap.top());
+        ASSERT_EQ(priorities[expected], heap.top_priority());
+    }
+}
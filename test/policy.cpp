@@ -1,6 +1,16 @@
+#include <string>
+#include <vector>
+
 #include "gtest/gtest.h"
 
+#include "rl/BlendedPolicy.h"
+#include "rl/DeterministicPolicy.h"
+#include "rl/FrozenStochasticPolicy.h"
+#include "rl/GridWorld.h"
+#include "rl/IterativePolicyEvaluator.h"
 #include "rl/Policy.h"
+#include "rl/RandomPolicy.h"
+#include "rl/StochasticPolicy.h"
 
 /**
  * Tests that 0 is returned by an action distribution when querying for an action that isn't listed
@@ -20,4 +30,245 @@ TEST(ActionDistribution, query_for_zero_weight_action) {
 
     // Test
     ASSERT_NO_THROW(action_dist.weight(a1));
-}
\ No newline at end of file
+}
+
+/**
+ * Tests that an ActionDistribution holding more actions than fit inline keeps all of the actions
+ * and weights, including through copies and clear().
+ */
+TEST(ActionDistribution, overflow_inline_storage) {
+    // Setup
+    const int action_count = rl::Policy::ActionDistribution::INLINE_CAPACITY + 3;
+    std::vector<rl::Action> actions;
+    for(int i = 0; i < action_count; i++) {
+        actions.emplace_back(i, "Action " + std::to_string(i));
+    }
+    rl::Policy::ActionDistribution action_dist;
+    rl::Weight total_weight = 0;
+    for(const rl::Action& a : actions) {
+        rl::Weight weight = a.id() + 1;
+        action_dist.add_action(a, weight);
+        total_weight += weight;
+    }
+
+    // Test
+    rl::Policy::ActionDistribution copy = action_dist;
+    rl::Policy::ActionDistributionView view = copy.view();
+    ASSERT_EQ(action_count, view.action_count());
+    ASSERT_EQ(total_weight, view.total_weight());
+    for(const rl::Action& a : actions) {
+        ASSERT_EQ(a.id() + 1, view.weight(a));
+        ASSERT_DOUBLE_EQ((a.id() + 1) / total_weight, copy.probability(a));
+    }
+    action_dist.clear();
+    ASSERT_TRUE(action_dist.empty());
+    ASSERT_EQ(0, action_dist.weight(actions.front()));
+    action_dist.add_action(actions.back());
+    ASSERT_EQ(&actions.back(), &action_dist.any());
+}
+
+/**
+ * Tests that a DenseDeterministicPolicy created from a StochasticPolicy takes the highest weighted
+ * action for each state, and has no actions for end states.
+ */
+TEST(DenseDeterministicPolicy, create_from_stochastic_policy) {
+    // Setup
+    rl::GridWorld<3, 3> grid_world;
+    const rl::State& end_state = grid_world.pos_to_state(grid::Position{2, 2});
+    grid_world.mark_as_end_state(end_state);
+    const rl::Action& up = grid_world.dir_to_action(grid::Direction::UP);
+    const rl::Action& right = grid_world.dir_to_action(grid::Direction::RIGHT);
+    rl::StochasticPolicy stochastic_policy(grid_world.state_count());
+    for(const rl::State& s : grid_world.states()) {
+        if(grid_world.is_end_state(s)) {
+            continue;
+        }
+        stochastic_policy.add_action_for_state(s, up, 1.0);
+        stochastic_policy.add_action_for_state(s, right, 2.0);
+    }
+
+    // Test
+    rl::DenseDeterministicPolicy policy =
+            rl::DenseDeterministicPolicy::create_from(grid_world, stochastic_policy);
+    for(const rl::State& s : grid_world.states()) {
+        if(grid_world.is_end_state(s)) {
+            ASSERT_EQ(rl::DenseDeterministicPolicy::NO_ACTION, policy.state_to_action()[s.id()]);
+            ASSERT_TRUE(policy.possible_actions(grid_world, s).empty());
+        } else {
+            ASSERT_EQ(right, policy.next_action(grid_world, s));
+            ASSERT_EQ(1, policy.possible_actions(grid_world, s).action_count());
+        }
+    }
+}
+
+/**
+ * Tests that evaluating a DenseDeterministicPolicy gives the same values as evaluating the same
+ * policy held as a StochasticPolicy.
+ */
+TEST(DenseDeterministicPolicy, evaluation_matches_stochastic_policy) {
+    // Setup
+    rl::GridWorld<4, 4> grid_world;
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{3, 3}));
+    grid_world.set_all_rewards_to(-1.0);
+    const rl::Action& down = grid_world.dir_to_action(grid::Direction::DOWN);
+    const rl::Action& right = grid_world.dir_to_action(grid::Direction::RIGHT);
+    std::vector<rl::ID> state_to_action(grid_world.state_count());
+    for(const rl::State& s : grid_world.states()) {
+        grid::Position pos = grid_world.state_to_pos(s);
+        state_to_action[s.id()] = pos.y < 3 ? down.id() : right.id();
+    }
+    state_to_action[grid_world.pos_to_state(grid::Position{3, 3}).id()] =
+            rl::DenseDeterministicPolicy::NO_ACTION;
+    rl::DenseDeterministicPolicy policy(grid_world.state_count());
+    policy.set_actions(state_to_action);
+    rl::StochasticPolicy stochastic_policy = rl::StochasticPolicy::create_from(grid_world, policy);
+    rl::IterativePolicyEvaluator evaluator;
+    rl::ValueTable expected = rl::evaluate(evaluator, grid_world, stochastic_policy);
+
+    // Test
+    const rl::ValueTable& result = rl::evaluate(evaluator, grid_world, policy);
+    for(const rl::State& s : grid_world.states()) {
+        ASSERT_EQ(expected.value(s), result.value(s));
+    }
+}
+
+/**
+ * Tests the probabilities of a 3-way blend, and that invalidate() picks up a change to a component
+ * policy.
+ */
+TEST(BlendedPolicy, n_way_blend_and_invalidate) {
+    // Setup
+    rl::GridWorld<2, 2> grid_world;
+    const rl::State& s = grid_world.pos_to_state(grid::Position{0, 0});
+    const rl::Action& up = grid_world.dir_to_action(grid::Direction::UP);
+    const rl::Action& down = grid_world.dir_to_action(grid::Direction::DOWN);
+    const rl::Action& right = grid_world.dir_to_action(grid::Direction::RIGHT);
+    rl::StochasticPolicy up_policy(grid_world.state_count());
+    up_policy.add_action_for_state(s, up, 1.0);
+    rl::StochasticPolicy down_policy(grid_world.state_count());
+    down_policy.add_action_for_state(s, down, 1.0);
+    rl::RandomPolicy random_policy;
+    // Weights are normalized: 0.5, 0.25 and 0.25.
+    rl::BlendedPolicy policy({{&up_policy, 2.0}, {&down_policy, 1.0}, {&random_policy, 1.0}});
+    const int action_count = grid_world.action_count();
+
+    // Test
+    ASSERT_DOUBLE_EQ(0.5 + 0.25 / action_count, policy.probability(grid_world, s, up));
+    ASSERT_DOUBLE_EQ(0.25 + 0.25 / action_count, policy.probability(grid_world, s, down));
+    ASSERT_DOUBLE_EQ(0.25 / action_count, policy.probability(grid_world, s, right));
+    ASSERT_DOUBLE_EQ(policy.probability(grid_world, s, up),
+                     policy.possible_actions(grid_world, s).probability(up));
+    // Change a component. The cached distribution is used until invalidated.
+    down_policy.clear_actions_for_state(s);
+    down_policy.add_action_for_state(s, right, 1.0);
+    ASSERT_DOUBLE_EQ(0.25 / action_count, policy.probability(grid_world, s, right));
+    policy.invalidate();
+    ASSERT_DOUBLE_EQ(0.25 + 0.25 / action_count, policy.probability(grid_world, s, right));
+    ASSERT_DOUBLE_EQ(0.25 / action_count, policy.probability(grid_world, s, down));
+}
+
+/**
+ * Tests that a view of a state's distribution survives the queries of other states, which add
+ * cache rows, and that dropped rows are refilled.
+ */
+TEST(BlendedPolicy, lazy_rows) {
+    // Setup
+    rl::GridWorld<4, 4> grid_world;
+    const rl::State& first = grid_world.pos_to_state(grid::Position{0, 0});
+    const rl::Action& up = grid_world.dir_to_action(grid::Direction::UP);
+    rl::StochasticPolicy up_policy(grid_world.state_count());
+    for(const rl::State& s : grid_world.states()) {
+        up_policy.add_action_for_state(s, up, 1.0);
+    }
+    rl::RandomPolicy random_policy;
+    rl::BlendedPolicy policy(&up_policy, &random_policy, 0.5);
+    const double up_probability = 0.5 + 0.5 / grid_world.action_count();
+    rl::Policy::ActionDistribution scratch;
+
+    // Test
+    rl::Policy::ActionDistributionView view =
+            policy.action_distribution(grid_world, first, scratch);
+    for(const rl::State& s : grid_world.states()) {
+        ASSERT_DOUBLE_EQ(up_probability, policy.probability(grid_world, s, up));
+    }
+    ASSERT_DOUBLE_EQ(up_probability, view.probability(up));
+    // Every state has been queried, but only prepare() marks the cache as complete.
+    ASSERT_FALSE(policy.is_prepared(grid_world));
+    policy.prepare(grid_world);
+    ASSERT_TRUE(policy.is_prepared(grid_world));
+    // Dropped rows are refilled from the changed component.
+    up_policy.clear_actions_for_state(first);
+    up_policy.add_action_for_state(first, grid_world.dir_to_action(grid::Direction::DOWN), 1.0);
+    policy.invalidate(first);
+    ASSERT_FALSE(policy.is_prepared(grid_world));
+    ASSERT_DOUBLE_EQ(0.5 / grid_world.action_count(), policy.probability(grid_world, first, up));
+    const rl::State& second = grid_world.pos_to_state(grid::Position{0, 1});
+    ASSERT_DOUBLE_EQ(up_probability, policy.probability(grid_world, second, up));
+    policy.invalidate();
+    for(int i = 0; i < 3; i++) {
+        for(const rl::State& s : grid_world.states()) {
+            double expected = s == first ? 0.5 / grid_world.action_count() : up_probability;
+            ASSERT_DOUBLE_EQ(expected, policy.probability(grid_world, s, up));
+        }
+        policy.invalidate();
+    }
+}
+
+/**
+ * Tests that a FrozenStochasticPolicy keeps the probabilities of the policy it was created from,
+ * and that its alias table sampling follows them.
+ */
+TEST(FrozenStochasticPolicy, create_from_policy) {
+    // Setup
+    rl::util::random::reseed_generator(1);
+    rl::GridWorld<2, 2> grid_world;
+    const rl::State& end_state = grid_world.pos_to_state(grid::Position{1, 1});
+    grid_world.mark_as_end_state(end_state);
+    rl::StochasticPolicy stochastic_policy(grid_world.state_count());
+    for(const rl::State& s : grid_world.states()) {
+        if(grid_world.is_end_state(s)) {
+            continue;
+        }
+        for(const rl::Action& a : grid_world.actions()) {
+            stochastic_policy.add_action_for_state(s, a, a.id() + 1);
+        }
+    }
+    const int sample_count = 40000;
+    const double allowed_error = 0.01;
+
+    // Test
+    rl::FrozenStochasticPolicy policy =
+            rl::FrozenStochasticPolicy::create_from(grid_world, stochastic_policy);
+    ASSERT_TRUE(policy.possible_actions(grid_world, end_state).empty());
+    const rl::State& s = grid_world.pos_to_state(grid::Position{0, 0});
+    std::vector<int> counts(grid_world.action_count(), 0);
+    for(int i = 0; i < sample_count; i++) {
+        counts[policy.next_action(grid_world, s).id()]++;
+    }
+    for(const rl::Action& a : grid_world.actions()) {
+        double expected = stochastic_policy.possible_actions(grid_world, s).probability(a);
+        ASSERT_DOUBLE_EQ(expected, policy.probability(s, a));
+        ASSERT_NEAR(expected, static_cast<double>(counts[a.id()]) / sample_count, allowed_error);
+    }
+}
+
+/**
+ * Tests that the greedy FrozenStochasticPolicy has the best action of each state.
+ */
+TEST(FrozenStochasticPolicy, create_greedy_from_action_values) {
+    // Setup
+    rl::GridWorld<2, 2> grid_world;
+    rl::ActionValueTable value_function(grid_world.state_count(), grid_world.action_count());
+    const rl::Action& left = grid_world.dir_to_action(grid::Direction::LEFT);
+    for(const rl::State& s : grid_world.states()) {
+        value_function.set_value(s, left, 1.0);
+    }
+
+    // Test
+    rl::FrozenStochasticPolicy policy =
+            rl::FrozenStochasticPolicy::create_from(grid_world, value_function);
+    for(const rl::State& s : grid_world.states()) {
+        ASSERT_EQ(left, policy.next_action(grid_world, s));
+        ASSERT_EQ(1.0, policy.probability(s, left));
+    }
+}
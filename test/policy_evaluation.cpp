@@ -1,11 +1,25 @@
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
 #include <rl/GradientMCLinear.h>
 #include <suttonbarto/RandomWalk.h>
 #include "gtest/gtest.h"
 
+#include "rl/BlendedPolicy.h"
+#include "rl/DeterministicPolicy.h"
 #include "rl/Environment.h"
+#include "rl/GridWorld.h"
 #include "rl/Policy.h"
 #include "common/PolicyEvaluationTests.h"
 #include "rl/IterativePolicyEvaluator.h"
+#include "rl/MultigridPolicyEvaluator.h"
+#include "rl/RandomPolicy.h"
+#include "rl/ShardedPolicyEvaluator.h"
+#include "rl/StochasticPolicy.h"
 #include "rl/FirstVisitMCValuePredictor.h"
 #include "rl/FirstVisitMCActionValuePredictor.h"
 #include "rl/MCEvaluator3.h"
@@ -43,6 +57,346 @@ TEST_F(IterativePolicyEvaluator, broken_policy) {
     test_case.check(evaluator);
 }
 
+TEST_F(IterativePolicyEvaluator, certified_error_continuous_task) {
+    evaluator.set_stopping_mode(rl::IterativePolicyEvaluator::StoppingMode::CERTIFIED_ERROR);
+    rl::test::ContinuousTaskTest test_case;
+    test_case.check(evaluator);
+}
+
+TEST_F(IterativePolicyEvaluator, certified_error_broken_policy) {
+    evaluator.set_stopping_mode(rl::IterativePolicyEvaluator::StoppingMode::CERTIFIED_ERROR);
+    rl::test::BrokenPolicyTest test_case;
+    test_case.check(evaluator);
+}
+
+/**
+ * The certified error should bound the actual error, and it should be reached in fewer sweeps than
+ * needed by the delta criteria to be reasonably sure of the same accuracy.
+ */
+TEST_F(IterativePolicyEvaluator, certified_error_bounds) {
+    // Setup
+    rl::test::RandomWalkGrid<8, 8> walk;
+    const double discount_rate = 0.9;
+    const double max_error = 1e-3;
+    rl::IterativePolicyEvaluator exact_evaluator;
+    exact_evaluator.set_discount_rate(discount_rate);
+    exact_evaluator.set_delta_threshold(1e-12);
+    rl::ValueTable expected = rl::evaluate(exact_evaluator, walk.grid_world, walk.policy);
+    // The delta criteria only guarantees delta * discount / (1 - discount).
+    rl::IterativePolicyEvaluator delta_evaluator;
+    delta_evaluator.set_discount_rate(discount_rate);
+    delta_evaluator.set_delta_threshold(max_error * (1 - discount_rate) / discount_rate);
+    rl::evaluate(delta_evaluator, walk.grid_world, walk.policy);
+    evaluator.set_discount_rate(discount_rate);
+    evaluator.set_delta_threshold(max_error);
+    evaluator.set_stopping_mode(rl::IterativePolicyEvaluator::StoppingMode::CERTIFIED_ERROR);
+
+    // Test
+    rl::ValueTable result = rl::evaluate(evaluator, walk.grid_world, walk.policy);
+    ASSERT_LT(evaluator.certified_error(), max_error);
+    for(const rl::State& s : walk.grid_world.states()) {
+        ASSERT_NEAR(expected.value(s), result.value(s), evaluator.certified_error());
+    }
+    ASSERT_LT(evaluator.steps_done(), delta_evaluator.steps_done());
+}
+
+/**
+ * Tests that the dense state->action array gives the same values as the policy's distributions.
+ * In a single row grid, UP and DOWN both leave the agent in place, so a state that takes either
+ * with equal probability has the same value as a state that always takes UP. Only the policy that
+ * always takes UP has a single action for every state, and so uses the dense array. A change to
+ * a DenseDeterministicPolicy between steps must be picked up.
+ */
+TEST_F(IterativePolicyEvaluator, dense_path_matches_distribution_path) {
+    // Setup
+    const int width = 6;
+    const double discount_rate = 0.9;
+    rl::GridWorld<1, width> grid_world{rl::GridWorldBoundsBehaviour::TRANSITION_TO_CURRENT};
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{0, 0}));
+    grid_world.set_all_rewards_to(-1.0);
+    const rl::Action& up = grid_world.dir_to_action(grid::Direction::UP);
+    const rl::Action& down = grid_world.dir_to_action(grid::Direction::DOWN);
+    const rl::Action& left = grid_world.dir_to_action(grid::Direction::LEFT);
+    const rl::State& stuck = grid_world.pos_to_state(grid::Position{0, width - 1});
+    rl::DenseDeterministicPolicy dense_policy(grid_world.state_count());
+    rl::StochasticPolicy stochastic_policy(grid_world.state_count());
+    for(const rl::State& s : grid_world.states()) {
+        if(grid_world.is_end_state(s)) {
+            continue;
+        }
+        if(s == stuck) {
+            dense_policy.set_action_for_state(s, up);
+            stochastic_policy.add_action_for_state(s, up, 1);
+            stochastic_policy.add_action_for_state(s, down, 1);
+        } else {
+            dense_policy.set_action_for_state(s, left);
+            stochastic_policy.add_action_for_state(s, left, 1);
+        }
+    }
+    evaluator.set_discount_rate(discount_rate);
+    rl::IterativePolicyEvaluator distribution_evaluator;
+    distribution_evaluator.set_discount_rate(discount_rate);
+    const double max_error = 1e-4;
+
+    // Test
+    // 1. Both paths give the same values.
+    const rl::ValueTable& expected =
+            rl::evaluate(distribution_evaluator, grid_world, stochastic_policy);
+    const rl::ValueTable& result = rl::evaluate(evaluator, grid_world, dense_policy);
+    for(const rl::State& s : grid_world.states()) {
+        ASSERT_EQ(expected.value(s), result.value(s));
+    }
+    ASSERT_NEAR(-1 / (1 - discount_rate), result.value(stuck), max_error);
+    // 2. The changed action is used without a new initialize().
+    dense_policy.set_action_for_state(stuck, left);
+    evaluator.step();
+    evaluator.run();
+    const double to_end = -(1 - std::pow(discount_rate, width - 1)) / (1 - discount_rate);
+    ASSERT_NEAR(to_end, evaluator.value_function().value(stuck), max_error);
+}
+
+/**
+ * A grid world that counts its one-step backups, including those of the default bulk backup.
+ */
+template<int HEIGHT, int WIDTH>
+class BackupCountingGridWorld : public rl::GridWorld<HEIGHT, WIDTH> {
+public:
+    using rl::GridWorld<HEIGHT, WIDTH>::GridWorld;
+
+    double action_value(const rl::State& from_state, const rl::Action& action,
+                        const rl::ValueTable& value_function,
+                        double discount_rate) const override {
+        backup_count++;
+        return rl::GridWorld<HEIGHT, WIDTH>::action_value(from_state, action, value_function,
+                                                          discount_rate);
+    }
+
+    mutable long backup_count = 0;
+};
+
+/**
+ * The bulk backup covers every allowed action, so a policy that weights only a few of them must
+ * back up just its own actions. In a single row grid, all four actions are allowed everywhere.
+ */
+TEST_F(IterativePolicyEvaluator, backs_up_only_policy_actions) {
+    // Setup
+    const int width = 4;
+    BackupCountingGridWorld<1, width> grid_world{
+            rl::GridWorldBoundsBehaviour::TRANSITION_TO_CURRENT};
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{0, 0}));
+    grid_world.set_all_rewards_to(-1.0);
+    rl::StochasticPolicy two_action_policy(grid_world.state_count());
+    rl::StochasticPolicy three_action_policy(grid_world.state_count());
+    for(const rl::State& s : grid_world.states()) {
+        if(grid_world.is_end_state(s)) {
+            continue;
+        }
+        for(grid::Direction d : {grid::Direction::LEFT, grid::Direction::UP}) {
+            two_action_policy.add_action_for_state(s, grid_world.dir_to_action(d), 1);
+            three_action_policy.add_action_for_state(s, grid_world.dir_to_action(d), 1);
+        }
+        three_action_policy.add_action_for_state(
+                s, grid_world.dir_to_action(grid::Direction::DOWN), 1);
+    }
+    const long non_end_state_count = width - 1;
+
+    // Test
+    // 1. Two of the four allowed actions: one backup per policy action.
+    evaluator.initialize(grid_world, two_action_policy);
+    evaluator.step();
+    ASSERT_EQ(2 * non_end_state_count, grid_world.backup_count);
+    // 2. Three of the four: the bulk backup, which covers all four.
+    grid_world.backup_count = 0;
+    evaluator.initialize(grid_world, three_action_policy);
+    evaluator.step();
+    ASSERT_EQ(4 * non_end_state_count, grid_world.backup_count);
+}
+
+/**
+ * Tests that an evaluator with a mapped value table gives the same values as one without, and
+ * that evaluating again with the same file resumes from the stored values.
+ */
+TEST_F(IterativePolicyEvaluator, mapped_value_table_resume) {
+    // Setup
+    rl::test::RandomWalkGrid<8, 8> walk;
+    const std::string path = testing::TempDir() + "rl_mapped_value_table_resume";
+    std::remove(path.c_str());
+    rl::IterativePolicyEvaluator heap_evaluator;
+    rl::ValueTable expected = rl::evaluate(heap_evaluator, walk.grid_world, walk.policy);
+    evaluator.set_value_table_file(path);
+
+    // Test
+    rl::ValueTable result = rl::evaluate(evaluator, walk.grid_world, walk.policy);
+    ASSERT_TRUE(evaluator.value_function().is_mapped());
+    ASSERT_TRUE(evaluator.value_function().created());
+    for(const rl::State& s : walk.grid_world.states()) {
+        ASSERT_EQ(expected.value(s), result.value(s));
+    }
+    // A copy is on the heap.
+    ASSERT_FALSE(result.is_mapped());
+    // Resume: the stored values have already converged.
+    rl::IterativePolicyEvaluator resumed_evaluator;
+    resumed_evaluator.set_value_table_file(path);
+    rl::evaluate(resumed_evaluator, walk.grid_world, walk.policy);
+    ASSERT_FALSE(resumed_evaluator.value_function().created());
+    ASSERT_EQ(1, resumed_evaluator.steps_done());
+    // A file holding a different table is rejected.
+    rl::GridWorld<4, 4> small_grid_world;
+    ASSERT_THROW(rl::ValueTable::open_mapped(path, small_grid_world.state_count()),
+                 std::runtime_error);
+    std::remove(path.c_str());
+}
+
+//----------------------------------------------------------------------------------------------
+// Multigrid policy evaluator.
+//----------------------------------------------------------------------------------------------
+class MultigridPolicyEvaluator : public ::testing::Test {
+protected:
+    rl::MultigridPolicyEvaluator evaluator;
+};
+
+TEST_F(MultigridPolicyEvaluator, grid_world1) {
+    rl::test::GridWorldTest1 test_case;
+    test_case.check(evaluator);
+}
+
+TEST_F(MultigridPolicyEvaluator, sutton_barto_exercise_4_1) {
+    rl::test::SuttonBartoExercise4_1Test test_case;
+    test_case.check(evaluator);
+}
+
+TEST_F(MultigridPolicyEvaluator, continuous_task) {
+    rl::test::ContinuousTaskTest test_case;
+    test_case.check(evaluator);
+}
+
+TEST_F(MultigridPolicyEvaluator, broken_policy) {
+    rl::test::BrokenPolicyTest test_case;
+    test_case.check(evaluator);
+}
+
+/**
+ * A random walk over a 16x16 grid to a corner end state. Value information needs many sweeps to
+ * cross the grid, which is the case the coarse levels are meant to speed up.
+ */
+TEST_F(MultigridPolicyEvaluator, grid_hierarchy) {
+    // Setup
+    const int height = 16;
+    const int width = 16;
+    rl::test::RandomWalkGrid<height, width> walk;
+    const double threshold = 1e-4;
+    rl::IterativePolicyEvaluator iterative_evaluator;
+    iterative_evaluator.set_delta_threshold(threshold);
+    rl::ValueTable expected = rl::evaluate(iterative_evaluator, walk.grid_world, walk.policy);
+    evaluator.set_delta_threshold(threshold);
+
+    // Test
+    evaluator.set_grid_hierarchy(height, width);
+    rl::ValueTable result = rl::evaluate(evaluator, walk.grid_world, walk.policy);
+    // The values are in the thousands, and both evaluators stop on the same small delta.
+    const double max_error = 0.5;
+    for(const rl::State& s : walk.grid_world.states()) {
+        ASSERT_NEAR(expected.value(s), result.value(s), max_error);
+    }
+    ASSERT_LT(evaluator.fine_sweeps_done(), iterative_evaluator.steps_done() / 10);
+
+    // The default hierarchy (runs of consecutive states) should also converge.
+    evaluator.clear_levels();
+    result = rl::evaluate(evaluator, walk.grid_world, walk.policy);
+    for(const rl::State& s : walk.grid_world.states()) {
+        ASSERT_NEAR(expected.value(s), result.value(s), max_error);
+    }
+}
+
+//----------------------------------------------------------------------------------------------
+// Sharded (multi-process) policy evaluator.
+//----------------------------------------------------------------------------------------------
+class ShardedPolicyEvaluator : public ::testing::Test {
+protected:
+    static const int PROCESS_COUNT = 3;
+    rl::ShardedPolicyEvaluator evaluator{PROCESS_COUNT};
+};
+
+TEST_F(ShardedPolicyEvaluator, grid_world1) {
+    rl::test::GridWorldTest1 test_case;
+    test_case.check(evaluator);
+}
+
+TEST_F(ShardedPolicyEvaluator, sutton_barto_exercise_4_1) {
+    rl::test::SuttonBartoExercise4_1Test test_case;
+    test_case.check(evaluator);
+}
+
+TEST_F(ShardedPolicyEvaluator, continuous_task) {
+    rl::test::ContinuousTaskTest test_case;
+    test_case.check(evaluator);
+}
+
+TEST_F(ShardedPolicyEvaluator, broken_policy) {
+    rl::test::BrokenPolicyTest test_case;
+    test_case.check(evaluator);
+}
+
+/**
+ * A grid with a random policy has transitions across every shard boundary.
+ */
+TEST_F(ShardedPolicyEvaluator, matches_iterative_evaluator) {
+    // Setup
+    rl::test::RandomWalkGrid<8, 8> walk{grid::Position{7, 7}};
+    rl::IterativePolicyEvaluator iterative_evaluator;
+    rl::ValueTable expected = rl::evaluate(iterative_evaluator, walk.grid_world, walk.policy);
+    const double max_error = 0.01;
+
+    // Test
+    rl::ValueTable result = rl::evaluate(evaluator, walk.grid_world, walk.policy);
+    for(const rl::State& s : walk.grid_world.states()) {
+        ASSERT_NEAR(expected.value(s), result.value(s), max_error);
+    }
+}
+
+/**
+ * A random policy whose process exits when asked about the first state.
+ */
+class ExitingPolicy : public rl::RandomPolicy {
+public:
+    ActionDistribution
+    possible_actions(const rl::Environment& e, const rl::State& from_state) const override {
+        exit_if_first(from_state);
+        return rl::RandomPolicy::possible_actions(e, from_state);
+    }
+
+    ActionDistributionView action_distribution(const rl::Environment& e,
+                                               const rl::State& from_state,
+                                               ActionDistribution& scratch) const override {
+        exit_if_first(from_state);
+        return rl::RandomPolicy::action_distribution(e, from_state, scratch);
+    }
+
+private:
+    static void exit_if_first(const rl::State& s) {
+        if(s.id() == 0) {
+            _exit(3);
+        }
+    }
+};
+
+/**
+ * A worker that dies must make step() throw, rather than leave it waiting for the worker forever.
+ */
+TEST_F(ShardedPolicyEvaluator, dead_worker) {
+    // Setup
+    rl::test::RandomWalkGrid<4, 4> walk{grid::Position{3, 3}};
+    ExitingPolicy policy;
+    evaluator.initialize(walk.grid_world, policy);
+
+    // Test
+    // Only the worker owning state 0 dies; the others are killed.
+    ASSERT_THROW(evaluator.step(), std::runtime_error);
+    // The evaluator can be reused.
+    evaluator.initialize(walk.grid_world, walk.policy);
+    ASSERT_NO_THROW(evaluator.step());
+}
+
 //----------------------------------------------------------------------------------------------
 // First-visit Monte Carlo state value function evaluator.
 //----------------------------------------------------------------------------------------------
@@ -67,6 +421,35 @@ TEST_F(FirstVisitMCValuePredictor, sutton_barto_exercise_4_1_LONG_RUNNING) {
     test_case.check(evaluator);
 }
 
+TEST_F(FirstVisitMCValuePredictor, thread_count_reproducible) {
+    rl::test::check_thread_count_reproducible(evaluator);
+}
+
+/**
+ * A BlendedPolicy fills its cache from its const methods, so with several trial threads every
+ * step must prepare it before the trials. A single thread leaves it to fill lazily.
+ */
+TEST_F(FirstVisitMCValuePredictor, threads_prepare_policy) {
+    // Setup
+    rl::test::RandomWalkGrid<4, 4> walk;
+    rl::BlendedPolicy policy(&walk.policy, &walk.policy, 0.5);
+    rl::FirstVisitMCValuePredictor threaded_evaluator;
+    threaded_evaluator.set_thread_count(3);
+
+    // Test
+    evaluator.initialize(walk.grid_world, policy);
+    evaluator.step();
+    ASSERT_FALSE(policy.is_prepared(walk.grid_world));
+    threaded_evaluator.initialize(walk.grid_world, policy);
+    threaded_evaluator.step();
+    ASSERT_TRUE(policy.is_prepared(walk.grid_world));
+    // A changed component policy invalidates the cache, and the next step prepares it again.
+    policy.invalidate();
+    ASSERT_FALSE(policy.is_prepared(walk.grid_world));
+    threaded_evaluator.step();
+    ASSERT_TRUE(policy.is_prepared(walk.grid_world));
+}
+
 //----------------------------------------------------------------------------------------------
 // First-visit Monte Carlo state value function evaluator.
 //----------------------------------------------------------------------------------------------
@@ -83,6 +466,62 @@ TEST_F(FirstVisitMCActionValuePredictor, grid_world1) {
     test_case.check(evaluator);
 }
 
+TEST_F(FirstVisitMCActionValuePredictor, grid_world1_pair_retirement) {
+    // Setup
+    rl::test::GridWorldTest1 test_case;
+    evaluator.set_pair_retirement(true, 5);
+    // Test
+    test_case.check(evaluator);
+    ASSERT_GT(evaluator.retired_pair_count(), 0);
+}
+
+/**
+ * The environment and policy are deterministic, so every return has zero variance and the
+ * confidence interval criteria are met once every pair has MIN_CONFIDENCE_INTERVAL_VISIT returns.
+ */
+TEST_F(FirstVisitMCActionValuePredictor, grid_world1_confidence_interval) {
+    // Setup
+    rl::test::GridWorldTest1 test_case;
+    evaluator.set_confidence_interval(0.99, 1e-3);
+    // Test
+    test_case.check(evaluator);
+    ASSERT_LE(evaluator.steps_done(),
+              rl::FirstVisitMCActionValuePredictor::MIN_CONFIDENCE_INTERVAL_VISIT);
+}
+
+/**
+ * A policy that always moves right, so that it is stuck at the right edge of the grid. With
+ * trial limits, the evaluation finishes and the stuck pairs have returns truncated at the horizon.
+ * The horizon counts from the start of a trial, so a pair visited later in a trial gets a return
+ * of a few steps less.
+ */
+TEST_F(FirstVisitMCActionValuePredictor, looping_policy_trial_limits) {
+    // Setup
+    rl::GridWorld<1, 3> grid_world{rl::GridWorldBoundsBehaviour::TRANSITION_TO_CURRENT};
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{0, 0}));
+    grid_world.set_all_rewards_to(-1.0);
+    rl::DeterministicLambdaPolicy right_policy(
+            [](const rl::Environment& env, const rl::State&) -> const rl::Action& {
+                return env.action(grid::Direction::RIGHT);
+            });
+    const long horizon = 50;
+    evaluator.set_trial_limits(rl::TrialLimits{horizon, true});
+    const rl::State& middle = grid_world.pos_to_state(grid::Position{0, 1});
+    const rl::State& right = grid_world.pos_to_state(grid::Position{0, 2});
+
+    // Test
+    evaluator.initialize(grid_world, right_policy);
+    evaluator.run();
+    ASSERT_GT(evaluator.truncated_trial_count(), 0);
+    const rl::ActionValueTable& q = evaluator.value_function();
+    ASSERT_EQ(-1.0, q.value(middle, grid_world.action(grid::Direction::LEFT)));
+    const double max_error = 2;
+    ASSERT_NEAR(-horizon, q.value(middle, grid_world.action(grid::Direction::RIGHT)), max_error);
+    ASSERT_NEAR(-horizon, q.value(middle, grid_world.action(grid::Direction::UP)), max_error);
+    ASSERT_NEAR(-horizon, q.value(right, grid_world.action(grid::Direction::LEFT)), max_error);
+    ASSERT_NEAR(-horizon, q.value(right, grid_world.action(grid::Direction::RIGHT)), max_error);
+}
+
 TEST_F(FirstVisitMCActionValuePredictor,
         blackjack_specific_case1_LONG_RUNNING) {
     // Setup
@@ -94,6 +533,10 @@ TEST_F(FirstVisitMCActionValuePredictor,
     test_case.check(evaluator);
 }
 
+TEST_F(FirstVisitMCActionValuePredictor, thread_count_reproducible) {
+    rl::test::check_thread_count_reproducible(evaluator);
+}
+
 //----------------------------------------------------------------------------------------------
 // Every-visit Monte Carlo off-policy importance sampling state-action value function evaluator.
 //----------------------------------------------------------------------------------------------
@@ -108,6 +551,59 @@ TEST_F(MCEvaluator3, grid_world1) {
     test_case.check(evaluator);
 }
 
+/**
+ * The target policy is deterministic, so the returns that get a non-zero weight don't vary. Every
+ * pair's estimate is certain after MIN_VARIANCE_VISIT visits, which takes fewer trials than the
+ * MIN_VISIT of the default scheduling.
+ */
+TEST_F(MCEvaluator3, grid_world1_variance_scheduling) {
+    // Setup
+    rl::test::GridWorldTest1 test_case;
+    evaluator.set_variance_scheduling(1e-3);
+    // Test
+    test_case.check(evaluator);
+    ASSERT_EQ(rl::MCEvaluator3::StartScheduling::VARIANCE, evaluator.start_scheduling());
+    ASSERT_LE(evaluator.steps_done(), rl::MCEvaluator3::MIN_VARIANCE_VISIT);
+}
+
+TEST_F(MCEvaluator3, grid_world1_truncated_trials) {
+    // Setup
+    rl::test::GridWorldTest1 test_case;
+    evaluator.set_truncated_trials(true);
+    // Test
+    test_case.check(evaluator);
+    ASSERT_TRUE(evaluator.truncated_trials());
+}
+
+/**
+ * The target policy and the grid are deterministic, so every update uses the exact return and
+ * both estimators end with the same values. Truncation stops simulating a trial at the first
+ * action the target policy wouldn't take, so it simulates fewer actions.
+ */
+TEST_F(MCEvaluator3, truncated_trials_match_full_trials) {
+    // Setup
+    const int height = 12;
+    rl::GridWorld<height, 1> grid_world{rl::GridWorldBoundsBehaviour::TRANSITION_TO_CURRENT};
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{height - 1, 0}));
+    grid_world.set_all_rewards_to(-1.0);
+    rl::DeterministicLambdaPolicy down_up_policy = rl::test::create_down_up_policy(grid_world);
+    rl::MCEvaluator3 truncating_evaluator;
+    truncating_evaluator.set_truncated_trials(true);
+    rl::util::random::reseed_generator(1);
+    const rl::ActionValueTable& full = rl::evaluate(evaluator, grid_world, down_up_policy);
+    rl::util::random::reseed_generator(1);
+    const rl::ActionValueTable& truncated =
+            rl::evaluate(truncating_evaluator, grid_world, down_up_policy);
+
+    // Test
+    ASSERT_LT(truncating_evaluator.simulated_action_count(), evaluator.simulated_action_count());
+    for(const rl::State& s : grid_world.states()) {
+        for(const rl::Action& a : grid_world.actions()) {
+            ASSERT_EQ(full.value(s, a), truncated.value(s, a));
+        }
+    }
+}
+
 TEST_F(MCEvaluator3, blackjack_specific_case1_LONG_RUNNING) {
     // Setup
     rl::test::BlackjackSpecificCase test_case;
@@ -134,6 +630,67 @@ TEST_F(TDEvaluator, grid_world1) {
     test_case.check(evaluator);
 }
 
+TEST_F(TDEvaluator, grid_world1_pair_retirement) {
+    // Setup
+    rl::test::GridWorldTest1 test_case;
+    evaluator.set_pair_retirement(true, 5);
+    // Test
+    test_case.check(evaluator);
+    ASSERT_GT(evaluator.retired_pair_count(), 0);
+}
+
+/**
+ * As for the FirstVisitMCActionValuePredictor, the trials of a looping policy are bounded.
+ */
+TEST_F(TDEvaluator, looping_policy_trial_limits) {
+    // Setup
+    rl::GridWorld<1, 3> grid_world{rl::GridWorldBoundsBehaviour::TRANSITION_TO_CURRENT};
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{0, 0}));
+    grid_world.set_all_rewards_to(-1.0);
+    rl::DeterministicLambdaPolicy right_policy(
+            [](const rl::Environment& env, const rl::State&) -> const rl::Action& {
+                return env.action(grid::Direction::RIGHT);
+            });
+    evaluator.set_trial_limits(rl::TrialLimits{rl::TrialLimits::NO_MAX_LENGTH, true});
+    const rl::State& middle = grid_world.pos_to_state(grid::Position{0, 1});
+
+    // Test
+    evaluator.initialize(grid_world, right_policy);
+    for(int i = 0; i < 10; i++) {
+        evaluator.step();
+    }
+    ASSERT_GT(evaluator.truncated_trial_count(), 0);
+    ASSERT_DOUBLE_EQ(-1.0, evaluator.value_function().value(
+            middle, grid_world.action(grid::Direction::LEFT)));
+}
+
+TEST_F(TDEvaluator, cycle_last_step_bootstraps) {
+    // Setup
+    rl::GridWorld<1, 2> grid_world{rl::GridWorldBoundsBehaviour::TRANSITION_TO_CURRENT};
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{0, 0}));
+    grid_world.set_all_rewards_to(-1.0);
+    rl::DeterministicLambdaPolicy right_policy(
+            [](const rl::Environment& env, const rl::State&) -> const rl::Action& {
+                return env.action(grid::Direction::RIGHT);
+            });
+    const rl::State& right = grid_world.pos_to_state(grid::Position{0, 1});
+    const rl::Action& right_action = grid_world.action(grid::Direction::RIGHT);
+
+    // Test
+    // Without a max_length, the step that closes the cycle is a valid update, which bootstraps
+    // off the value of the repeated state.
+    evaluator.set_trial_limits(rl::TrialLimits{rl::TrialLimits::NO_MAX_LENGTH, true});
+    evaluator.initialize(grid_world, right_policy);
+    evaluator.step();
+    ASSERT_LT(evaluator.value_function().value(right, right_action), -1.0);
+    // With a max_length, that step's reward would include the rewards up to the horizon, so
+    // it is dropped and only the first step of the trial updates the value.
+    evaluator.set_trial_limits(rl::TrialLimits{50, true});
+    evaluator.initialize(grid_world, right_policy);
+    evaluator.step();
+    ASSERT_DOUBLE_EQ(-1.0, evaluator.value_function().value(right, right_action));
+}
+
 TEST_F(TDEvaluator, blackjack_specific_case1) {
     // Setup
     rl::test::BlackjackSpecificCase test_case;
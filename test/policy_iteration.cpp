@@ -29,22 +29,22 @@ void check_policy_action(const rl::Policy& policy, const rl::Environment& env,
                          const rl::State& in_state,
                          rl::test::TestEnvironment::OptimalActions optimal_actions) {
     rl::Policy::ActionDistribution action_dist = policy.possible_actions(env, in_state);
-    auto weight_map = action_dist.weight_map();
+    auto entries = action_dist.entries();
     // End states shouldn't have an action.
     if(optimal_actions.empty()) {
-        ASSERT_TRUE(weight_map.empty());
+        ASSERT_TRUE(entries.empty());
         // There is nothing left to test for end states.
         return;
     }
     // The policy must not contain more actions than the optimal policy set.
-    ASSERT_GE(optimal_actions.size(), weight_map.size());
+    ASSERT_GE(optimal_actions.size(), static_cast<std::size_t>(entries.size()));
     // The policy's actions should be an optimal action.
-    for(auto entry : weight_map) {
-        const rl::Action& policy_action = *CHECK_NOTNULL(entry.first);
+    for(const rl::Policy::ActionWeight& entry : entries) {
+        const rl::Action& policy_action = *CHECK_NOTNULL(entry.action);
         ASSERT_TRUE(optimal_actions.count(policy_action.id()))
         << "Testing state: " << in_state.name() << " "
         << "correct: " << env.action(*optimal_actions.begin()).name()
-        << ", actual: " << entry.first->name();
+        << ", actual: " << entry.action->name();
     }
 }
 
@@ -83,13 +83,20 @@ TEST(PolicyImprovers, policy_iterator_LONG_RUNNING) {
 
 TEST(PolicyImprovers, action_value_policy_iterator_LONG_RUNNING) {
     rl::ActionValuePolicyImprover improver;
-    // FIXME: A Monte Carlo evaluator of deterministic policy on a deterministic environment
-    //        has a high chance of encountering an infinite trial unless loop detection is
-    //        implemented.
-    //test_improver(improver, rl::test::Exercise4_1(), rl::test::FirstValidActionPolicy());
     test_improver(improver, rl::test::suttonbarto::Exercise5_1(), rl::RandomPolicy());
 }
 
+/**
+ * A Monte Carlo evaluator of a deterministic policy on a deterministic environment would likely
+ * run an infinite trial without trial limits.
+ */
+TEST(PolicyImprovers, action_value_policy_iterator_trial_limits) {
+    rl::ActionValuePolicyImprover improver;
+    improver.set_trial_limits(rl::TrialLimits{100, true});
+    test_improver(improver, rl::test::suttonbarto::Exercise4_1(),
+                  rl::test::FirstValidActionPolicy());
+}
+
 TEST(PolicyImprovers, action_value_iterator_with_MCEvalutar3_LONG_RUNNING) {
     // Setup
     rl::ActionValuePolicyImprover improver;
@@ -178,4 +185,31 @@ TEST(PolicyImprovers, example6_6) {
         check_policy_action(*p_qlearning_policy, test_case.env(), state,
                 test_case.optimal_actions(state));
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Q-learning only visits the states reachable from the start state, so a sparse table stores
+ * fewer rows than there are states. In a corridor, the states past the end state are unreachable.
+ */
+TEST(PolicyImprovers, qlearning_sparse_tables) {
+    // Setup
+    rl::GridWorld<1, 64> corridor;
+    const grid::Position start{0, 0};
+    const grid::Position end{0, 3};
+    corridor.set_start_state(corridor.pos_to_state(start));
+    corridor.mark_as_end_state(corridor.pos_to_state(end));
+    corridor.set_all_rewards_to(-1.0);
+    rl::QLearningImprover improver;
+    improver.set_iteration_count(200);
+    rl::ActionValueTable value_function = rl::ActionValueTable::create_sparse(corridor);
+    rl::util::random::reseed_generator(1);
+
+    // Test
+    std::unique_ptr<rl::Policy> p_policy = improver.improve_using(corridor, value_function);
+    // Only the rows of the 3 states before the end state are stored.
+    ASSERT_EQ(3, value_function.sparse_row_count());
+    ASSERT_LT(static_cast<long>(value_function.sparse_row_count()), corridor.state_count());
+    // The learned policy takes the shortest route.
+    rl::Trace trace = rl::run_trial(corridor, *p_policy);
+    ASSERT_EQ(4, trace.size());
+}
@@ -0,0 +1,146 @@
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "util/random.h"
+#include "util/RandomEngines.h"
+
+using rl::util::random::Engine;
+using rl::util::random::Generator;
+
+/**
+ * Tests the Philox4x32-10 block function against the known answers from the Random123 library.
+ */
+TEST(RandomEngines, philox_known_answers) {
+    // Setup
+    const std::uint32_t zero_key[2] = {0, 0};
+    const std::uint32_t zero_counter[4] = {0, 0, 0, 0};
+    const std::uint32_t ones_key[2] = {0xFFFFFFFF, 0xFFFFFFFF};
+    const std::uint32_t ones_counter[4] = {0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF};
+    std::uint32_t out[4];
+
+    // Test
+    rl::util::random::Philox4x32::block(zero_key, zero_counter, out);
+    ASSERT_EQ(0x6627E8D5u, out[0]);
+    ASSERT_EQ(0xE169C58Du, out[1]);
+    ASSERT_EQ(0xBC57AC4Cu, out[2]);
+    ASSERT_EQ(0x9B00DBD8u, out[3]);
+    rl::util::random::Philox4x32::block(ones_key, ones_counter, out);
+    ASSERT_EQ(0x408F276Du, out[0]);
+    ASSERT_EQ(0x41C83B0Eu, out[1]);
+    ASSERT_EQ(0xA20BC7C6u, out[2]);
+    ASSERT_EQ(0x6D5451FDu, out[3]);
+}
+
+/**
+ * Tests that a Philox jump gives the next stream, and that a PCG64 advance matches stepping.
+ */
+TEST(RandomEngines, jumps) {
+    // Setup
+    rl::util::random::Philox4x32 philox(42, 7);
+    rl::util::random::Philox4x32 next_stream(42, 8);
+    rl::util::random::Pcg64 pcg(42);
+    rl::util::random::Pcg64 stepped = pcg;
+
+    // Test
+    for(int i = 0; i < 6; i++) {
+        philox();
+        next_stream();
+    }
+    philox.jump();
+    ASSERT_TRUE(philox == next_stream);
+    ASSERT_EQ(next_stream(), philox());
+    for(int i = 0; i < 1000; i++) {
+        stepped();
+    }
+    pcg.advance(1000);
+    ASSERT_TRUE(pcg == stepped);
+    ASSERT_EQ(stepped(), pcg());
+}
+
+/**
+ * Tests that the default engine gives the std::mt19937 sequence, so seeded results are unchanged.
+ */
+TEST(Generator, mt19937_sequence) {
+    // Setup
+    Generator generator(Engine::MT19937, 1);
+    std::mt19937 expected(1);
+
+    // Test
+    for(int i = 0; i < 1000; i++) {
+        ASSERT_EQ(expected(), generator());
+    }
+    ASSERT_THROW(generator.jump(), std::logic_error);
+}
+
+/**
+ * Tests that split() gives a stream that is reproducible and different from the parent's.
+ */
+TEST(Generator, split) {
+    for(Engine engine : {Engine::MT19937, Engine::XOSHIRO256, Engine::PCG64, Engine::PHILOX}) {
+        // Setup
+        Generator a(engine, 3);
+        Generator b(engine, 3);
+
+        // Test
+        Generator child_a = a.split();
+        Generator child_b = b.split();
+        ASSERT_EQ(engine, child_a.engine());
+        bool all_equal = true;
+        for(int i = 0; i < 100; i++) {
+            Generator::result_type c = child_a();
+            ASSERT_EQ(c, child_b());
+            Generator::result_type p = a();
+            ASSERT_EQ(p, b());
+            all_equal = all_equal and c == p;
+        }
+        ASSERT_FALSE(all_equal);
+    }
+}
+
+TEST(Generator, fill_uniform) {
+    for(Engine engine : {Engine::MT19937, Engine::XOSHIRO256, Engine::PCG64, Engine::PHILOX}) {
+        // Setup
+        Generator generator(engine, 5);
+        std::vector<double> buffer(10000);
+
+        // Test
+        generator.fill_uniform(buffer.data(), buffer.data() + buffer.size());
+        double sum = 0;
+        for(double u : buffer) {
+            ASSERT_GE(u, 0.0);
+            ASSERT_LT(u, 1.0);
+            sum += u;
+        }
+        ASSERT_NEAR(0.5, sum / buffer.size(), 0.01);
+    }
+}
+
+/**
+ * Tests that a ScopedGenerator replaces the thread's generator, and that reseed_generator() keeps
+ * the selected engine.
+ */
+TEST(Generator, scoped_generator) {
+    // Setup
+    rl::util::random::set_engine(Engine::XOSHIRO256, 9);
+    Generator expected(Engine::XOSHIRO256, 9);
+    Generator scoped(Engine::PHILOX, 9);
+    Generator expected_scoped(Engine::PHILOX, 9);
+
+    // Test
+    ASSERT_EQ(expected(), rl::util::random::generator()());
+    {
+        rl::util::random::ScopedGenerator scope(scoped);
+        ASSERT_EQ(&scoped, &rl::util::random::generator());
+        ASSERT_EQ(expected_scoped(), rl::util::random::generator()());
+    }
+    ASSERT_EQ(expected(), rl::util::random::generator()());
+    rl::util::random::reseed_generator(9);
+    ASSERT_EQ(Engine::XOSHIRO256, rl::util::random::generator().engine());
+    ASSERT_EQ(Generator(Engine::XOSHIRO256, 9)(), rl::util::random::generator()());
+    // Restore the default engine for the other tests.
+    rl::util::random::set_engine(Engine::MT19937, Generator::DEFAULT_SEED);
+}
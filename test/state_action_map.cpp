@@ -0,0 +1,45 @@
+#include <algorithm>
+
+#include "gtest/gtest.h"
+
+#include "rl/GridWorld.h"
+#include "rl/StateActionMap.h"
+
+/**
+ * Tests that a CompactStateActionMap stores exactly the allowed pairs of non-end states, and that
+ * each live pair has its own entry.
+ */
+TEST(CompactStateActionMap, stores_only_live_pairs) {
+    // Setup
+    rl::GridWorld<3, 3> grid_world(rl::GridWorldBoundsBehaviour::NO_OUT_OF_BOUNDS);
+    const rl::State& end_state = grid_world.pos_to_state(grid::Position{2, 2});
+    grid_world.mark_as_end_state(end_state);
+    rl::CompactStateActionMap<long> map(grid_world, -1);
+    long live_count = 0;
+    for(const rl::State& s : grid_world.states()) {
+        for(const rl::Action& a : grid_world.actions()) {
+            if(!grid_world.is_end_state(s) and grid_world.is_action_allowed(s, a)) {
+                map.set(s, a, live_count++);
+            }
+        }
+    }
+
+    // Test
+    // Corner and edge tiles have disallowed actions, so not all rows are full.
+    ASSERT_LT(live_count, (grid_world.state_count() - 1) * grid_world.action_count());
+    ASSERT_EQ(live_count, map.size());
+    long expected = 0;
+    for(const rl::State& s : grid_world.states()) {
+        for(const rl::Action& a : grid_world.actions()) {
+            if(!grid_world.is_end_state(s) and grid_world.is_action_allowed(s, a)) {
+                ASSERT_EQ(expected, map.data(s, a));
+                ASSERT_EQ(expected, map[map.index(s, a)]);
+                expected++;
+            } else {
+                ASSERT_EQ(rl::CompactStateActionMap<long>::NO_INDEX, map.index(s, a));
+            }
+        }
+    }
+    // Reductions only see the live entries.
+    ASSERT_EQ(0, *std::min_element(std::begin(map.data()), std::end(map.data())));
+}
@@ -0,0 +1,167 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "rl/DeterministicPolicy.h"
+#include "rl/GridWorld.h"
+#include "rl/RandomPolicy.h"
+#include "rl/Trial.h"
+#include "util/random.h"
+
+/**
+ * Tests that run_trial() into a TraceBuffer records the same steps as the Trace version, and that
+ * reusing the buffer replaces its contents.
+ */
+TEST(Trial, trace_buffer_matches_trace) {
+    // Setup
+    rl::GridWorld<4, 4> grid_world;
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{3, 3}));
+    rl::RandomPolicy policy;
+    const rl::State& start_state = grid_world.pos_to_state(grid::Position{1, 2});
+    const rl::Action& start_action = grid_world.action(0);
+    rl::TraceBuffer buffer;
+    // Fill the buffer with a different trial first.
+    rl::run_trial(grid_world, policy, buffer);
+    const int trial_count = 20;
+
+    // Test
+    for(int t = 0; t < trial_count; t++) {
+        rl::util::random::reseed_generator(t);
+        rl::Trace trace = rl::run_trial(grid_world, policy, &start_state, &start_action);
+        rl::util::random::reseed_generator(t);
+        rl::run_trial(grid_world, policy, buffer, &start_state, &start_action);
+        ASSERT_EQ(trace.size(), buffer.size());
+        for(std::size_t i = 0; i < trace.size(); i++) {
+            ASSERT_EQ(trace[i].state.id(), buffer.state_id(i));
+            rl::ID action_id = trace[i].action ? trace[i].action->id()
+                                               : rl::TraceBuffer::NO_ACTION;
+            ASSERT_EQ(action_id, buffer.action_id(i));
+            ASSERT_EQ(trace[i].reward, buffer.reward(i));
+        }
+    }
+}
+
+/**
+ * Tests that record_trial_while() stops when the record function returns false, before the
+ * rejected action is executed, and otherwise runs to the end state.
+ */
+TEST(Trial, record_trial_while_stops) {
+    // Setup
+    rl::GridWorld<4, 4> grid_world;
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{3, 3}));
+    rl::RandomPolicy policy;
+    const rl::State& start_state = grid_world.pos_to_state(grid::Position{0, 0});
+    rl::util::random::reseed_generator(1);
+    int recorded = 0;
+    bool has_end_step = false;
+
+    // Test
+    rl::TrialEnd end = rl::impl::record_trial_while(
+            grid_world, policy, &start_state, nullptr,
+            [&recorded](const rl::State&, const rl::Action*, double) {
+                return ++recorded < 3;
+            });
+    ASSERT_EQ(rl::TrialEnd::STOPPED, end);
+    ASSERT_EQ(3, recorded);
+    recorded = 0;
+    end = rl::impl::record_trial_while(
+            grid_world, policy, &start_state, nullptr,
+            [&](const rl::State& state, const rl::Action* action, double) {
+                recorded++;
+                has_end_step = !action and grid_world.is_end_state(state);
+                return true;
+            });
+    ASSERT_EQ(rl::TrialEnd::END_STATE, end);
+    ASSERT_TRUE(has_end_step);
+    ASSERT_GT(recorded, 1);
+}
+
+/**
+ * Tests the trial limits with a policy that walks into the top wall of a grid world, where it
+ * stays forever.
+ */
+TEST(Trial, trial_limits) {
+    // Setup
+    rl::GridWorld<3, 3> grid_world{rl::GridWorldBoundsBehaviour::TRANSITION_TO_CURRENT};
+    grid_world.mark_as_end_state(grid_world.pos_to_state(grid::Position{2, 2}));
+    grid_world.set_all_rewards_to(-1.0);
+    rl::DeterministicLambdaPolicy up_policy(
+            [](const rl::Environment& env, const rl::State&) -> const rl::Action& {
+                return env.action(grid::Direction::UP);
+            });
+    const rl::State& start_state = grid_world.pos_to_state(grid::Position{2, 1});
+    rl::TraceBuffer buffer;
+    const long max_length = 50;
+
+    // Test
+    // The horizon alone.
+    rl::TrialEnd end = rl::run_trial(grid_world, up_policy, buffer, &start_state, nullptr,
+                                     rl::TrialLimits{max_length, false});
+    ASSERT_EQ(rl::TrialEnd::MAX_LENGTH, end);
+    ASSERT_EQ(static_cast<std::size_t>(max_length + 1), buffer.size());
+    ASSERT_EQ(rl::TraceBuffer::NO_ACTION, buffer.action_ids().back());
+    double horizon_return = 0;
+    for(double r : buffer.rewards()) {
+        horizon_return += r;
+    }
+    ASSERT_EQ(-max_length, horizon_return);
+    // The cycle is found on the first return to the top row, and the rest of the horizon is added
+    // to the last reward.
+    end = rl::run_trial(grid_world, up_policy, buffer, &start_state, nullptr,
+                        rl::TrialLimits{max_length, true});
+    ASSERT_EQ(rl::TrialEnd::CYCLE, end);
+    ASSERT_EQ(4u, buffer.size());
+    ASSERT_EQ(grid_world.pos_to_state(grid::Position{0, 1}).id(), buffer.state_ids().back());
+    double cycle_return = 0;
+    for(double r : buffer.rewards()) {
+        cycle_return += r;
+    }
+    ASSERT_EQ(horizon_return, cycle_return);
+    // Without a horizon, the last reward is that of entering the repeated state.
+    end = rl::run_trial(grid_world, up_policy, buffer, &start_state, nullptr,
+                        rl::TrialLimits{rl::TrialLimits::NO_MAX_LENGTH, true});
+    ASSERT_EQ(rl::TrialEnd::CYCLE, end);
+    ASSERT_EQ(-1.0, buffer.rewards().back());
+    // A stochastic policy isn't stopped, as it can leave the top row.
+    rl::RandomPolicy random_policy;
+    rl::util::random::reseed_generator(1);
+    end = rl::run_trial(grid_world, random_policy, buffer, &start_state, nullptr,
+                        rl::TrialLimits{rl::TrialLimits::NO_MAX_LENGTH, true});
+    ASSERT_EQ(rl::TrialEnd::END_STATE, end);
+}
+
+/**
+ * Tests that FirstVisitIndex keeps the first step of each key, and forgets the visits of the
+ * previous trace, in both modes.
+ */
+TEST(FirstVisitIndex, first_steps) {
+    for(bool sparse : {false, true}) {
+        // Setup
+        rl::FirstVisitIndex index;
+        if(sparse) {
+            index.reset_sparse();
+        } else {
+            index.reset(10);
+        }
+        const std::vector<long> first_trace = {3, 5, 3, 7, 5};
+        const std::vector<long> second_trace = {5, 9};
+
+        // Test
+        index.next_trace();
+        for(int i = 0; i < static_cast<int>(first_trace.size()); i++) {
+            index.visit(first_trace[i], i);
+        }
+        ASSERT_EQ(0, index.first_step(3));
+        ASSERT_EQ(1, index.first_step(5));
+        ASSERT_EQ(3, index.first_step(7));
+        ASSERT_EQ(rl::FirstVisitIndex::NOT_VISITED, index.first_step(9));
+        index.next_trace();
+        for(int i = 0; i < static_cast<int>(second_trace.size()); i++) {
+            index.visit(second_trace[i], i);
+        }
+        ASSERT_EQ(rl::FirstVisitIndex::NOT_VISITED, index.first_step(3));
+        ASSERT_EQ(0, index.first_step(5));
+        ASSERT_EQ(rl::FirstVisitIndex::NOT_VISITED, index.first_step(7));
+        ASSERT_EQ(1, index.first_step(9));
+    }
+}